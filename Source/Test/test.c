@@ -40,9 +40,10 @@ typedef struct {
 	const char *backing;
 } test_context_t;
 
-const char *test_backingpath(const char *path, test_context_t *context);
-const char *test_backingpath(const char *path, test_context_t *context) {
-	static char result[PATH_MAX];
+// the callbacks can be called from several threads at once, so the caller
+// provides the storage for the result.
+const char *test_backingpath(const char *path, test_context_t *context, char result[PATH_MAX]);
+const char *test_backingpath(const char *path, test_context_t *context, char result[PATH_MAX]) {
 	snprintf(result, PATH_MAX, "%s%s", context->backing, path);
 	return result;
 }
@@ -51,7 +52,7 @@ bool test_statfs(const char *path, kfsstatfs_t *result, void *context);
 bool test_statfs(const char *path, kfsstatfs_t *result, void *context) {
 	bool success = false;
 	struct statfs sbuf;
-	if (statfs(test_backingpath(path, context), &sbuf) == 0) {
+	if (statfs(test_backingpath(path, context, (char [PATH_MAX]){}), &sbuf) == 0) {
 		result->free = sbuf.f_bfree;
 		result->size = sbuf.f_bsize;
 		success = true;
@@ -63,7 +64,7 @@ bool test_stat(const char *path, kfsstat_t *result, void *context);
 bool test_stat(const char *path, kfsstat_t *result, void *context) {
 	bool success = false;
 	struct stat sbuf;
-	if (lstat(test_backingpath(path, context), &sbuf) == 0) {
+	if (lstat(test_backingpath(path, context, (char [PATH_MAX]){}), &sbuf) == 0) {
 		result->size = sbuf.st_size;
 		result->atime = (kfstime_t){ sbuf.st_atimespec.tv_sec, sbuf.st_atimespec.tv_nsec };
 		result->mtime = (kfstime_t){ sbuf.st_mtimespec.tv_sec, sbuf.st_mtimespec.tv_nsec };
@@ -95,40 +96,71 @@ bool test_stat(const char *path, kfsstat_t *result, void *context) {
 	return success;
 }
 
-ssize_t test_read(const char *path, char *buf, size_t offset, size_t length, void *context);
-ssize_t test_read(const char *path, char *buf, size_t offset, size_t length, void *context) {
-	ssize_t result = -1;
-	int fd = open(test_backingpath(path, context), O_RDONLY);
-	if (fd >= 0) {
-		lseek(fd, offset, SEEK_SET);
-		result = read(fd, buf, length);
-		close(fd);
-	}
+// files are opened once for a run of reads and writes, and the descriptor is
+// kept as the handle.
+bool test_open(const char *path, void **handle, int *error, void *context);
+bool test_open(const char *path, void **handle, int *error, void *context) {
+	const char *backing = test_backingpath(path, context, (char [PATH_MAX]){});
+	int fd = open(backing, O_RDWR);
+	if (fd < 0 && errno == EACCES) { fd = open(backing, O_RDONLY); }
+	if (fd < 0) { *error = errno; return false; }
+	*handle = malloc(sizeof(int));
+	*(int *)*handle = fd;
+	return true;
+}
+
+void test_release(const char *path, void *handle, void *context);
+void test_release(const char *path, void *handle, void *context) {
+	close(*(int *)handle);
+	free(handle);
+}
+
+ssize_t test_read(const char *path, void *handle, char *buf, size_t offset, size_t length, int *error, void *context);
+ssize_t test_read(const char *path, void *handle, char *buf, size_t offset, size_t length, int *error, void *context) {
+	ssize_t result = pread(*(int *)handle, buf, length, offset);
+	if (result < 0) { *error = errno; }
 	return result;
 }
 
-ssize_t test_write(const char *path, const char *buf, size_t offset, size_t length, void *context);
-ssize_t test_write(const char *path, const char *buf, size_t offset, size_t length, void *context) {
+// reads are sent straight from the backing file
+ssize_t test_read_file(const char *path, void *handle, size_t offset, size_t length, int *fd, off_t *fdoffset, int *error, void *context);
+ssize_t test_read_file(const char *path, void *handle, size_t offset, size_t length, int *fd, off_t *fdoffset, int *error, void *context) {
 	ssize_t result = -1;
-	int fd = open(test_backingpath(path, context), O_WRONLY);
-	if (fd >= 0) {
-		lseek(fd, offset, SEEK_SET);
-		result = write(fd, buf, length);
-		close(fd);
+	struct stat sbuf;
+	*fd = *(int *)handle;
+	if (fstat(*fd, &sbuf) == 0) {
+		*fdoffset = offset;
+		result = (offset < sbuf.st_size) ? MIN(length, sbuf.st_size - offset) : 0;
 	}
+	else { *error = errno; }
 	return result;
 }
 
+ssize_t test_write(const char *path, void *handle, const char *buf, size_t offset, size_t length, int *error, void *context);
+ssize_t test_write(const char *path, void *handle, const char *buf, size_t offset, size_t length, int *error, void *context) {
+	ssize_t result = pwrite(*(int *)handle, buf, length, offset);
+	if (result < 0) { *error = errno; }
+	return result;
+}
+
+// the same write, for a filesystem that only writes asynchronously
+void test_write_async(const char *path, void *handle, const char *buf, size_t offset, size_t length, kfsreq_t *req, void *context);
+void test_write_async(const char *path, void *handle, const char *buf, size_t offset, size_t length, kfsreq_t *req, void *context) {
+	int error = 0;
+	ssize_t result = test_write(path, handle, buf, offset, length, &error, context);
+	kfs_complete(req, result, error);
+}
+
 bool test_symlink(const char *path, const char *value, void *context);
 bool test_symlink(const char *path, const char *value, void *context) {
-	return symlink(value, test_backingpath(path, context)) == 0;
+	return symlink(value, test_backingpath(path, context, (char [PATH_MAX]){})) == 0;
 }
 
 bool test_readlink(const char *path, char **value, void *context);
 bool test_readlink(const char *path, char **value, void *context) {
 	bool success = false;
 	char *result = malloc(sizeof(char) * PATH_MAX);
-	ssize_t length = readlink(test_backingpath(path, context), result, PATH_MAX);
+	ssize_t length = readlink(test_backingpath(path, context, (char [PATH_MAX]){}), result, PATH_MAX);
 	if (length >= 0 && length < PATH_MAX) {
 		result[length] = '\0';
 		success = true;
@@ -140,7 +172,7 @@ bool test_readlink(const char *path, char **value, void *context) {
 bool test_create(const char *path, void *context);
 bool test_create(const char *path, void *context) {
 	bool success = false;
-	int fd = open(test_backingpath(path, context), O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	int fd = open(test_backingpath(path, context, (char [PATH_MAX]){}), O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
 	if (fd >= 0) {
 		close(fd);
 		success = true;
@@ -150,21 +182,20 @@ bool test_create(const char *path, void *context) {
 
 bool test_remove(const char *path, void *context);
 bool test_remove(const char *path, void *context) {
-	return unlink(test_backingpath(path, context)) == 0;
+	return unlink(test_backingpath(path, context, (char [PATH_MAX]){})) == 0;
 }
 
 bool test_rename(const char *path, const char *new_path, void *context);
 bool test_rename(const char *path, const char *new_path, void *context) {
-	// need to dup the to path since test backing stores value in a static buffer
-	char *to = strdup(test_backingpath(new_path, context));
-	int result = rename(test_backingpath(path, context), to);
-	free(to);
-	return result == 0;
+	return rename(test_backingpath(path, context, (char [PATH_MAX]){}),
+				  test_backingpath(new_path, context, (char [PATH_MAX]){})) == 0;
 }
 
-bool test_truncate(const char *path, uint64_t size, void *context);
-bool test_truncate(const char *path, uint64_t size, void *context) {
-	return truncate(test_backingpath(path, context), size) == 0;
+bool test_truncate(const char *path, void *handle, uint64_t size, int *error, void *context);
+bool test_truncate(const char *path, void *handle, uint64_t size, int *error, void *context) {
+	bool success = (ftruncate(*(int *)handle, size) == 0);
+	if (!success) { *error = errno; }
+	return success;
 }
 
 bool test_chmod(const char *path, kfsmode_t mode, void *context);
@@ -179,7 +210,7 @@ bool test_chmod(const char *path, kfsmode_t mode, void *context) {
 	if (mode & KFS_IROTH) { set |= S_IROTH; }
 	if (mode & KFS_IWOTH) { set |= S_IWOTH; }
 	if (mode & KFS_IXOTH) { set |= S_IXOTH; }
-	return chmod(test_backingpath(path, context), set) == 0;
+	return chmod(test_backingpath(path, context, (char [PATH_MAX]){}), set) == 0;
 }
 
 bool test_utimes(const char *path, const kfstime_t *atime, const kfstime_t *mtime, void *context);
@@ -195,23 +226,23 @@ bool test_utimes(const char *path, const kfstime_t *atime, const kfstime_t *mtim
 		times[1].tv_sec = mtime->sec;
 		times[1].tv_usec = mtime->nsec / 1000.0;
 	}
-	return utimes(test_backingpath(path, context), times) == 0;
+	return utimes(test_backingpath(path, context, (char [PATH_MAX]){}), times) == 0;
 }
 
 bool test_mkdir(const char *path, void *context);
 bool test_mkdir(const char *path, void *context) {
-	return mkdir(test_backingpath(path, context), S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == 0;
+	return mkdir(test_backingpath(path, context, (char [PATH_MAX]){}), S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == 0;
 }
 
 bool test_rmdir(const char *path, void *context);
 bool test_rmdir(const char *path, void *context) {
-	return rmdir(test_backingpath(path, context)) == 0;
+	return rmdir(test_backingpath(path, context, (char [PATH_MAX]){})) == 0;
 }
 
 bool test_readdir(const char *path, kfscontents_t *contents, void *context);
 bool test_readdir(const char *path, kfscontents_t *contents, void *context) {
 	bool success = false;
-	DIR *dir = opendir(test_backingpath(path, context));
+	DIR *dir = opendir(test_backingpath(path, context, (char [PATH_MAX]){}));
 	if (dir) {
 		struct dirent *entry = NULL;
 		while ((entry = readdir(dir))) {
@@ -257,6 +288,7 @@ int main() {
 		.statfs = test_statfs,
 		.stat = test_stat,
 		.read = test_read,
+		.read_file = test_read_file,
 		.write = test_write,
 		.symlink = test_symlink,
 		.readlink = test_readlink,
@@ -269,6 +301,8 @@ int main() {
 		.mkdir = test_mkdir,
 		.rmdir = test_rmdir,
 		.readdir = test_readdir,
+		.open = test_open,
+		.release = test_release,
 		.options = {
 			.mountpoint = "/tmp/kfstest/mount",
 		},
@@ -278,8 +312,19 @@ int main() {
 	kfsid_t fsid = kfs_mount(&filesystem);
 	if (fsid < 0) { kfs_perror("mount"); return 1; }
 
+	// the same files, through a filesystem that only has write_async but asks for writeback
+	kfsfilesystem_t asyncfilesystem = filesystem;
+	asyncfilesystem.write = NULL;
+	asyncfilesystem.write_async = test_write_async;
+	asyncfilesystem.options.mountpoint = "/tmp/kfstest/async";
+	asyncfilesystem.options.writeback = 256;
+
+	kfsid_t asyncid = kfs_mount(&asyncfilesystem);
+	if (asyncid < 0) { kfs_perror("mount"); kfs_unmount(fsid); return 1; }
+
 	int result = runtests();
 
+	kfs_unmount(asyncid);
 	kfs_unmount(fsid);
 
 	// cleanup
@@ -346,5 +391,13 @@ int runtests(void) {
 	cmdassert_empty("rm -r /tmp/kfstest/mount/dir", "recursive remove dir with contents");
 	cmdassert_match("rmdir /tmp/kfstest/mount/dir", "No such file or directory", "remove missing dir");
 	
+	// write through a filesystem with only write_async and writeback set
+	cmdassert_empty("echo hello async > /tmp/kfstest/async/file", "create file with write_async");
+	cmdassert_empty("dd if=/dev/zero of=/tmp/kfstest/async/file bs=4096 count=64 seek=1 2>/dev/null", "write file with write_async");
+	cmdassert_empty("sync", "sync file written with write_async");
+	cmdassert_empty("cmp /tmp/kfstest/async/file /tmp/kfstest/backing/file", "file not written with write_async");
+	cmdassert_match("stat -f '%z' /tmp/kfstest/backing/file", "266240", "file written with write_async has wrong size");
+	cmdassert_empty("rm /tmp/kfstest/async/file", "remove file written with write_async");
+	
 	return 0;
 }
@@ -0,0 +1,118 @@
+//
+//  arena.c
+//  KFS
+//
+//  Copyright (c) 2012, FadingRed LLC
+//  All rights reserved.
+//  
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+//  following conditions are met:
+//  
+//    - Redistributions of source code must retain the above copyright notice, this list of conditions and the
+//      following disclaimer.
+//    - Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+//      following disclaimer in the documentation and/or other materials provided with the distribution.
+//    - Neither the name of the FadingRed LLC nor the names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior written permission.
+//  
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+//  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define CHUNK_LEN		0x10000		/* 64K */
+#define RETAIN_LEN		0x80000		/* 512K */
+#define ALIGNMENT		16
+
+typedef struct kfschunk kfschunk_t;
+
+struct kfschunk {
+	kfschunk_t *next;
+	size_t capacity;
+	size_t used;
+	char data[] __attribute__((aligned(ALIGNMENT))); // so each allocation is aligned, not just its size
+};
+
+struct kfsarena {
+	kfschunk_t *chunks;
+	kfschunk_t *current;
+};
+
+
+#pragma mark -
+#pragma mark function implementation
+// ----------------------------------------------------------------------------------------------------
+// function implementation
+// ----------------------------------------------------------------------------------------------------
+
+kfsarena_t *kfsarena_create(void) {
+	return calloc(1, sizeof(kfsarena_t));
+}
+
+void kfsarena_destroy(kfsarena_t *arena) {
+	if (arena) {
+		kfschunk_t *chunk = arena->chunks;
+		while (chunk) {
+			kfschunk_t *next = chunk->next;
+			free(chunk);
+			chunk = next;
+		}
+		free(arena);
+	}
+}
+
+void *kfsarena_alloc(kfsarena_t *arena, size_t size) {
+	size = (size + (ALIGNMENT - 1)) & ~(size_t)(ALIGNMENT - 1);
+
+	// move through the chunks (kept from before the last reset) until we find
+	// one with enough room. only if we run out do we allocate a new chunk.
+	kfschunk_t *chunk = arena->current;
+	while (chunk && (chunk->capacity - chunk->used) < size) {
+		chunk = chunk->next;
+	}
+
+	if (chunk == NULL) {
+		size_t capacity = (size > CHUNK_LEN) ? size : CHUNK_LEN;
+		chunk = malloc(sizeof(kfschunk_t) + capacity);
+		chunk->capacity = capacity;
+		chunk->used = 0;
+		chunk->next = NULL;
+
+		kfschunk_t **link = &arena->chunks;
+		while (*link) { link = &(*link)->next; }
+		*link = chunk;
+	}
+
+	void *result = chunk->data + chunk->used;
+	chunk->used += size;
+	arena->current = chunk;
+
+	memset(result, 0, size);
+	return result;
+}
+
+void kfsarena_reset(kfsarena_t *arena) {
+	size_t retained = 0;
+	kfschunk_t **link = &arena->chunks;
+	while (*link) {
+		kfschunk_t *chunk = *link;
+		if (retained + chunk->capacity <= RETAIN_LEN) {
+			retained += chunk->capacity;
+			chunk->used = 0;
+			link = &chunk->next;
+		} else { // over the limit, give this one back
+			*link = chunk->next;
+			free(chunk);
+		}
+	}
+	arena->current = arena->chunks;
+}
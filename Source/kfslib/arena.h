@@ -0,0 +1,61 @@
+//
+//  arena.h
+//  KFS
+//
+//  Copyright (c) 2012, FadingRed LLC
+//  All rights reserved.
+//  
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+//  following conditions are met:
+//  
+//    - Redistributions of source code must retain the above copyright notice, this list of conditions and the
+//      following disclaimer.
+//    - Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+//      following disclaimer in the documentation and/or other materials provided with the distribution.
+//    - Neither the name of the FadingRed LLC nor the names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior written permission.
+//  
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+//  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _KFSARENA_H_
+#define _KFSARENA_H_
+
+#include "kfslib.h"
+
+typedef struct kfsarena kfsarena_t;
+
+/*!
+ \brief		Create an arena
+ \details	An arena hands out memory that is all released at once when the arena
+			is reset. It is not thread safe, so each thread should use its own.
+ */
+kfsarena_t *kfsarena_create(void);
+
+/*!
+ \brief		Destroy an arena
+ \details	Frees the arena and all memory allocated from it.
+ */
+void kfsarena_destroy(kfsarena_t *arena);
+
+/*!
+ \brief		Allocate memory
+ \details	Allocates zeroed memory from the arena. The memory remains valid until
+			the arena is reset.
+ */
+void *kfsarena_alloc(kfsarena_t *arena, size_t size);
+
+/*!
+ \brief		Reset an arena
+ \details	Releases all memory allocated from the arena. Memory is kept around to
+			be reused by later allocations (up to a limit).
+ */
+void kfsarena_reset(kfsarena_t *arena);
+
+#endif
@@ -0,0 +1,177 @@
+//
+//  attrcache.c
+//  KFS
+//
+//  Copyright (c) 2012, FadingRed LLC
+//  All rights reserved.
+//  
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+//  following conditions are met:
+//  
+//    - Redistributions of source code must retain the above copyright notice, this list of conditions and the
+//      following disclaimer.
+//    - Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+//      following disclaimer in the documentation and/or other materials provided with the distribution.
+//    - Neither the name of the FadingRed LLC nor the names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior written permission.
+//  
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+//  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+#include "attrcache.h"
+#include "internal.h"
+#include <stdlib.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#define ATTR_BUCKETS		1024
+#define ATTR_MAX_ENTRIES	4096
+#define ATTR_VERSIONS		4096
+
+typedef struct kfsattrentry kfsattrentry_t;
+struct kfsattrentry {
+	kfsid_t identifier;
+	uint64_t fileid;
+	fattr3 attributes;
+	uint64_t expires;		// in milliseconds
+	kfsattrentry_t *chain;	// next in the bucket
+	kfsattrentry_t *older;	// least recently stored first, for eviction
+	kfsattrentry_t *newer;
+};
+
+static kfsattrentry_t *buckets[ATTR_BUCKETS];
+static kfsattrentry_t *oldest = NULL;
+static kfsattrentry_t *newest = NULL;
+static unsigned int count = 0;
+static uint64_t versions[ATTR_VERSIONS];	// bumped when the attributes of a file that hashes there change
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+#pragma mark -
+#pragma mark entries
+// ----------------------------------------------------------------------------------------------------
+// entries
+// ----------------------------------------------------------------------------------------------------
+
+static uint64_t kfsattrcache_now(void);
+static uint64_t kfsattrcache_now(void) {
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_usec / 1000;
+}
+
+static kfsattrentry_t **kfsattrcache_bucket(kfsid_t identifier, uint64_t fileid);
+static kfsattrentry_t **kfsattrcache_bucket(kfsid_t identifier, uint64_t fileid) {
+	uint64_t hash = (fileid * 0x9E3779B97F4A7C15ull) ^ (uint64_t)identifier;
+	return &buckets[(hash >> 32) % ATTR_BUCKETS];
+}
+
+static uint64_t *kfsattrcache_version_slot(kfsid_t identifier, uint64_t fileid);
+static uint64_t *kfsattrcache_version_slot(kfsid_t identifier, uint64_t fileid) {
+	uint64_t hash = (fileid * 0x9E3779B97F4A7C15ull) ^ (uint64_t)identifier;
+	return &versions[(hash >> 32) % ATTR_VERSIONS];
+}
+
+static kfsattrentry_t *kfsattrcache_find_nolock(kfsid_t identifier, uint64_t fileid);
+static kfsattrentry_t *kfsattrcache_find_nolock(kfsid_t identifier, uint64_t fileid) {
+	kfsattrentry_t *entry = *kfsattrcache_bucket(identifier, fileid);
+	while (entry && !(entry->identifier == identifier && entry->fileid == fileid)) {
+		entry = entry->chain;
+	}
+	return entry;
+}
+
+// unlink and free the entry. the lock must be held.
+static void kfsattrcache_remove_nolock(kfsattrentry_t *entry);
+static void kfsattrcache_remove_nolock(kfsattrentry_t *entry) {
+	kfsattrentry_t **link = kfsattrcache_bucket(entry->identifier, entry->fileid);
+	while (*link != entry) { link = &(*link)->chain; }
+	*link = entry->chain;
+
+	if (entry->older) { entry->older->newer = entry->newer; }
+	else { oldest = entry->newer; }
+	if (entry->newer) { entry->newer->older = entry->older; }
+	else { newest = entry->older; }
+	count--;
+	free(entry);
+}
+
+
+#pragma mark -
+#pragma mark function implementation
+// ----------------------------------------------------------------------------------------------------
+// function implementation
+// ----------------------------------------------------------------------------------------------------
+
+uint64_t kfsattrcache_version(kfsid_t identifier, uint64_t fileid) {
+	pthread_mutex_lock(&lock);
+	uint64_t result = *kfsattrcache_version_slot(identifier, fileid);
+	pthread_mutex_unlock(&lock);
+	return result;
+}
+
+void kfsattrcache_set(kfsid_t identifier, const kfsfilesystem_t *filesystem, uint64_t fileid,
+	const fattr3 *attributes, uint64_t version) {
+	uint64_t timeout = kfsfilesystem_attr_timeout(filesystem);
+	pthread_mutex_lock(&lock);
+	if (version == *kfsattrcache_version_slot(identifier, fileid)) {
+		kfsattrentry_t *entry = kfsattrcache_find_nolock(identifier, fileid);
+		if (entry) { kfsattrcache_remove_nolock(entry); }
+
+		entry = malloc(sizeof(kfsattrentry_t));
+		entry->identifier = identifier;
+		entry->fileid = fileid;
+		entry->attributes = *attributes;
+		entry->expires = kfsattrcache_now() + timeout;
+
+		kfsattrentry_t **bucket = kfsattrcache_bucket(identifier, fileid);
+		entry->chain = *bucket;
+		*bucket = entry;
+		entry->older = newest;
+		entry->newer = NULL;
+		if (newest) { newest->newer = entry; }
+		else { oldest = entry; }
+		newest = entry;
+		count++;
+
+		while (count > ATTR_MAX_ENTRIES) { kfsattrcache_remove_nolock(oldest); }
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+bool kfsattrcache_get(kfsid_t identifier, uint64_t fileid, fattr3 *attributes) {
+	bool result = false;
+	pthread_mutex_lock(&lock);
+	kfsattrentry_t *entry = kfsattrcache_find_nolock(identifier, fileid);
+	if (entry && entry->expires <= kfsattrcache_now()) {
+		kfsattrcache_remove_nolock(entry);
+	} else if (entry) {
+		*attributes = entry->attributes;
+		result = true;
+	}
+	pthread_mutex_unlock(&lock);
+	return result;
+}
+
+void kfsattrcache_invalidate(kfsid_t identifier, uint64_t fileid) {
+	pthread_mutex_lock(&lock);
+	(*kfsattrcache_version_slot(identifier, fileid))++;
+	kfsattrentry_t *entry = kfsattrcache_find_nolock(identifier, fileid);
+	if (entry) { kfsattrcache_remove_nolock(entry); }
+	pthread_mutex_unlock(&lock);
+}
+
+void kfsattrcache_clear(kfsid_t identifier) {
+	pthread_mutex_lock(&lock);
+	for (unsigned int i = 0; i < ATTR_VERSIONS; i++) { versions[i]++; }
+	for (kfsattrentry_t *entry = oldest, *next = NULL; entry; entry = next) {
+		next = entry->newer;
+		if (entry->identifier == identifier) { kfsattrcache_remove_nolock(entry); }
+	}
+	pthread_mutex_unlock(&lock);
+}
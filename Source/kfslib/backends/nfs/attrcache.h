@@ -0,0 +1,69 @@
+//
+//  attrcache.h
+//  KFS
+//
+//  Copyright (c) 2012, FadingRed LLC
+//  All rights reserved.
+//  
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+//  following conditions are met:
+//  
+//    - Redistributions of source code must retain the above copyright notice, this list of conditions and the
+//      following disclaimer.
+//    - Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+//      following disclaimer in the documentation and/or other materials provided with the distribution.
+//    - Neither the name of the FadingRed LLC nor the names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior written permission.
+//  
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+//  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+#ifndef _KFSATTRCACHE_H_
+#define _KFSATTRCACHE_H_
+
+#include <stdbool.h>
+#include "kfslib.h"
+#include "nfs3.h"
+
+/*!
+ \brief		Get the version of a file's attributes
+ \details	The version changes whenever the file's attributes are invalidated (and sometimes
+			when another file's are, since versions are kept in a fixed number of slots). Get it
+			before asking the filesystem for attributes, and pass it to kfsattrcache_set so that
+			attributes read while the file was being changed aren't cached.
+ */
+uint64_t kfsattrcache_version(kfsid_t identifier, uint64_t fileid);
+
+/*!
+ \brief		Cache attributes
+ \details	Stores the attributes of a file unless they were invalidated since version.
+			They're kept for the filesystem's attr_timeout.
+ */
+void kfsattrcache_set(kfsid_t identifier, const kfsfilesystem_t *filesystem, uint64_t fileid,
+	const fattr3 *attributes, uint64_t version);
+
+/*!
+ \brief		Get cached attributes
+ \details	Fills in the attributes of a file and returns true if they were cached recently
+			enough to still be trusted. Never calls into the filesystem.
+ */
+bool kfsattrcache_get(kfsid_t identifier, uint64_t fileid, fattr3 *attributes);
+
+/*!
+ \brief		Invalidate cached attributes
+ \details	Removes the attributes of a file. Call this once the file has been changed.
+ */
+void kfsattrcache_invalidate(kfsid_t identifier, uint64_t fileid);
+
+/*!
+ \brief		Invalidate cached attributes for a filesystem
+ \details	Removes the attributes of every file in the filesystem.
+ */
+void kfsattrcache_clear(kfsid_t identifier);
+
+#endif
@@ -0,0 +1,300 @@
+//
+//  blockcache.c
+//  KFS
+//
+//  Copyright (c) 2012, FadingRed LLC
+//  All rights reserved.
+//  
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+//  following conditions are met:
+//  
+//    - Redistributions of source code must retain the above copyright notice, this list of conditions and the
+//      following disclaimer.
+//    - Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+//      following disclaimer in the documentation and/or other materials provided with the distribution.
+//    - Neither the name of the FadingRed LLC nor the names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior written permission.
+//  
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+//  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+#include "blockcache.h"
+#include "readahead.h"
+#include "internal.h"
+#include "fileid.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define BLOCKCACHE_BLOCK	0x10000		/* 64K */
+#define BLOCKCACHE_SHARDS	16
+#define BLOCKCACHE_BUCKETS	256			/* per shard */
+#define BLOCKCACHE_VERSIONS	4096
+
+typedef struct kfscacheblock kfscacheblock_t;
+struct kfscacheblock {
+	kfsid_t identifier;
+	uint64_t fileid;
+	uint64_t index;				// offset in the file, in blocks
+	uint64_t version;			// of the file when the block was read
+	char *data;
+	size_t length;				// less than a block at the end of the file
+	bool referenced;			// read since the clock hand last passed
+	kfscacheblock_t *chain;		// next in the bucket
+	kfscacheblock_t *prev;		// around the clock
+	kfscacheblock_t *next;
+};
+
+// blocks are spread over shards, each with its own lock, so that reads of
+// different blocks rarely wait on each other. each filesystem may use an equal
+// part of its limit in each shard.
+typedef struct kfscacheshard kfscacheshard_t;
+struct kfscacheshard {
+	pthread_mutex_t lock;
+	kfscacheblock_t *buckets[BLOCKCACHE_BUCKETS];
+	kfscacheblock_t *hand;		// next block the clock looks at for eviction
+	size_t used[MAX_FIELSYSTEMS];
+};
+
+static kfscacheshard_t shards[BLOCKCACHE_SHARDS];
+static pthread_once_t shardsonce = PTHREAD_ONCE_INIT;
+
+// changing a file changes its version, which makes all of its blocks stale at
+// once. files share versions when they hash the same, which is harmless.
+static uint64_t versions[BLOCKCACHE_VERSIONS];
+static pthread_mutex_t versionlock = PTHREAD_MUTEX_INITIALIZER;
+
+
+#pragma mark -
+#pragma mark versions
+// ----------------------------------------------------------------------------------------------------
+// versions
+// ----------------------------------------------------------------------------------------------------
+
+static uint64_t *kfsblockcache_version_slot(kfsid_t identifier, uint64_t fileid);
+static uint64_t *kfsblockcache_version_slot(kfsid_t identifier, uint64_t fileid) {
+	uint64_t hash = (fileid * 0x9E3779B97F4A7C15ull) ^ (uint64_t)identifier;
+	return &versions[(hash >> 32) % BLOCKCACHE_VERSIONS];
+}
+
+static uint64_t kfsblockcache_version(kfsid_t identifier, uint64_t fileid);
+static uint64_t kfsblockcache_version(kfsid_t identifier, uint64_t fileid) {
+	pthread_mutex_lock(&versionlock);
+	uint64_t result = *kfsblockcache_version_slot(identifier, fileid);
+	pthread_mutex_unlock(&versionlock);
+	return result;
+}
+
+
+#pragma mark -
+#pragma mark shards
+// ----------------------------------------------------------------------------------------------------
+// shards
+// ----------------------------------------------------------------------------------------------------
+
+static void kfsblockcache_init_shards(void);
+static void kfsblockcache_init_shards(void) {
+	for (unsigned int index = 0; index < BLOCKCACHE_SHARDS; index++) {
+		pthread_mutex_init(&shards[index].lock, NULL);
+	}
+}
+
+static uint64_t kfsblockcache_hash(kfsid_t identifier, uint64_t fileid, uint64_t index);
+static uint64_t kfsblockcache_hash(kfsid_t identifier, uint64_t fileid, uint64_t index) {
+	return (((fileid * 0x9E3779B97F4A7C15ull) ^ index) * 0x9E3779B97F4A7C15ull) ^ (uint64_t)identifier;
+}
+
+static kfscacheshard_t *kfsblockcache_shard(kfsid_t identifier, uint64_t fileid, uint64_t index);
+static kfscacheshard_t *kfsblockcache_shard(kfsid_t identifier, uint64_t fileid, uint64_t index) {
+	return &shards[(kfsblockcache_hash(identifier, fileid, index) >> 56) % BLOCKCACHE_SHARDS];
+}
+
+static kfscacheblock_t **kfsblockcache_bucket(kfscacheshard_t *shard, kfsid_t identifier, uint64_t fileid, uint64_t index);
+static kfscacheblock_t **kfsblockcache_bucket(kfscacheshard_t *shard, kfsid_t identifier, uint64_t fileid, uint64_t index) {
+	return &shard->buckets[(kfsblockcache_hash(identifier, fileid, index) >> 32) % BLOCKCACHE_BUCKETS];
+}
+
+static kfscacheblock_t *kfsblockcache_find_nolock(kfscacheshard_t *shard, kfsid_t identifier, uint64_t fileid, uint64_t index);
+static kfscacheblock_t *kfsblockcache_find_nolock(kfscacheshard_t *shard, kfsid_t identifier, uint64_t fileid, uint64_t index) {
+	kfscacheblock_t *block = *kfsblockcache_bucket(shard, identifier, fileid, index);
+	while (block && !(block->identifier == identifier && block->fileid == fileid && block->index == index)) {
+		block = block->chain;
+	}
+	return block;
+}
+
+// take the block out of the shard and free it. the shard must be locked.
+static void kfsblockcache_remove_nolock(kfscacheshard_t *shard, kfscacheblock_t *block);
+static void kfsblockcache_remove_nolock(kfscacheshard_t *shard, kfscacheblock_t *block) {
+	kfscacheblock_t **link = kfsblockcache_bucket(shard, block->identifier, block->fileid, block->index);
+	while (*link != block) { link = &(*link)->chain; }
+	*link = block->chain;
+
+	if (block->next == block) { shard->hand = NULL; }
+	else {
+		block->prev->next = block->next;
+		block->next->prev = block->prev;
+		if (shard->hand == block) { shard->hand = block->next; }
+	}
+	shard->used[block->identifier] -= block->length;
+	free(block->data);
+	free(block);
+}
+
+// make room for length more bytes from the filesystem by going around the clock,
+// evicting its blocks that haven't been read since the hand last passed them.
+// returns false if there isn't room. the shard must be locked.
+static bool kfsblockcache_evict_nolock(kfscacheshard_t *shard, kfsid_t identifier, size_t length, size_t limit);
+static bool kfsblockcache_evict_nolock(kfscacheshard_t *shard, kfsid_t identifier, size_t length, size_t limit) {
+	if (length > limit) { return false; }
+	for (kfscacheblock_t *block = shard->hand; block && shard->used[identifier] + length > limit; block = shard->hand) {
+		shard->hand = block->next;
+		if (block->identifier != identifier) { continue; }
+		if (block->referenced) { block->referenced = false; }
+		else { kfsblockcache_remove_nolock(shard, block); }
+	}
+	return true;
+}
+
+static void kfsblockcache_insert(kfsid_t identifier, uint64_t fileid, uint64_t index, uint64_t version,
+								 const char *data, size_t length, size_t limit);
+static void kfsblockcache_insert(kfsid_t identifier, uint64_t fileid, uint64_t index, uint64_t version,
+								 const char *data, size_t length, size_t limit) {
+	kfscacheshard_t *shard = kfsblockcache_shard(identifier, fileid, index);
+	pthread_mutex_lock(&shard->lock);
+	kfscacheblock_t *block = kfsblockcache_find_nolock(shard, identifier, fileid, index);
+	if (block) { kfsblockcache_remove_nolock(shard, block); }
+	if (kfsblockcache_evict_nolock(shard, identifier, length, limit)) {
+		block = calloc(1, sizeof(kfscacheblock_t));
+		block->identifier = identifier;
+		block->fileid = fileid;
+		block->index = index;
+		block->version = version;
+		block->data = malloc(length ? length : 1);
+		block->length = length;
+		memcpy(block->data, data, length);
+
+		kfscacheblock_t **bucket = kfsblockcache_bucket(shard, identifier, fileid, index);
+		block->chain = *bucket;
+		*bucket = block;
+
+		// new blocks go just behind the hand, so they're looked at last
+		if (shard->hand) {
+			block->next = shard->hand;
+			block->prev = shard->hand->prev;
+			block->prev->next = block;
+			block->next->prev = block;
+		} else {
+			block->next = block;
+			block->prev = block;
+			shard->hand = block;
+		}
+		shard->used[identifier] += length;
+	}
+	pthread_mutex_unlock(&shard->lock);
+}
+
+// copy the block into buf if it's there and current. returns its length, or -1
+// if it's not there.
+static ssize_t kfsblockcache_lookup(kfsid_t identifier, uint64_t fileid, uint64_t index, uint64_t version,
+									char *buf, size_t offset, size_t length);
+static ssize_t kfsblockcache_lookup(kfsid_t identifier, uint64_t fileid, uint64_t index, uint64_t version,
+									char *buf, size_t offset, size_t length) {
+	ssize_t result = -1;
+	kfscacheshard_t *shard = kfsblockcache_shard(identifier, fileid, index);
+	pthread_mutex_lock(&shard->lock);
+	kfscacheblock_t *block = kfsblockcache_find_nolock(shard, identifier, fileid, index);
+	if (block && block->version != version) {
+		kfsblockcache_remove_nolock(shard, block);
+	} else if (block) {
+		size_t available = (block->length > offset) ? block->length - offset : 0;
+		if (length > available) { length = available; }
+		memcpy(buf, block->data + offset, length);
+		block->referenced = true;
+		result = (ssize_t)length;
+	}
+	pthread_mutex_unlock(&shard->lock);
+	return result;
+}
+
+
+#pragma mark -
+#pragma mark function implementation
+// ----------------------------------------------------------------------------------------------------
+// function implementation
+// ----------------------------------------------------------------------------------------------------
+
+ssize_t kfsblockcache_read(kfsid_t identifier, const kfsfilesystem_t *filesystem, const char *path, void *handle,
+						   char *buf, uint64_t offset, size_t length, int *error) {
+	size_t limit = ((size_t)filesystem->options.block_cache * 1024) / BLOCKCACHE_SHARDS;
+	if (limit == 0 || length == 0) {
+		return kfsreadahead_read(identifier, filesystem, path, handle, buf, offset, length, error);
+	}
+	pthread_once(&shardsonce, kfsblockcache_init_shards);
+
+	uint64_t fileid = kfs_fileid(identifier, path);
+	uint64_t version = kfsblockcache_version(identifier, fileid);
+
+	// use the blocks if every one the read covers is there. a short block is the
+	// end of the file, so the read stops there.
+	size_t count = 0;
+	bool complete = true;
+	while (complete && count < length) {
+		uint64_t position = offset + count;
+		size_t within = (size_t)(position % BLOCKCACHE_BLOCK);
+		size_t wanted = BLOCKCACHE_BLOCK - within;
+		if (wanted > length - count) { wanted = length - count; }
+		ssize_t copied = kfsblockcache_lookup(identifier, fileid, position / BLOCKCACHE_BLOCK, version,
+											  buf + count, within, wanted);
+		if (copied == -1) { complete = false; }
+		else {
+			count += copied;
+			if ((size_t)copied < wanted) { break; }
+		}
+	}
+	if (complete) { return (ssize_t)count; }
+
+	ssize_t result = kfsreadahead_read(identifier, filesystem, path, handle, buf, offset, length, error);
+	if (result != -1 && (filesystem->cacheable == NULL || filesystem->cacheable(path, filesystem->context))) {
+		// keep each whole block that was read, and the last block if the read
+		// came up short at the end of the file. blocks read while the file was
+		// changed have an old version, so they're never used.
+		uint64_t index = (offset + BLOCKCACHE_BLOCK - 1) / BLOCKCACHE_BLOCK;
+		for (;; index++) {
+			uint64_t start = index * BLOCKCACHE_BLOCK;
+			uint64_t end = offset + (uint64_t)result;
+			if (start > end || (start == end && (size_t)result == length)) { break; }
+			size_t blocklength = (end - start < BLOCKCACHE_BLOCK) ? (size_t)(end - start) : BLOCKCACHE_BLOCK;
+			if (blocklength < BLOCKCACHE_BLOCK && (size_t)result == length) { break; } // not the end of the file
+			kfsblockcache_insert(identifier, fileid, index, version, buf + (start - offset), blocklength, limit);
+			if (blocklength < BLOCKCACHE_BLOCK) { break; }
+		}
+	}
+	return result;
+}
+
+void kfsblockcache_invalidate(kfsid_t identifier, uint64_t fileid) {
+	pthread_mutex_lock(&versionlock);
+	(*kfsblockcache_version_slot(identifier, fileid))++;
+	pthread_mutex_unlock(&versionlock);
+}
+
+void kfsblockcache_clear(kfsid_t identifier) {
+	pthread_once(&shardsonce, kfsblockcache_init_shards);
+	for (unsigned int index = 0; index < BLOCKCACHE_SHARDS; index++) {
+		kfscacheshard_t *shard = &shards[index];
+		pthread_mutex_lock(&shard->lock);
+		for (unsigned int bucket = 0; bucket < BLOCKCACHE_BUCKETS; bucket++) {
+			for (kfscacheblock_t *block = shard->buckets[bucket], *next = NULL; block; block = next) {
+				next = block->chain;
+				if (block->identifier == identifier) { kfsblockcache_remove_nolock(shard, block); }
+			}
+		}
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
@@ -0,0 +1,55 @@
+//
+//  blockcache.h
+//  KFS
+//
+//  Copyright (c) 2012, FadingRed LLC
+//  All rights reserved.
+//  
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+//  following conditions are met:
+//  
+//    - Redistributions of source code must retain the above copyright notice, this list of conditions and the
+//      following disclaimer.
+//    - Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+//      following disclaimer in the documentation and/or other materials provided with the distribution.
+//    - Neither the name of the FadingRed LLC nor the names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior written permission.
+//  
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+//  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+#ifndef _KFSBLOCKCACHE_H_
+#define _KFSBLOCKCACHE_H_
+
+#include <stdbool.h>
+#include "kfslib.h"
+
+/*!
+ \brief		Read from a file
+ \details	Reads from blocks of the file kept from earlier reads when they're all there, and
+			otherwise reads as kfsreadahead_read does, keeping the blocks that were read (up to
+			the filesystem's block_cache option, and only if the filesystem's cacheable callback
+			allows it). Returns the number of bytes read or -1 with an error.
+ */
+ssize_t kfsblockcache_read(kfsid_t identifier, const kfsfilesystem_t *filesystem, const char *path, void *handle,
+						   char *buf, uint64_t offset, size_t length, int *error);
+
+/*!
+ \brief		Forget blocks of a file
+ \details	Call this once the file has been changed. Blocks being read when this is called are
+			not kept.
+ */
+void kfsblockcache_invalidate(kfsid_t identifier, uint64_t fileid);
+
+/*!
+ \brief		Forget blocks of a filesystem
+ \details	Frees every block kept for the filesystem.
+ */
+void kfsblockcache_clear(kfsid_t identifier);
+
+#endif
@@ -0,0 +1,572 @@
+//
+//  dircache.c
+//  KFS
+//
+//  Copyright (c) 2012, FadingRed LLC
+//  All rights reserved.
+//  
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+//  following conditions are met:
+//  
+//    - Redistributions of source code must retain the above copyright notice, this list of conditions and the
+//      following disclaimer.
+//    - Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+//      following disclaimer in the documentation and/or other materials provided with the distribution.
+//    - Neither the name of the FadingRed LLC nor the names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior written permission.
+//  
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+//  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+#include "dircache.h"
+#include "internal.h"
+#include "fileid.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#define DIRCACHE_MAX_LISTINGS	32
+#define DIRCACHE_IDLE_TIMEOUT	10000	/* milliseconds a listing is kept without being read */
+#define DIRCACHE_PAGE_LEN		1024	/* most entries asked of readdir_next at once */
+#define DIRCACHE_VERSIONS		4096
+#define DIRCACHE_BOOKMARKS		1024
+#define DIRCACHE_COLLISION_BITS	8
+
+struct kfsdirsnapshot {
+	kfsid_t identifier;
+	uint64_t fileid;
+	nfstime3 mtime;				// of the directory when it was listed
+	bool plus;					// listed with readdirplus
+	const kfsfilesystem_t *filesystem;
+	char *path;
+	void *cursor;				// from opendir, when listed a page at a time
+	kfscontents_t *contents;
+	uint64_t *fileids;			// for each entry in contents
+	uint64_t *cookies;			// for each entry in contents
+	uint64_t *order;			// entries of a whole listing, in cookie order
+	uint64_t start;				// index of the first entry in contents
+	uint64_t after;				// cookie of the entry before start
+	bool found;					// the cursor could be moved to after
+	bool eof;					// there are no entries after contents
+	uint64_t loaded;			// in milliseconds
+	uint64_t used;				// in milliseconds
+	uint64_t version;			// of the directory when it was listed
+	unsigned int refs;			// one for the cache, and one for each user
+	kfsdirsnapshot_t *next;
+};
+
+// the name of the last entry given to a client in a page read with a cursor,
+// so that a new cursor can start right after it.
+typedef struct kfsdirbookmark {
+	kfsid_t identifier;
+	uint64_t fileid;
+	uint64_t cookie;
+	char *name;
+} kfsdirbookmark_t;
+
+static kfsdirsnapshot_t *listings = NULL;
+static unsigned int count = 0;
+static kfsdirbookmark_t bookmarks[DIRCACHE_BOOKMARKS];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+// each directory has a version that's changed when it's invalidated, so a
+// listing made or read while the directory was being changed isn't kept.
+// directories share versions when they hash the same, which is harmless.
+static uint64_t versions[DIRCACHE_VERSIONS];
+
+
+#pragma mark -
+#pragma mark cookies
+// ----------------------------------------------------------------------------------------------------
+// cookies
+// ----------------------------------------------------------------------------------------------------
+
+// a cookie is the hash of an entry's name, with the low bits telling apart
+// names that hash the same. it doesn't depend on the other entries, so it stays
+// the same while the directory changes around it. 0 is the start of the
+// directory, so it's never used.
+static uint64_t kfsdircache_hash(const char *name);
+static uint64_t kfsdircache_hash(const char *name) {
+	uint64_t hash = 0xCBF29CE484222325ull;
+	for (const unsigned char *c = (const unsigned char *)name; *c; c++) {
+		hash = (hash ^ *c) * 0x100000001B3ull;
+	}
+	hash &= ~0ull << DIRCACHE_COLLISION_BITS;
+	return hash ? hash : (1ull << DIRCACHE_COLLISION_BITS);
+}
+
+typedef struct kfsdirsort {
+	uint64_t cookie;
+	const char *name;
+	uint64_t index;
+} kfsdirsort_t;
+
+static int kfsdircache_compare(const void *a, const void *b);
+static int kfsdircache_compare(const void *a, const void *b) {
+	const kfsdirsort_t *first = a;
+	const kfsdirsort_t *second = b;
+	int result = 0;
+	if (first->cookie < second->cookie) { result = -1; }
+	else if (first->cookie > second->cookie) { result = 1; }
+	else { result = strcmp(first->name, second->name); }
+	return result;
+}
+
+// put the entries of a whole listing in cookie order. names that hash the same
+// are numbered in name order.
+static void kfsdircache_sort(kfsdirsnapshot_t *snapshot);
+static void kfsdircache_sort(kfsdirsnapshot_t *snapshot) {
+	uint64_t entries = kfscontents_count(snapshot->contents);
+	kfsdirsort_t *sort = malloc(sizeof(kfsdirsort_t) * (entries ? entries : 1));
+	for (uint64_t i = 0; i < entries; i++) {
+		sort[i].cookie = snapshot->cookies[i];
+		sort[i].name = kfscontents_at(snapshot->contents, i);
+		sort[i].index = i;
+	}
+	qsort(sort, entries, sizeof(kfsdirsort_t), kfsdircache_compare);
+
+	snapshot->order = malloc(sizeof(uint64_t) * (entries ? entries : 1));
+	uint64_t collision = 0;
+	for (uint64_t i = 0; i < entries; i++) {
+		collision = (i > 0 && sort[i].cookie == sort[i-1].cookie) ? collision + 1 : 0;
+		if (collision >= (1 << DIRCACHE_COLLISION_BITS)) { collision = (1 << DIRCACHE_COLLISION_BITS) - 1; }
+		snapshot->order[i] = sort[i].index;
+		snapshot->cookies[sort[i].index] |= collision;
+	}
+	free(sort);
+}
+
+// the bookmark slot for a cookie. the lock must be held.
+static kfsdirbookmark_t *kfsdircache_bookmark_nolock(kfsid_t identifier, uint64_t fileid, uint64_t cookie);
+static kfsdirbookmark_t *kfsdircache_bookmark_nolock(kfsid_t identifier, uint64_t fileid, uint64_t cookie) {
+	uint64_t hash = ((fileid ^ cookie) * 0x9E3779B97F4A7C15ull) ^ (uint64_t)identifier;
+	return &bookmarks[(hash >> 32) % DIRCACHE_BOOKMARKS];
+}
+
+
+#pragma mark -
+#pragma mark listings
+// ----------------------------------------------------------------------------------------------------
+// listings
+// ----------------------------------------------------------------------------------------------------
+
+static uint64_t kfsdircache_now(void);
+static uint64_t kfsdircache_now(void) {
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_usec / 1000;
+}
+
+static uint64_t *kfsdircache_version_slot(kfsid_t identifier, uint64_t fileid);
+static uint64_t *kfsdircache_version_slot(kfsid_t identifier, uint64_t fileid) {
+	uint64_t hash = (fileid * 0x9E3779B97F4A7C15ull) ^ (uint64_t)identifier;
+	return &versions[(hash >> 32) % DIRCACHE_VERSIONS];
+}
+
+// the entry in contents at an index in the listing.
+static uint64_t kfsdircache_entry(const kfsdirsnapshot_t *snapshot, uint64_t index);
+static uint64_t kfsdircache_entry(const kfsdirsnapshot_t *snapshot, uint64_t index) {
+	index -= snapshot->start;
+	return snapshot->order ? snapshot->order[index] : index;
+}
+
+static void kfsdircache_destroy(kfsdirsnapshot_t *snapshot);
+static void kfsdircache_destroy(kfsdirsnapshot_t *snapshot) {
+	if (snapshot->cursor) { snapshot->filesystem->closedir(snapshot->cursor, snapshot->filesystem->context); }
+	kfscontents_destroy(snapshot->contents);
+	free(snapshot->fileids);
+	free(snapshot->cookies);
+	free(snapshot->order);
+	free(snapshot->path);
+	free(snapshot);
+}
+
+// destroy listings collected while the lock was held, so that closedir isn't
+// called with it.
+static void kfsdircache_destroy_all(kfsdirsnapshot_t *doomed);
+static void kfsdircache_destroy_all(kfsdirsnapshot_t *doomed) {
+	for (kfsdirsnapshot_t *next = NULL; doomed; doomed = next) {
+		next = doomed->next;
+		kfsdircache_destroy(doomed);
+	}
+}
+
+// take the listing out of the cache. once the last user releases it, it's
+// added to doomed to be destroyed. the lock must be held.
+static void kfsdircache_remove_nolock(kfsdirsnapshot_t *snapshot, kfsdirsnapshot_t **doomed);
+static void kfsdircache_remove_nolock(kfsdirsnapshot_t *snapshot, kfsdirsnapshot_t **doomed) {
+	kfsdirsnapshot_t **link = &listings;
+	while (*link != snapshot) { link = &(*link)->next; }
+	*link = snapshot->next;
+	count--;
+	if (--snapshot->refs == 0) {
+		snapshot->next = *doomed;
+		*doomed = snapshot;
+	}
+}
+
+// add the listing to the cache. the lock must be held.
+static void kfsdircache_insert_nolock(kfsdirsnapshot_t *snapshot);
+static void kfsdircache_insert_nolock(kfsdirsnapshot_t *snapshot) {
+	snapshot->refs++;
+	snapshot->next = listings;
+	listings = snapshot;
+	count++;
+}
+
+// drop listings nobody has read from in a while, and the least recently used
+// ones beyond the limit. the lock must be held.
+static void kfsdircache_expire_nolock(uint64_t now, kfsdirsnapshot_t **doomed);
+static void kfsdircache_expire_nolock(uint64_t now, kfsdirsnapshot_t **doomed) {
+	kfsdirsnapshot_t *lru = NULL;
+	for (kfsdirsnapshot_t *snapshot = listings, *next = NULL; snapshot; snapshot = next) {
+		next = snapshot->next;
+		if (snapshot->used + DIRCACHE_IDLE_TIMEOUT <= now) { kfsdircache_remove_nolock(snapshot, doomed); }
+		else if (lru == NULL || snapshot->used < lru->used) { lru = snapshot; }
+	}
+	if (count >= DIRCACHE_MAX_LISTINGS && lru) { kfsdircache_remove_nolock(lru, doomed); }
+}
+
+// make the file ids and cookies of the entries in contents from index on,
+// reusing one buffer for the paths.
+static void kfsdircache_prepare(kfsdirsnapshot_t *snapshot, uint64_t index);
+static void kfsdircache_prepare(kfsdirsnapshot_t *snapshot, uint64_t index) {
+	uint64_t entries = kfscontents_count(snapshot->contents);
+	snapshot->fileids = realloc(snapshot->fileids, sizeof(uint64_t) * (entries ? entries : 1));
+	snapshot->cookies = realloc(snapshot->cookies, sizeof(uint64_t) * (entries ? entries : 1));
+
+	char fspath[PATH_MAX];
+	size_t prefix = strlcpy(fspath, snapshot->path, PATH_MAX);
+	if (prefix < PATH_MAX - 1 && strcmp(snapshot->path, "/") != 0) { fspath[prefix++] = '/'; }
+	for (; index < entries; index++) {
+		const char *name = kfscontents_at(snapshot->contents, index);
+		strlcpy(fspath + prefix, name, PATH_MAX - prefix);
+		snapshot->fileids[index] = kfs_fileid(snapshot->identifier, fspath);
+		snapshot->cookies[index] = kfsdircache_hash(name);
+	}
+}
+
+static kfsdirsnapshot_t *kfsdircache_create(kfsid_t identifier, uint64_t fileid, const nfstime3 *mtime,
+	const kfsfilesystem_t *filesystem, const char *path);
+static kfsdirsnapshot_t *kfsdircache_create(kfsid_t identifier, uint64_t fileid, const nfstime3 *mtime,
+	const kfsfilesystem_t *filesystem, const char *path) {
+	kfsdirsnapshot_t *snapshot = calloc(1, sizeof(kfsdirsnapshot_t));
+	snapshot->identifier = identifier;
+	snapshot->fileid = fileid;
+	snapshot->mtime = *mtime;
+	snapshot->filesystem = filesystem;
+	snapshot->path = strdup(path);
+	snapshot->contents = kfscontents_create();
+	snapshot->found = true;
+	snapshot->refs = 1;
+	return snapshot;
+}
+
+// list the whole directory at once.
+static bool kfsdircache_list(kfsdirsnapshot_t *snapshot, bool plus, int *error);
+static bool kfsdircache_list(kfsdirsnapshot_t *snapshot, bool plus, int *error) {
+	const kfsfilesystem_t *filesystem = snapshot->filesystem;
+	snapshot->plus = plus && filesystem->readdirplus;
+	bool listed = snapshot->plus ?
+		filesystem->readdirplus(snapshot->path, snapshot->contents, error, filesystem->context) :
+		filesystem->readdir(snapshot->path, snapshot->contents, error, filesystem->context);
+	if (listed) {
+		snapshot->eof = true;
+		snapshot->loaded = kfsdircache_now();
+		kfsdircache_prepare(snapshot, 0);
+		kfsdircache_sort(snapshot);
+	}
+	return listed;
+}
+
+// read from the cursor until the entries up to (but not including) index are
+// there or the directory has ended.
+static bool kfsdircache_fill(kfsdirsnapshot_t *snapshot, uint64_t index, int *error);
+static bool kfsdircache_fill(kfsdirsnapshot_t *snapshot, uint64_t index, int *error) {
+	const kfsfilesystem_t *filesystem = snapshot->filesystem;
+	bool success = true;
+	uint64_t entries = kfscontents_count(snapshot->contents);
+	while (success && !snapshot->eof && snapshot->start + entries < index) {
+		uint64_t max = index - (snapshot->start + entries);
+		if (max > DIRCACHE_PAGE_LEN) { max = DIRCACHE_PAGE_LEN; }
+		success = filesystem->readdir_next(snapshot->cursor, snapshot->contents, max,
+			&snapshot->eof, error, filesystem->context);
+		if (success) {
+			kfsdircache_prepare(snapshot, entries);
+			snapshot->loaded = kfsdircache_now();
+			if (kfscontents_count(snapshot->contents) == entries) { snapshot->eof = true; } // nothing more
+			entries = kfscontents_count(snapshot->contents);
+		}
+	}
+	return success;
+}
+
+// forget the entries before index, which the client has already been given.
+static void kfsdircache_drop(kfsdirsnapshot_t *snapshot, uint64_t index);
+static void kfsdircache_drop(kfsdirsnapshot_t *snapshot, uint64_t index) {
+	uint64_t entries = kfscontents_count(snapshot->contents);
+	uint64_t dropped = (index > snapshot->start) ? index - snapshot->start : 0;
+	if (dropped > entries) { dropped = entries; }
+	if (dropped) {
+		kfscontents_t *contents = kfscontents_create();
+		for (uint64_t i = dropped; i < entries; i++) {
+			const kfsstat_t *stat = kfscontents_stat_at(snapshot->contents, i);
+			if (stat) { kfscontents_append_stat(contents, kfscontents_at(snapshot->contents, i), stat); }
+			else { kfscontents_append(contents, kfscontents_at(snapshot->contents, i)); }
+		}
+		snapshot->after = snapshot->cookies[dropped - 1];
+		memmove(snapshot->fileids, snapshot->fileids + dropped, sizeof(uint64_t) * (entries - dropped));
+		memmove(snapshot->cookies, snapshot->cookies + dropped, sizeof(uint64_t) * (entries - dropped));
+		kfscontents_destroy(snapshot->contents);
+		snapshot->contents = contents;
+		snapshot->start += dropped;
+	}
+}
+
+// open a cursor just past the entry with the cookie. the cursor starts after the
+// bookmarked name when there is one, and otherwise the directory is read
+// through, a page at a time, until the entry turns up.
+static bool kfsdircache_open(kfsdirsnapshot_t *snapshot, uint64_t cookie, int *error);
+static bool kfsdircache_open(kfsdirsnapshot_t *snapshot, uint64_t cookie, int *error) {
+	const kfsfilesystem_t *filesystem = snapshot->filesystem;
+	char *name = NULL;
+	if (cookie) {
+		pthread_mutex_lock(&lock);
+		kfsdirbookmark_t *bookmark = kfsdircache_bookmark_nolock(snapshot->identifier, snapshot->fileid, cookie);
+		if (bookmark->name && bookmark->identifier == snapshot->identifier &&
+			bookmark->fileid == snapshot->fileid && bookmark->cookie == cookie) {
+			name = strdup(bookmark->name);
+		}
+		pthread_mutex_unlock(&lock);
+	}
+
+	snapshot->cursor = filesystem->opendir(snapshot->path, name, error, filesystem->context);
+	snapshot->after = cookie;
+	bool success = (snapshot->cursor != NULL);
+	if (success && cookie && !name) {
+		snapshot->found = false;
+		while (success && !snapshot->found && !snapshot->eof) {
+			uint64_t upto = snapshot->start + DIRCACHE_PAGE_LEN;
+			if ((success = kfsdircache_fill(snapshot, upto, error))) {
+				uint64_t entries = kfscontents_count(snapshot->contents);
+				uint64_t index = 0;
+				while (index < entries && snapshot->cookies[index] != cookie) { index++; }
+				snapshot->found = (index < entries);
+				kfsdircache_drop(snapshot, snapshot->start + (snapshot->found ? index + 1 : entries));
+			}
+		}
+	}
+	free(name);
+	return success;
+}
+
+
+#pragma mark -
+#pragma mark function implementation
+// ----------------------------------------------------------------------------------------------------
+// function implementation
+// ----------------------------------------------------------------------------------------------------
+
+kfsdirsnapshot_t *kfsdircache_get(kfsid_t identifier, uint64_t fileid, const nfstime3 *mtime, bool plus,
+	uint64_t cookie, uint64_t wanted, const kfsfilesystem_t *filesystem, const char *path, int *error) {
+	bool paged = filesystem->opendir && filesystem->readdir_next && filesystem->closedir;
+	kfsdirsnapshot_t *result = NULL;
+	kfsdirsnapshot_t *doomed = NULL;
+	pthread_mutex_lock(&lock);
+	uint64_t now = kfsdircache_now();
+	kfsdircache_expire_nolock(now, &doomed);
+
+	// a whole listing is shared by everyone reading the directory, but a cursor
+	// is used by one request at a time and is only found where it was left.
+	for (kfsdirsnapshot_t *snapshot = listings, *next = NULL; snapshot; snapshot = next) {
+		next = snapshot->next;
+		if (snapshot->identifier != identifier || snapshot->fileid != fileid) { continue; }
+		if (snapshot->cursor && snapshot->after != cookie) { continue; }
+
+		bool changed =
+			snapshot->mtime.seconds != mtime->seconds ||
+			snapshot->mtime.nseconds != mtime->nseconds;
+		bool lacking = plus && filesystem->readdirplus && !snapshot->plus && !snapshot->cursor;
+		if (changed || lacking || (cookie == 0 && !snapshot->cursor)) {
+			kfsdircache_remove_nolock(snapshot, &doomed);
+		} else {
+			snapshot->used = now;
+			snapshot->refs++;
+			if (snapshot->cursor) { kfsdircache_remove_nolock(snapshot, &doomed); }
+			result = snapshot;
+			break;
+		}
+	}
+	uint64_t version = *kfsdircache_version_slot(identifier, fileid);
+	pthread_mutex_unlock(&lock);
+	kfsdircache_destroy_all(doomed);
+	doomed = NULL;
+
+	// the filesystem is listed without the lock, so a listing made while the
+	// directory was changed is used for this request, but not kept.
+	if (result == NULL) {
+		result = kfsdircache_create(identifier, fileid, mtime, filesystem, path);
+		result->version = version;
+		bool success = paged ?
+			kfsdircache_open(result, cookie, error) :
+			kfsdircache_list(result, plus, error);
+		if (!success) {
+			kfsdircache_destroy(result);
+			result = NULL;
+		} else if (!paged) {
+			pthread_mutex_lock(&lock);
+			result->used = kfsdircache_now();
+			if (version == *kfsdircache_version_slot(identifier, fileid)) {
+				for (kfsdirsnapshot_t *existing = listings; existing; existing = existing->next) {
+					if (existing->identifier == identifier && existing->fileid == fileid) {
+						kfsdircache_remove_nolock(existing, &doomed);
+						break;
+					}
+				}
+				kfsdircache_expire_nolock(result->used, &doomed);
+				kfsdircache_insert_nolock(result);
+			}
+			pthread_mutex_unlock(&lock);
+			kfsdircache_destroy_all(doomed);
+		}
+	}
+
+	if (result && result->cursor && !kfsdircache_fill(result, result->start + wanted, error)) {
+		kfsdircache_destroy(result);
+		result = NULL;
+	}
+	return result;
+}
+
+void kfsdircache_release(kfsdirsnapshot_t *snapshot, uint64_t index) {
+	kfsdirsnapshot_t *doomed = NULL;
+	if (snapshot->cursor) {
+		// keep the name of the last entry given out, so a new cursor can start
+		// after it if this one is gone by the next page.
+		char *name = NULL;
+		uint64_t cookie = 0;
+		if (index > snapshot->start && index <= kfsdircache_count(snapshot)) {
+			name = strdup(kfsdircache_name(snapshot, index - 1));
+			cookie = kfsdircache_cookie(snapshot, index - 1);
+		}
+
+		// keep the cursor where the client will pick up, unless there's nothing
+		// left to read or the directory changed while it was being read.
+		kfsdircache_drop(snapshot, index);
+		pthread_mutex_lock(&lock);
+		if (name) {
+			kfsdirbookmark_t *bookmark = kfsdircache_bookmark_nolock(snapshot->identifier, snapshot->fileid, cookie);
+			free(bookmark->name);
+			bookmark->identifier = snapshot->identifier;
+			bookmark->fileid = snapshot->fileid;
+			bookmark->cookie = cookie;
+			bookmark->name = name;
+		}
+		bool finished = snapshot->eof && kfscontents_count(snapshot->contents) == 0;
+		if (!finished && snapshot->version == *kfsdircache_version_slot(snapshot->identifier, snapshot->fileid)) {
+			snapshot->used = kfsdircache_now();
+			kfsdircache_expire_nolock(snapshot->used, &doomed);
+			kfsdircache_insert_nolock(snapshot);
+		}
+		pthread_mutex_unlock(&lock);
+	}
+
+	pthread_mutex_lock(&lock);
+	if (--snapshot->refs == 0) {
+		snapshot->next = doomed;
+		doomed = snapshot;
+	}
+	pthread_mutex_unlock(&lock);
+	kfsdircache_destroy_all(doomed);
+}
+
+bool kfsdircache_find(const kfsdirsnapshot_t *snapshot, uint64_t cookie, uint64_t *index) {
+	bool found = true;
+	if (snapshot->cursor || cookie == 0) {
+		*index = snapshot->start;
+		found = snapshot->found;
+	} else {
+		// the first entry with a greater cookie, whether or not the entry with the
+		// cookie is still there.
+		uint64_t low = 0;
+		uint64_t high = kfscontents_count(snapshot->contents);
+		while (low < high) {
+			uint64_t middle = low + (high - low) / 2;
+			if (snapshot->cookies[snapshot->order[middle]] <= cookie) { low = middle + 1; }
+			else { high = middle; }
+		}
+		*index = low;
+	}
+	return found;
+}
+
+uint64_t kfsdircache_count(const kfsdirsnapshot_t *snapshot) {
+	return snapshot->start + kfscontents_count(snapshot->contents);
+}
+
+bool kfsdircache_eof(const kfsdirsnapshot_t *snapshot) {
+	return snapshot->eof;
+}
+
+const char *kfsdircache_name(const kfsdirsnapshot_t *snapshot, uint64_t index) {
+	return (index >= snapshot->start && index < kfsdircache_count(snapshot)) ?
+		kfscontents_at(snapshot->contents, kfsdircache_entry(snapshot, index)) : NULL;
+}
+
+uint64_t kfsdircache_fileid(const kfsdirsnapshot_t *snapshot, uint64_t index) {
+	return (index >= snapshot->start && index < kfsdircache_count(snapshot)) ?
+		snapshot->fileids[kfsdircache_entry(snapshot, index)] : 0;
+}
+
+uint64_t kfsdircache_cookie(const kfsdirsnapshot_t *snapshot, uint64_t index) {
+	return (index >= snapshot->start && index < kfsdircache_count(snapshot)) ?
+		snapshot->cookies[kfsdircache_entry(snapshot, index)] : 0;
+}
+
+const kfsstat_t *kfsdircache_stat(const kfsdirsnapshot_t *snapshot, uint64_t index) {
+	const kfsstat_t *stat = NULL;
+	if (index >= snapshot->start && index < kfsdircache_count(snapshot) &&
+		snapshot->loaded + kfsfilesystem_attr_timeout(snapshot->filesystem) > kfsdircache_now()) {
+		stat = kfscontents_stat_at(snapshot->contents, kfsdircache_entry(snapshot, index));
+	}
+	return stat;
+}
+
+void kfsdircache_invalidate(kfsid_t identifier, uint64_t fileid) {
+	kfsdirsnapshot_t *doomed = NULL;
+	pthread_mutex_lock(&lock);
+	(*kfsdircache_version_slot(identifier, fileid))++;
+	for (kfsdirsnapshot_t *snapshot = listings, *next = NULL; snapshot; snapshot = next) {
+		next = snapshot->next;
+		if (snapshot->identifier == identifier && snapshot->fileid == fileid) {
+			kfsdircache_remove_nolock(snapshot, &doomed);
+		}
+	}
+	pthread_mutex_unlock(&lock);
+	kfsdircache_destroy_all(doomed);
+}
+
+void kfsdircache_clear(kfsid_t identifier) {
+	kfsdirsnapshot_t *doomed = NULL;
+	pthread_mutex_lock(&lock);
+	for (unsigned int i = 0; i < DIRCACHE_VERSIONS; i++) { versions[i]++; }
+	for (kfsdirsnapshot_t *snapshot = listings, *next = NULL; snapshot; snapshot = next) {
+		next = snapshot->next;
+		if (snapshot->identifier == identifier) { kfsdircache_remove_nolock(snapshot, &doomed); }
+	}
+	for (unsigned int i = 0; i < DIRCACHE_BOOKMARKS; i++) {
+		if (bookmarks[i].name && bookmarks[i].identifier == identifier) {
+			free(bookmarks[i].name);
+			bookmarks[i].name = NULL;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+	kfsdircache_destroy_all(doomed);
+}
@@ -0,0 +1,121 @@
+//
+//  dircache.h
+//  KFS
+//
+//  Copyright (c) 2012, FadingRed LLC
+//  All rights reserved.
+//  
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+//  following conditions are met:
+//  
+//    - Redistributions of source code must retain the above copyright notice, this list of conditions and the
+//      following disclaimer.
+//    - Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+//      following disclaimer in the documentation and/or other materials provided with the distribution.
+//    - Neither the name of the FadingRed LLC nor the names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior written permission.
+//  
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+//  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+#ifndef _KFSDIRCACHE_H_
+#define _KFSDIRCACHE_H_
+
+#include <stdbool.h>
+#include "kfslib.h"
+#include "nfs3.h"
+
+typedef struct kfsdirsnapshot kfsdirsnapshot_t;
+
+/*!
+ \brief		Get a directory listing
+ \details	Gets a listing of a directory that stays the same while a client reads it a page at a
+			time, for a page that starts after the entry with the cookie. A listing is kept while
+			the directory's modification time stays at mtime and pages keep being read from it.
+			Otherwise (or when the cookie is 0, as it is when a client starts from the beginning)
+			the filesystem is asked to list the directory again. When plus is set the listing is
+			made with readdirplus if the filesystem has it.
+			
+			If the filesystem reads directories with a cursor, the listing only holds the
+			entries after the cookie until wanted of them are there (or the directory has
+			ended). A cursor left where the last page ended is picked up again. Returns NULL and
+			sets error if the directory couldn't be listed. Release the listing with
+			kfsdircache_release.
+ */
+kfsdirsnapshot_t *kfsdircache_get(kfsid_t identifier, uint64_t fileid, const nfstime3 *mtime, bool plus,
+	uint64_t cookie, uint64_t wanted, const kfsfilesystem_t *filesystem, const char *path, int *error);
+
+/*!
+ \brief		Release a directory listing
+ \details	Releases a listing returned by kfsdircache_get. Index is where the next page starts,
+			so a cursor is kept there.
+ */
+void kfsdircache_release(kfsdirsnapshot_t *snapshot, uint64_t index);
+
+/*!
+ \brief		Find where a page starts
+ \details	Gets the index of the first entry after the one with the cookie (or of the first
+			entry if the cookie is 0). Cookies don't depend on the other entries, so this works
+			even if the directory has changed, or the entry is gone. Returns false only when a
+			cursor was read to the end without finding the entry and no name was kept for it.
+ */
+bool kfsdircache_find(const kfsdirsnapshot_t *snapshot, uint64_t cookie, uint64_t *index);
+
+/*!
+ \brief		Get the number of entries
+ \details	Gets the index just past the last entry in the listing.
+ */
+uint64_t kfsdircache_count(const kfsdirsnapshot_t *snapshot);
+
+/*!
+ \brief		Check for the end of the directory
+ \details	Returns true if there are no entries in the directory past those in the listing.
+ */
+bool kfsdircache_eof(const kfsdirsnapshot_t *snapshot);
+
+/*!
+ \brief		Get the name of an entry
+ \details	Gets the name of an entry in the listing. The name is valid until the listing is
+			released.
+ */
+const char *kfsdircache_name(const kfsdirsnapshot_t *snapshot, uint64_t index);
+
+/*!
+ \brief		Get the file id of an entry
+ \details	Gets the file id of an entry in the listing. File ids are made when the directory
+			is listed, not for each page.
+ */
+uint64_t kfsdircache_fileid(const kfsdirsnapshot_t *snapshot, uint64_t index);
+
+/*!
+ \brief		Get the cookie of an entry
+ \details	Gets the cookie of an entry in the listing, made from its name. A client picks up
+			after the entry by asking for a page with it.
+ */
+uint64_t kfsdircache_cookie(const kfsdirsnapshot_t *snapshot, uint64_t index);
+
+/*!
+ \brief		Get the attributes of an entry
+ \details	Gets the attributes the filesystem gave for an entry when it was listed. Returns
+			NULL if there weren't any, or if the listing is older than the filesystem's attr_timeout.
+ */
+const kfsstat_t *kfsdircache_stat(const kfsdirsnapshot_t *snapshot, uint64_t index);
+
+/*!
+ \brief		Invalidate a directory listing
+ \details	Drops the listing of a directory. Call this once the directory has been changed.
+ */
+void kfsdircache_invalidate(kfsid_t identifier, uint64_t fileid);
+
+/*!
+ \brief		Invalidate directory listings for a filesystem
+ \details	Drops the listing of every directory in the filesystem.
+ */
+void kfsdircache_clear(kfsid_t identifier);
+
+#endif
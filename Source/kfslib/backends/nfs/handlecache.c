@@ -0,0 +1,268 @@
+//
+//  handlecache.c
+//  KFS
+//
+//  Copyright (c) 2012, FadingRed LLC
+//  All rights reserved.
+//  
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+//  following conditions are met:
+//  
+//    - Redistributions of source code must retain the above copyright notice, this list of conditions and the
+//      following disclaimer.
+//    - Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+//      following disclaimer in the documentation and/or other materials provided with the distribution.
+//    - Neither the name of the FadingRed LLC nor the names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior written permission.
+//  
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+//  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "handlecache.h"
+#include "fileid.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#define HANDLE_BUCKETS		256
+#define HANDLE_MAX_ENTRIES	256
+#define HANDLE_IDLE_TIMEOUT	5		/* seconds an unused handle is kept open */
+
+struct kfshandle {
+	kfsid_t identifier;
+	uint64_t fileid;
+	char *path;
+	void *value;
+	kfsrelease_f release;	// copied, since the filesystem may be unmounted while the handle is in use
+	void *context;
+	int refs;
+	bool forgotten;			// closed once it's no longer in use
+	time_t used;
+	kfshandle_t *chain;		// next in the bucket
+	kfshandle_t *older;		// least recently used first, for eviction
+	kfshandle_t *newer;
+};
+
+static kfshandle_t *buckets[HANDLE_BUCKETS];
+static kfshandle_t *oldest = NULL;
+static kfshandle_t *newest = NULL;
+static unsigned int count = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t sweeponce = PTHREAD_ONCE_INIT;
+
+
+#pragma mark -
+#pragma mark entries
+// ----------------------------------------------------------------------------------------------------
+// entries
+// ----------------------------------------------------------------------------------------------------
+
+static kfshandle_t **kfshandle_bucket(kfsid_t identifier, uint64_t fileid);
+static kfshandle_t **kfshandle_bucket(kfsid_t identifier, uint64_t fileid) {
+	uint64_t hash = (fileid * 0x9E3779B97F4A7C15ull) ^ (uint64_t)identifier;
+	return &buckets[(hash >> 32) % HANDLE_BUCKETS];
+}
+
+// make the handle the most recently used. the lock must be held.
+static void kfshandle_touch_nolock(kfshandle_t *handle);
+static void kfshandle_touch_nolock(kfshandle_t *handle) {
+	if (handle != newest) {
+		if (handle->older) { handle->older->newer = handle->newer; }
+		else if (oldest == handle) { oldest = handle->newer; }
+		if (handle->newer) { handle->newer->older = handle->older; }
+		handle->older = newest;
+		handle->newer = NULL;
+		if (newest) { newest->newer = handle; }
+		else { oldest = handle; }
+		newest = handle;
+	}
+	handle->used = time(NULL);
+}
+
+// take the handle out of the cache. the caller closes it. the lock must be held.
+static void kfshandle_remove_nolock(kfshandle_t *handle);
+static void kfshandle_remove_nolock(kfshandle_t *handle) {
+	kfshandle_t **link = kfshandle_bucket(handle->identifier, handle->fileid);
+	while (*link != handle) { link = &(*link)->chain; }
+	*link = handle->chain;
+
+	if (handle->older) { handle->older->newer = handle->newer; }
+	else { oldest = handle->newer; }
+	if (handle->newer) { handle->newer->older = handle->older; }
+	else { newest = handle->older; }
+	count--;
+}
+
+static void kfshandle_close(kfshandle_t *handle);
+static void kfshandle_close(kfshandle_t *handle) {
+	if (handle->release) { handle->release(handle->path, handle->value, handle->context); }
+	free(handle->path);
+	free(handle);
+}
+
+// take handles that haven't been used in a while (or any unused handles while
+// there are too many) out of the cache, and return them as a list to close.
+static kfshandle_t *kfshandle_evict_nolock(bool all);
+static kfshandle_t *kfshandle_evict_nolock(bool all) {
+	kfshandle_t *evicted = NULL;
+	time_t now = time(NULL);
+	kfshandle_t *handle = oldest;
+	while (handle) {
+		kfshandle_t *next = handle->newer;
+		bool idle = all || (now - handle->used >= HANDLE_IDLE_TIMEOUT) || count > HANDLE_MAX_ENTRIES;
+		if (handle->refs == 0 && (idle || handle->forgotten)) {
+			kfshandle_remove_nolock(handle);
+			handle->chain = evicted;
+			evicted = handle;
+		}
+		else if (!idle && !handle->forgotten) { break; } // everything newer is in use more recently
+		handle = next;
+	}
+	return evicted;
+}
+
+static void kfshandle_close_all(kfshandle_t *list);
+static void kfshandle_close_all(kfshandle_t *list) {
+	while (list) {
+		kfshandle_t *next = list->chain;
+		kfshandle_close(list);
+		list = next;
+	}
+}
+
+
+// forget the handles for a filesystem (and path, if given). they're closed once
+// they're no longer in use.
+static void kfshandle_forget_matching(kfsid_t identifier, const char *path);
+static void kfshandle_forget_matching(kfsid_t identifier, const char *path) {
+	pthread_mutex_lock(&lock);
+	kfshandle_t *evicted = NULL;
+	for (kfshandle_t *handle = oldest, *next = NULL; handle; handle = next) {
+		next = handle->newer;
+		if (handle->identifier == identifier && (path == NULL || strcmp(handle->path, path) == 0)) {
+			handle->forgotten = true;
+			if (handle->refs == 0) {
+				kfshandle_remove_nolock(handle);
+				handle->chain = evicted;
+				evicted = handle;
+			}
+		}
+	}
+	pthread_mutex_unlock(&lock);
+	kfshandle_close_all(evicted);
+}
+
+
+#pragma mark -
+#pragma mark sweeping
+// ----------------------------------------------------------------------------------------------------
+// sweeping
+// ----------------------------------------------------------------------------------------------------
+
+static void *kfshandle_sweep(void *unused);
+static void *kfshandle_sweep(void *unused) {
+	while (true) {
+		sleep(1);
+		pthread_mutex_lock(&lock);
+		kfshandle_t *evicted = kfshandle_evict_nolock(false);
+		pthread_mutex_unlock(&lock);
+		kfshandle_close_all(evicted);
+	}
+	return NULL; // should never reach here
+}
+
+static void kfshandle_start_sweeping(void);
+static void kfshandle_start_sweeping(void) {
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, kfshandle_sweep, NULL) == 0) {
+		pthread_detach(thread);
+	}
+}
+
+
+#pragma mark -
+#pragma mark function implementation
+// ----------------------------------------------------------------------------------------------------
+// function implementation
+// ----------------------------------------------------------------------------------------------------
+
+bool kfshandle_acquire(kfsid_t identifier, const kfsfilesystem_t *filesystem, const char *path,
+					   kfshandle_t **outHandle, int *error) {
+	*outHandle = NULL;
+	if (filesystem->open == NULL) { return true; }
+	pthread_once(&sweeponce, kfshandle_start_sweeping);
+
+	uint64_t fileid = kfs_fileid(identifier, path);
+	kfshandle_t **bucket = kfshandle_bucket(identifier, fileid);
+
+	pthread_mutex_lock(&lock);
+	kfshandle_t *handle = *bucket;
+	while (handle && !(handle->identifier == identifier && handle->fileid == fileid &&
+					   !handle->forgotten && strcmp(handle->path, path) == 0)) {
+		handle = handle->chain;
+	}
+	if (handle) {
+		handle->refs++;
+		kfshandle_touch_nolock(handle);
+	}
+	pthread_mutex_unlock(&lock);
+
+	if (handle == NULL) {
+		// open without holding the lock. if another worker opens the same file at
+		// the same time, both handles are used, and the extra one is closed once
+		// it's idle.
+		void *value = NULL;
+		if (!filesystem->open(path, &value, error, filesystem->context)) { return false; }
+
+		handle = calloc(1, sizeof(kfshandle_t));
+		handle->identifier = identifier;
+		handle->fileid = fileid;
+		handle->path = strdup(path);
+		handle->value = value;
+		handle->release = filesystem->release;
+		handle->context = filesystem->context;
+		handle->refs = 1;
+
+		pthread_mutex_lock(&lock);
+		handle->chain = *bucket;
+		*bucket = handle;
+		count++;
+		kfshandle_touch_nolock(handle);
+		kfshandle_t *evicted = (count > HANDLE_MAX_ENTRIES) ? kfshandle_evict_nolock(false) : NULL;
+		pthread_mutex_unlock(&lock);
+		kfshandle_close_all(evicted);
+	}
+
+	*outHandle = handle;
+	return true;
+}
+
+void kfshandle_release(kfshandle_t *handle) {
+	if (handle) {
+		pthread_mutex_lock(&lock);
+		bool closed = (--handle->refs == 0 && handle->forgotten);
+		if (closed) { kfshandle_remove_nolock(handle); }
+		pthread_mutex_unlock(&lock);
+		if (closed) { kfshandle_close(handle); }
+	}
+}
+
+void *kfshandle_value(kfshandle_t *handle) {
+	return handle ? handle->value : NULL;
+}
+
+void kfshandle_forget(kfsid_t identifier, const char *path) {
+	kfshandle_forget_matching(identifier, path);
+}
+
+void kfshandle_clear(kfsid_t identifier) {
+	kfshandle_forget_matching(identifier, NULL);
+}
@@ -0,0 +1,72 @@
+//
+//  handlecache.h
+//  KFS
+//
+//  Copyright (c) 2012, FadingRed LLC
+//  All rights reserved.
+//  
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+//  following conditions are met:
+//  
+//    - Redistributions of source code must retain the above copyright notice, this list of conditions and the
+//      following disclaimer.
+//    - Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+//      following disclaimer in the documentation and/or other materials provided with the distribution.
+//    - Neither the name of the FadingRed LLC nor the names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior written permission.
+//  
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+//  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _KFSHANDLECACHE_H_
+#define _KFSHANDLECACHE_H_
+
+#include <stdbool.h>
+#include "kfslib.h"
+
+typedef struct kfshandle kfshandle_t;
+
+/*!
+ \brief		Acquire a handle
+ \details	Gets the handle the filesystem opened for the file at path, opening it if it's not
+			already open. Handles are kept open while they're in use and for a while after, so
+			that a run of reads or writes to a file only opens it once. If the filesystem doesn't
+			open files, this succeeds and sets handle to NULL. Returns false (with an error) if
+			the file couldn't be opened. Every handle acquired must be released.
+ */
+bool kfshandle_acquire(kfsid_t identifier, const kfsfilesystem_t *filesystem, const char *path,
+					   kfshandle_t **handle, int *error);
+
+/*!
+ \brief		Release a handle
+ \details	Releases a handle from kfshandle_acquire. NULL is allowed.
+ */
+void kfshandle_release(kfshandle_t *handle);
+
+/*!
+ \brief		Get the value of a handle
+ \details	Returns what the filesystem's open callback gave for the handle, or NULL if the
+			handle is NULL.
+ */
+void *kfshandle_value(kfshandle_t *handle);
+
+/*!
+ \brief		Forget the handle for a path
+ \details	Closes the handle for the file at path (once it's no longer in use) so that it isn't
+			used again. Call this once the file has been removed or renamed.
+ */
+void kfshandle_forget(kfsid_t identifier, const char *path);
+
+/*!
+ \brief		Forget the handles for a filesystem
+ \details	Closes every handle for the filesystem once it's no longer in use.
+ */
+void kfshandle_clear(kfsid_t identifier);
+
+#endif
@@ -0,0 +1,202 @@
+//
+//  namecache.c
+//  KFS
+//
+//  Copyright (c) 2012, FadingRed LLC
+//  All rights reserved.
+//  
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+//  following conditions are met:
+//  
+//    - Redistributions of source code must retain the above copyright notice, this list of conditions and the
+//      following disclaimer.
+//    - Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+//      following disclaimer in the documentation and/or other materials provided with the distribution.
+//    - Neither the name of the FadingRed LLC nor the names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior written permission.
+//  
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+//  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+#include "namecache.h"
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#define NAME_BUCKETS		1024
+#define NAME_MAX_ENTRIES	4096
+#define NAME_VERSIONS		4096
+
+typedef struct kfsnameentry kfsnameentry_t;
+struct kfsnameentry {
+	kfsid_t identifier;
+	uint64_t parent;
+	uint64_t hash;
+	uint64_t fileid;		// 0 when nothing has the name
+	uint64_t expires;		// in milliseconds
+	kfsnameentry_t *chain;	// next in the bucket
+	kfsnameentry_t *older;	// least recently stored first, for eviction
+	kfsnameentry_t *newer;
+	char name[];
+};
+
+static kfsnameentry_t *buckets[NAME_BUCKETS];
+static kfsnameentry_t *oldest = NULL;
+static kfsnameentry_t *newest = NULL;
+static unsigned int count = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+// directories share versions when they hash the same, which is harmless.
+static uint64_t versions[NAME_VERSIONS];
+
+
+#pragma mark -
+#pragma mark entries
+// ----------------------------------------------------------------------------------------------------
+// entries
+// ----------------------------------------------------------------------------------------------------
+
+static uint64_t kfsnamecache_now(void);
+static uint64_t kfsnamecache_now(void) {
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_usec / 1000;
+}
+
+static uint64_t kfsnamecache_hash(kfsid_t identifier, uint64_t parent, const char *name);
+static uint64_t kfsnamecache_hash(kfsid_t identifier, uint64_t parent, const char *name) {
+	uint64_t hash = (parent * 0x9E3779B97F4A7C15ull) ^ (uint64_t)identifier;
+	for (const unsigned char *c = (const unsigned char *)name; *c; c++) {
+		hash = (hash ^ *c) * 0x100000001B3ull;
+	}
+	return hash;
+}
+
+static uint64_t *kfsnamecache_version_slot(kfsid_t identifier, uint64_t parent);
+static uint64_t *kfsnamecache_version_slot(kfsid_t identifier, uint64_t parent) {
+	uint64_t hash = (parent * 0x9E3779B97F4A7C15ull) ^ (uint64_t)identifier;
+	return &versions[(hash >> 32) % NAME_VERSIONS];
+}
+
+static kfsnameentry_t *kfsnamecache_find_nolock(kfsid_t identifier, uint64_t parent, const char *name, uint64_t hash);
+static kfsnameentry_t *kfsnamecache_find_nolock(kfsid_t identifier, uint64_t parent, const char *name, uint64_t hash) {
+	kfsnameentry_t *entry = buckets[(hash >> 32) % NAME_BUCKETS];
+	while (entry && !(entry->hash == hash && entry->identifier == identifier &&
+					  entry->parent == parent && strcmp(entry->name, name) == 0)) {
+		entry = entry->chain;
+	}
+	return entry;
+}
+
+// unlink and free the entry. the lock must be held.
+static void kfsnamecache_remove_nolock(kfsnameentry_t *entry);
+static void kfsnamecache_remove_nolock(kfsnameentry_t *entry) {
+	kfsnameentry_t **link = &buckets[(entry->hash >> 32) % NAME_BUCKETS];
+	while (*link != entry) { link = &(*link)->chain; }
+	*link = entry->chain;
+
+	if (entry->older) { entry->older->newer = entry->newer; }
+	else { oldest = entry->newer; }
+	if (entry->newer) { entry->newer->older = entry->older; }
+	else { newest = entry->older; }
+	count--;
+	free(entry);
+}
+
+
+#pragma mark -
+#pragma mark function implementation
+// ----------------------------------------------------------------------------------------------------
+// function implementation
+// ----------------------------------------------------------------------------------------------------
+
+uint64_t kfsnamecache_version(kfsid_t identifier, uint64_t parent) {
+	pthread_mutex_lock(&lock);
+	uint64_t result = *kfsnamecache_version_slot(identifier, parent);
+	pthread_mutex_unlock(&lock);
+	return result;
+}
+
+void kfsnamecache_set(kfsid_t identifier, const kfsfilesystem_t *filesystem, uint64_t parent,
+	const char *name, uint64_t fileid, uint64_t version) {
+	uint64_t timeout = kfsfilesystem_attr_timeout(filesystem);
+	uint64_t hash = kfsnamecache_hash(identifier, parent, name);
+	size_t length = strlen(name) + 1;
+	pthread_mutex_lock(&lock);
+	if (version == *kfsnamecache_version_slot(identifier, parent)) {
+		kfsnameentry_t *entry = kfsnamecache_find_nolock(identifier, parent, name, hash);
+		if (entry) { kfsnamecache_remove_nolock(entry); }
+
+		entry = malloc(sizeof(kfsnameentry_t) + length);
+		entry->identifier = identifier;
+		entry->parent = parent;
+		entry->hash = hash;
+		entry->fileid = fileid;
+		entry->expires = kfsnamecache_now() + timeout;
+		memcpy(entry->name, name, length);
+
+		kfsnameentry_t **bucket = &buckets[(hash >> 32) % NAME_BUCKETS];
+		entry->chain = *bucket;
+		*bucket = entry;
+		entry->older = newest;
+		entry->newer = NULL;
+		if (newest) { newest->newer = entry; }
+		else { oldest = entry; }
+		newest = entry;
+		count++;
+
+		while (count > NAME_MAX_ENTRIES) { kfsnamecache_remove_nolock(oldest); }
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+bool kfsnamecache_get(kfsid_t identifier, uint64_t parent, const char *name, uint64_t *fileid) {
+	bool result = false;
+	uint64_t hash = kfsnamecache_hash(identifier, parent, name);
+	pthread_mutex_lock(&lock);
+	kfsnameentry_t *entry = kfsnamecache_find_nolock(identifier, parent, name, hash);
+	if (entry && entry->expires <= kfsnamecache_now()) {
+		kfsnamecache_remove_nolock(entry);
+	} else if (entry) {
+		*fileid = entry->fileid;
+		result = true;
+	}
+	pthread_mutex_unlock(&lock);
+	return result;
+}
+
+void kfsnamecache_remove(kfsid_t identifier, uint64_t parent, const char *name) {
+	uint64_t hash = kfsnamecache_hash(identifier, parent, name);
+	pthread_mutex_lock(&lock);
+	(*kfsnamecache_version_slot(identifier, parent))++;
+	kfsnameentry_t *entry = kfsnamecache_find_nolock(identifier, parent, name, hash);
+	if (entry) { kfsnamecache_remove_nolock(entry); }
+	pthread_mutex_unlock(&lock);
+}
+
+void kfsnamecache_invalidate(kfsid_t identifier, uint64_t parent) {
+	pthread_mutex_lock(&lock);
+	(*kfsnamecache_version_slot(identifier, parent))++;
+	for (kfsnameentry_t *entry = oldest, *next = NULL; entry; entry = next) {
+		next = entry->newer;
+		if (entry->identifier == identifier && entry->parent == parent) { kfsnamecache_remove_nolock(entry); }
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void kfsnamecache_clear(kfsid_t identifier) {
+	pthread_mutex_lock(&lock);
+	for (unsigned int i = 0; i < NAME_VERSIONS; i++) { versions[i]++; }
+	for (kfsnameentry_t *entry = oldest, *next = NULL; entry; entry = next) {
+		next = entry->newer;
+		if (entry->identifier == identifier) { kfsnamecache_remove_nolock(entry); }
+	}
+	pthread_mutex_unlock(&lock);
+}
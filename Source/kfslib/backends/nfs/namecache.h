@@ -0,0 +1,75 @@
+//
+//  namecache.h
+//  KFS
+//
+//  Copyright (c) 2012, FadingRed LLC
+//  All rights reserved.
+//  
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+//  following conditions are met:
+//  
+//    - Redistributions of source code must retain the above copyright notice, this list of conditions and the
+//      following disclaimer.
+//    - Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+//      following disclaimer in the documentation and/or other materials provided with the distribution.
+//    - Neither the name of the FadingRed LLC nor the names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior written permission.
+//  
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+//  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+#ifndef _KFSNAMECACHE_H_
+#define _KFSNAMECACHE_H_
+
+#include <stdbool.h>
+#include "kfslib.h"
+
+/*!
+ \brief		Get the version of a directory
+ \details	The version changes whenever a name in the directory is invalidated. Get it before
+			asking the filesystem whether a name exists, and pass it to kfsnamecache_set so that
+			an answer found while the directory was being changed isn't cached.
+ */
+uint64_t kfsnamecache_version(kfsid_t identifier, uint64_t parent);
+
+/*!
+ \brief		Cache a name
+ \details	Stores the file id of a name in a directory, or 0 if nothing has that name, unless the
+			directory's version has changed. It's kept for the filesystem's attr_timeout.
+ */
+void kfsnamecache_set(kfsid_t identifier, const kfsfilesystem_t *filesystem, uint64_t parent,
+	const char *name, uint64_t fileid, uint64_t version);
+
+/*!
+ \brief		Get a cached name
+ \details	Returns true if a name in a directory was looked up recently enough to still be
+			trusted, and gets its file id (0 if it doesn't exist). Never calls into the
+			filesystem.
+ */
+bool kfsnamecache_get(kfsid_t identifier, uint64_t parent, const char *name, uint64_t *fileid);
+
+/*!
+ \brief		Invalidate a cached name
+ \details	Removes a name in a directory. Call this once a file of that name has been created
+			or removed.
+ */
+void kfsnamecache_remove(kfsid_t identifier, uint64_t parent, const char *name);
+
+/*!
+ \brief		Invalidate cached names in a directory
+ \details	Removes every name in a directory.
+ */
+void kfsnamecache_invalidate(kfsid_t identifier, uint64_t parent);
+
+/*!
+ \brief		Invalidate cached names for a filesystem
+ \details	Removes every name in the filesystem.
+ */
+void kfsnamecache_clear(kfsid_t identifier);
+
+#endif
@@ -28,6 +28,16 @@
 #include "kfslib.h"
 #include "internal.h"
 #include "fileid.h"
+#include "transport.h"
+#include "handlecache.h"
+#include "attrcache.h"
+#include "writeback.h"
+#include "readahead.h"
+#include "blockcache.h"
+#include "dircache.h"
+#include "namecache.h"
+#include "nfs3programs.h"
+#include "bufferpool.h"
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
@@ -44,7 +54,7 @@
 	if (strlen(format)) { dlog(format, ##__VA_ARGS__); } \
 } while (0)
 #define dlog_end() do { \
-	dlog("\t%s %i", result.status == NFS3_OK ? "ok" : "error", result.status); \
+	dlog("\t%s %i", result->status == NFS3_OK ? "ok" : "error", result->status); \
 } while (0)
 #else
 #define dlog(format, ...)
@@ -86,6 +96,43 @@ const kfsfilesystem_t *get_filesystem(nfs_fh3 object, const char **outPath, uint
 	return get_filesystem_from_path(object.data.data_val, outPath, outIdentifier);
 }
 
+// the filesystem and file ids in a handle, without looking up the path.
+void get_identifiers(nfs_fh3 object, uint64_t *outIdentifier, uint64_t *outFileid);
+void get_identifiers(nfs_fh3 object, uint64_t *outIdentifier, uint64_t *outFileid) {
+	char *fileid_str = NULL;
+	uint64_t fsid = (uint64_t)strtoull(object.data.data_val, &fileid_str, 10);
+	*outIdentifier = fsid;
+	*outFileid = (*fileid_str == ':') ? (uint64_t)strtoull(fileid_str + 1, NULL, 10) : kfs_fileid(fsid, "/");
+}
+
+// forget the cached attributes and data of a file once it's been changed. this
+// must happen before getting post op attributes for the change.
+void invalidate_fileid(uint64_t identifier, uint64_t fileid);
+void invalidate_fileid(uint64_t identifier, uint64_t fileid) {
+	kfsattrcache_invalidate(identifier, fileid);
+	kfsreadahead_invalidate(identifier, fileid);
+	kfsblockcache_invalidate(identifier, fileid);
+	kfsdircache_invalidate(identifier, fileid);
+}
+
+void invalidate_cached(nfs_fh3 object);
+void invalidate_cached(nfs_fh3 object) {
+	uint64_t identifier = 0;
+	uint64_t fileid = 0;
+	get_identifiers(object, &identifier, &fileid);
+	invalidate_fileid(identifier, fileid);
+}
+
+// forget whether a name in a directory exists once a file of that name has been
+// created or removed.
+void invalidate_name(nfs_fh3 dir, const char *name);
+void invalidate_name(nfs_fh3 dir, const char *name) {
+	uint64_t identifier = 0;
+	uint64_t parent = 0;
+	get_identifiers(dir, &identifier, &parent);
+	kfsnamecache_remove(identifier, parent, name);
+}
+
 nfsstat3 convert_status(int err, nfsstat3 default_status);
 nfsstat3 convert_status(int err, nfsstat3 default_status) {
 	switch (err) {
@@ -111,53 +158,76 @@ nfsstat3 convert_status(int err, nfsstat3 default_status) {
 	}
 }
 
+void fattr_from_stat(const kfsstat_t *sbuf, uint64_t fileid, fattr3 *result);
+void fattr_from_stat(const kfsstat_t *sbuf, uint64_t fileid, fattr3 *result) {
+	*result = (fattr3){};
+	
+	if (0) {}
+	else if (sbuf->type == KFS_REG) { result->type = NF3REG; }
+	else if (sbuf->type == KFS_DIR) { result->type = NF3DIR; }
+	else if (sbuf->type == KFS_BLK) { result->type = NF3BLK; }
+	else if (sbuf->type == KFS_CHR) { result->type = NF3CHR; }
+	else if (sbuf->type == KFS_LNK) { result->type = NF3LNK; }
+	else if (sbuf->type == KFS_SOCK) { result->type = NF3SOCK; }
+	else if (sbuf->type == KFS_FIFO) { result->type = NF3FIFO; }
+	
+	if (sbuf->mode & KFS_IRUSR) { result->mode |= NFS_IRUSR; }
+	if (sbuf->mode & KFS_IWUSR) { result->mode |= NFS_IWUSR; }
+	if (sbuf->mode & KFS_IXUSR) { result->mode |= NFS_IXUSR; }
+	if (sbuf->mode & KFS_IRGRP) { result->mode |= NFS_IRGRP; }
+	if (sbuf->mode & KFS_IWGRP) { result->mode |= NFS_IWGRP; }
+	if (sbuf->mode & KFS_IXGRP) { result->mode |= NFS_IXGRP; }
+	if (sbuf->mode & KFS_IROTH) { result->mode |= NFS_IROTH; }
+	if (sbuf->mode & KFS_IWOTH) { result->mode |= NFS_IWOTH; }
+	if (sbuf->mode & KFS_IXOTH) { result->mode |= NFS_IXOTH; }
+	
+	result->nlink = 1;
+	result->uid = getuid();
+	result->gid = getgid();
+	result->size = sbuf->size;
+	result->used = sbuf->used;
+	result->rdev = (specdata3){ 0, 0 };
+	result->fsid = 0;
+	result->fileid = fileid;
+	result->atime = (nfstime3){ sbuf->atime.sec, sbuf->atime.nsec };
+	result->mtime = (nfstime3){ sbuf->mtime.sec, sbuf->mtime.nsec };
+	result->ctime = (nfstime3){ sbuf->ctime.sec, sbuf->ctime.nsec };
+}
+
+// stat a path, only making its file id once it's known to exist.
+nfsstat3 get_path_fattr(const kfsfilesystem_t *filesystem, uint64_t identifier, const char *path, fattr3 *result);
+nfsstat3 get_path_fattr(const kfsfilesystem_t *filesystem, uint64_t identifier, const char *path, fattr3 *result) {
+	nfsstat3 status = NFS3_OK;
+	int error = 0;
+	kfsstat_t sbuf = {};
+	// attributes are only cached for a file that already had an id, since the
+	// version can't be read for one that doesn't exist yet.
+	uint64_t existing = fileid_frompath(identifier, path);
+	uint64_t version = kfsattrcache_version(identifier, existing);
+	if (filesystem->stat(path, &sbuf, &error, filesystem->context)) {
+		uint64_t fileid = kfs_fileid(identifier, path);
+		fattr_from_stat(&sbuf, fileid, result);
+		kfswriteback_size(identifier, fileid, &result->size);
+		if (fileid == existing) { kfsattrcache_set(identifier, filesystem, fileid, result, version); }
+	} else { // stat failed
+		status = convert_status(error, NFS3ERR_NOENT);
+	}
+	return status;
+}
+
 nfsstat3 get_fattr(nfs_fh3 object, fattr3 *result);
 nfsstat3 get_fattr(nfs_fh3 object, fattr3 *result) {
 	nfsstat3 status = NFS3_OK;
 	uint64_t identifier = 0;
-	int error = 0;
 	const char *path = NULL;
+	uint64_t fileid = 0;
 	const kfsfilesystem_t *filesystem = get_filesystem(object, &path, &identifier);
-	if (filesystem) {
+	get_identifiers(object, &(uint64_t){0}, &fileid);
+	if (filesystem && kfsattrcache_get(identifier, fileid, result)) {
+		dlog("\t%s (path, cached)", path);
+	} else if (filesystem) {
 		dlog("\t%s (path, getattr)", path);
-		
-		kfsstat_t sbuf = {};
-		if (filesystem->stat(path, &sbuf, &error, filesystem->context)) {
-			*result = (fattr3){};
-			
-			if (0) {}
-			else if (sbuf.type == KFS_REG) { result->type = NF3REG; }
-			else if (sbuf.type == KFS_DIR) { result->type = NF3DIR; }
-			else if (sbuf.type == KFS_BLK) { result->type = NF3BLK; }
-			else if (sbuf.type == KFS_CHR) { result->type = NF3CHR; }
-			else if (sbuf.type == KFS_LNK) { result->type = NF3LNK; }
-			else if (sbuf.type == KFS_SOCK) { result->type = NF3SOCK; }
-			else if (sbuf.type == KFS_FIFO) { result->type = NF3FIFO; }
-			
-			if (sbuf.mode & KFS_IRUSR) { result->mode |= NFS_IRUSR; }
-			if (sbuf.mode & KFS_IWUSR) { result->mode |= NFS_IWUSR; }
-			if (sbuf.mode & KFS_IXUSR) { result->mode |= NFS_IXUSR; }
-			if (sbuf.mode & KFS_IRGRP) { result->mode |= NFS_IRGRP; }
-			if (sbuf.mode & KFS_IWGRP) { result->mode |= NFS_IWGRP; }
-			if (sbuf.mode & KFS_IXGRP) { result->mode |= NFS_IXGRP; }
-			if (sbuf.mode & KFS_IROTH) { result->mode |= NFS_IROTH; }
-			if (sbuf.mode & KFS_IWOTH) { result->mode |= NFS_IWOTH; }
-			if (sbuf.mode & KFS_IXOTH) { result->mode |= NFS_IXOTH; }
-			
-			result->nlink = 1;
-			result->uid = getuid();
-			result->gid = getgid();
-			result->size = sbuf.size;
-			result->used = sbuf.used;
-			result->rdev = (specdata3){ 0, 0 };
-			result->fsid = 0;
-			result->fileid = kfs_fileid(identifier, path);
-			result->atime = (nfstime3){ sbuf.atime.sec, sbuf.atime.nsec };
-			result->mtime = (nfstime3){ sbuf.mtime.sec, sbuf.mtime.nsec };
-			result->ctime = (nfstime3){ sbuf.ctime.sec, sbuf.ctime.nsec };
-		} else { // stat failed
-			status = convert_status(error, NFS3ERR_NOENT);
-		}
+		status = get_path_fattr(filesystem, identifier, path, result);
 	} else { // no filesystem
 		status = NFS3ERR_BADHANDLE;
 	}
@@ -169,17 +239,22 @@ nfsstat3 get_fattr(nfs_fh3 object, fattr3 *result) {
 nfsstat3 set_fattr(nfs_fh3 object, const sattr3 *attrs);
 nfsstat3 set_fattr(nfs_fh3 object, const sattr3 *attrs) {
 	nfsstat3 status = NFS3_OK;
+	uint64_t identifier = 0;
 	int error = 0;
 	const char *path = NULL;
-	const kfsfilesystem_t *filesystem = get_filesystem(object, &path, NULL);
+	const kfsfilesystem_t *filesystem = get_filesystem(object, &path, &identifier);
 	if (filesystem) {
 		dlog("\t%s (path, setattr)", path);
 
 		// check for resize
 		if (status == NFS3_OK && attrs->size.set_it) {
-			if (!filesystem->truncate(path, attrs->size.set_size3_u.size, &error, filesystem->context)) {
+			kfshandle_t *handle = NULL;
+			if (!kfswriteback_flush(identifier, kfs_fileid(identifier, path), &error) ||
+				!kfshandle_acquire(identifier, filesystem, path, &handle, &error) ||
+				!filesystem->truncate(path, kfshandle_value(handle), attrs->size.set_size3_u.size, &error, filesystem->context)) {
 				status = convert_status(error, NFS3ERR_NOENT); // truncate failed
 			}
+			kfshandle_release(handle);
 		}
 
 		// check for mode change
@@ -232,6 +307,8 @@ nfsstat3 set_fattr(nfs_fh3 object, const sattr3 *attrs) {
 				status = NFS3ERR_NOTSUPP;
 			}
 		}
+
+		invalidate_cached(object);
 	} else { // no filesystem
 		status = NFS3ERR_BADHANDLE;
 	}
@@ -247,21 +324,202 @@ nfsstat3 get_required_post_op(post_op_attr *result, nfs_fh3 object) {
 
 nfsstat3 get_pre_op(pre_op_attr *result, nfs_fh3 object);
 nfsstat3 get_pre_op(pre_op_attr *result, nfs_fh3 object) {
-	result->attributes_follow = false;
+	// only cached attributes are used, so this never costs a stat. the client
+	// just won't be able to tell whether anyone else changed the object.
+	uint64_t identifier = 0;
+	uint64_t fileid = 0;
+	fattr3 attributes;
+	get_identifiers(object, &identifier, &fileid);
+	result->attributes_follow = kfsattrcache_get(identifier, fileid, &attributes);
+	if (result->attributes_follow) {
+		result->pre_op_attr_u.attributes.size = attributes.size;
+		result->pre_op_attr_u.attributes.mtime = attributes.mtime;
+		result->pre_op_attr_u.attributes.ctime = attributes.ctime;
+	}
 	return NFS3_OK;
 }
 
+char *copy_string(struct svc_req *rqstp, const char *string);
+char *copy_string(struct svc_req *rqstp, const char *string) {
+	size_t length = strlen(string) + 1;
+	char *result = kfstransport_alloc(rqstp, length);
+	memcpy(result, string, length);
+	return result;
+}
+
+nfs_fh3 copy_fh(struct svc_req *rqstp, nfs_fh3 object);
+nfs_fh3 copy_fh(struct svc_req *rqstp, nfs_fh3 object) {
+	nfs_fh3 result = object;
+	result.data.data_val = kfstransport_alloc(rqstp, object.data.data_len);
+	memcpy(result.data.data_val, object.data.data_val, object.data.data_len);
+	return result;
+}
+
 nfsstat3 get_post_op(post_op_attr *result, nfs_fh3 object);
 nfsstat3 get_post_op(post_op_attr *result, nfs_fh3 object) {
-	// we could get post op attributes here, but there's little
-	// reason to. we're not really trying to handle the same
-	// complexities of a real NFS server. if there's a reason
-	// to, though, it's easy with:
-	// return get_required_post_op(result, object);
-	result->attributes_follow = false;
+	// post op attributes are optional, so they're only sent when they're cached
+	// and it doesn't cost a stat. when they are sent, the client doesn't need to
+	// follow up with a getattr. use get_required_post_op to always send them.
+	uint64_t identifier = 0;
+	uint64_t fileid = 0;
+	get_identifiers(object, &identifier, &fileid);
+	result->attributes_follow = kfsattrcache_get(identifier, fileid, &result->post_op_attr_u.attributes);
 	return NFS3_OK;
 }
 
+nfsstat3 get_changed_post_op(post_op_attr *result, nfs_fh3 object);
+nfsstat3 get_changed_post_op(post_op_attr *result, nfs_fh3 object) {
+	// after a change, anything cached is out of date. getting the attributes
+	// again here caches them for the calls that follow, and saves the client a
+	// getattr to find out what the change did.
+	invalidate_cached(object);
+	nfsstat3 status = get_required_post_op(result, object);
+	if (status != NFS3_OK) { result->attributes_follow = false; }
+	return status;
+}
+
+
+/* Routing
+ * ------------------------------------------------------------------------- */
+
+// like xdr_WRITE3args, but the data points into the call where it was received
+// rather than being copied (and is left alone when the arguments are freed).
+static bool_t xdr_WRITE3args_inline(XDR *xdrs, WRITE3args *objp);
+static bool_t xdr_WRITE3args_inline(XDR *xdrs, WRITE3args *objp) {
+	if (xdrs->x_op != XDR_DECODE && xdrs->x_op != XDR_FREE) { return xdr_WRITE3args(xdrs, objp); }
+	if (!xdr_nfs_fh3(xdrs, &objp->file)) { return FALSE; }
+	if (xdrs->x_op == XDR_FREE) {
+		objp->data.data_val = NULL;
+		return TRUE;
+	}
+
+	if (!xdr_offset3(xdrs, &objp->offset) ||
+		!xdr_count3(xdrs, &objp->count) ||
+		!xdr_stable_how(xdrs, &objp->stable) ||
+		!xdr_u_int(xdrs, &objp->data.data_len)) { return FALSE; }
+	objp->data.data_val = (char *)xdr_inline(xdrs, (int)RNDUP(objp->data.data_len));
+	return (objp->data.data_val != NULL || objp->data.data_len == 0);
+}
+
+void nfs_route_3(struct svc_req *rqstp, XDR *xdrs, kfsroute_t *route) {
+	// reads and writes move bulk data. everything else is cheap and someone is
+	// usually waiting on it (a shell or the finder), so it goes in its own lane
+	// to stay fast while large copies are in progress.
+	switch (rqstp->rq_proc) {
+		case NFSPROC3_READ:
+		case NFSPROC3_WRITE:
+		case NFSPROC3_COMMIT:
+			route->lane = KFSLANE_DATA;
+			break;
+		default:
+			route->lane = KFSLANE_METADATA;
+			break;
+	}
+	if (rqstp->rq_proc == NFSPROC3_WRITE) { route->args = (xdrproc_t)xdr_WRITE3args_inline; }
+
+	// the kernel retransmits calls that take longer than its (very short)
+	// timeout. these must not be performed a second time.
+	switch (rqstp->rq_proc) {
+		case NFSPROC3_SETATTR:
+		case NFSPROC3_WRITE:
+		case NFSPROC3_CREATE:
+		case NFSPROC3_MKDIR:
+		case NFSPROC3_SYMLINK:
+		case NFSPROC3_MKNOD:
+		case NFSPROC3_REMOVE:
+		case NFSPROC3_RMDIR:
+		case NFSPROC3_RENAME:
+		case NFSPROC3_LINK:
+			route->idempotent = false;
+			break;
+		default:
+			route->idempotent = true;
+			break;
+	}
+
+	kfsid_t identifier = -1;
+	if (rqstp->rq_proc != NFSPROC3_NULL) {
+		// the arguments of every other procedure start with a file handle, and
+		// the handle starts with the filesystem identifier.
+		u_int position = XDR_GETPOS(xdrs);
+		nfs_fh3 object = {};
+		if (xdr_nfs_fh3(xdrs, &object)) {
+			kfsid_t value = 0;
+			u_int i = 0;
+			for (; i < object.data.data_len && object.data.data_val[i] >= '0' && object.data.data_val[i] <= '9'; i++) {
+				value = (value * 10) + (object.data.data_val[i] - '0');
+			}
+			if (i > 0) { identifier = value; }
+		}
+		xdr_free((xdrproc_t)xdr_nfs_fh3, (char *)&object);
+		XDR_SETPOS(xdrs, position);
+	}
+	route->filesystem = identifier;
+}
+
+
+/* Busy Replies
+ * ------------------------------------------------------------------------- */
+
+// NFS3ERR_JUKEBOX tells the client the file isn't available right now, and it
+// tries the call again after a short wait.
+void nfs_busy_3(struct svc_req *rqstp, SVCXPRT *transp) {
+	xdrproc_t xdr_result = NULL;
+	switch (rqstp->rq_proc) {
+		case NFSPROC3_GETATTR: xdr_result = (xdrproc_t)xdr_GETATTR3res; break;
+		case NFSPROC3_SETATTR: xdr_result = (xdrproc_t)xdr_SETATTR3res; break;
+		case NFSPROC3_LOOKUP: xdr_result = (xdrproc_t)xdr_LOOKUP3res; break;
+		case NFSPROC3_ACCESS: xdr_result = (xdrproc_t)xdr_ACCESS3res; break;
+		case NFSPROC3_READLINK: xdr_result = (xdrproc_t)xdr_READLINK3res; break;
+		case NFSPROC3_READ: xdr_result = (xdrproc_t)xdr_READ3res; break;
+		case NFSPROC3_WRITE: xdr_result = (xdrproc_t)xdr_WRITE3res; break;
+		case NFSPROC3_CREATE: xdr_result = (xdrproc_t)xdr_CREATE3res; break;
+		case NFSPROC3_MKDIR: xdr_result = (xdrproc_t)xdr_MKDIR3res; break;
+		case NFSPROC3_SYMLINK: xdr_result = (xdrproc_t)xdr_SYMLINK3res; break;
+		case NFSPROC3_MKNOD: xdr_result = (xdrproc_t)xdr_MKNOD3res; break;
+		case NFSPROC3_REMOVE: xdr_result = (xdrproc_t)xdr_REMOVE3res; break;
+		case NFSPROC3_RMDIR: xdr_result = (xdrproc_t)xdr_RMDIR3res; break;
+		case NFSPROC3_RENAME: xdr_result = (xdrproc_t)xdr_RENAME3res; break;
+		case NFSPROC3_LINK: xdr_result = (xdrproc_t)xdr_LINK3res; break;
+		case NFSPROC3_READDIR: xdr_result = (xdrproc_t)xdr_READDIR3res; break;
+		case NFSPROC3_READDIRPLUS: xdr_result = (xdrproc_t)xdr_READDIRPLUS3res; break;
+		case NFSPROC3_FSSTAT: xdr_result = (xdrproc_t)xdr_FSSTAT3res; break;
+		case NFSPROC3_FSINFO: xdr_result = (xdrproc_t)xdr_FSINFO3res; break;
+		case NFSPROC3_PATHCONF: xdr_result = (xdrproc_t)xdr_PATHCONF3res; break;
+		case NFSPROC3_COMMIT: xdr_result = (xdrproc_t)xdr_COMMIT3res; break;
+		default: return;
+	}
+
+	// every result starts with its status, and a zeroed failure result has no
+	// attributes following it.
+	union {
+		GETATTR3res getattr;
+		SETATTR3res setattr;
+		LOOKUP3res lookup;
+		ACCESS3res access;
+		READLINK3res readlink;
+		READ3res read;
+		WRITE3res write;
+		CREATE3res create;
+		MKDIR3res mkdir;
+		SYMLINK3res symlink;
+		MKNOD3res mknod;
+		REMOVE3res remove;
+		RMDIR3res rmdir;
+		RENAME3res rename;
+		LINK3res link;
+		READDIR3res readdir;
+		READDIRPLUS3res readdirplus;
+		FSSTAT3res fsstat;
+		FSINFO3res fsinfo;
+		PATHCONF3res pathconf;
+		COMMIT3res commit;
+	} result;
+	memset(&result, 0, sizeof(result));
+	*(nfsstat3 *)&result = NFS3ERR_JUKEBOX;
+	svc_sendreply(transp, xdr_result, (caddr_t)&result);
+}
+
 
 /* RPC Methods (stubs generated by rpcgen)
  * ------------------------------------------------------------------------- */
@@ -276,24 +534,24 @@ nfsproc3_null_3_svc(struct svc_req *rqstp) {
 GETATTR3res *
 nfsproc3_getattr_3_svc(GETATTR3args args,  struct svc_req *rqstp) {
 	dlog_begin("\t%s (handle)", args.object.data.data_val);
-	static GETATTR3res result;
-	result.status = get_fattr(args.object, &result.GETATTR3res_u.resok.obj_attributes);
+	GETATTR3res *result = kfstransport_alloc(rqstp, sizeof(GETATTR3res));
+	result->status = get_fattr(args.object, &result->GETATTR3res_u.resok.obj_attributes);
 	dlog_end();
-	return(&result);
+	return(result);
 }
 
 SETATTR3res *
 nfsproc3_setattr_3_svc(SETATTR3args args,  struct svc_req *rqstp) {
 	dlog_begin("");
-	static SETATTR3res result;
+	SETATTR3res *result = kfstransport_alloc(rqstp, sizeof(SETATTR3res));
 
-	pre_op_attr *pre_op = (result.status == NFS3_OK) ?
-		&result.SETATTR3res_u.resok.obj_wcc.before :
-		&result.SETATTR3res_u.resfail.obj_wcc.before;
+	pre_op_attr *pre_op = (result->status == NFS3_OK) ?
+		&result->SETATTR3res_u.resok.obj_wcc.before :
+		&result->SETATTR3res_u.resfail.obj_wcc.before;
 	get_pre_op(pre_op, args.object);
 	
 	// assume we're okay to start
-	result.status = NFS3_OK;
+	result->status = NFS3_OK;
 	
 	// guard check
 	if (args.guard.check) {
@@ -301,45 +559,63 @@ nfsproc3_setattr_3_svc(SETATTR3args args,  struct svc_req *rqstp) {
 		get_fattr(args.object, &attrs);
 		if (attrs.ctime.seconds != args.guard.sattrguard3_u.obj_ctime.seconds ||
 			attrs.ctime.nseconds != args.guard.sattrguard3_u.obj_ctime.nseconds) {
-			result.status = NFS3ERR_NOT_SYNC;
+			result->status = NFS3ERR_NOT_SYNC;
 		}
 	}
 	
 	// after guard check
-	if (result.status == NFS3_OK) {
-		result.status = set_fattr(args.object, &args.new_attributes);
+	if (result->status == NFS3_OK) {
+		result->status = set_fattr(args.object, &args.new_attributes);
 	}
 
-	post_op_attr *post_op = (result.status == NFS3_OK) ?
-		&result.SETATTR3res_u.resok.obj_wcc.after :
-		&result.SETATTR3res_u.resfail.obj_wcc.after;
-	get_post_op(post_op, args.object);
+	post_op_attr *post_op = (result->status == NFS3_OK) ?
+		&result->SETATTR3res_u.resok.obj_wcc.after :
+		&result->SETATTR3res_u.resfail.obj_wcc.after;
+	get_changed_post_op(post_op, args.object);
 	dlog_end();
-	return(&result);
+	return(result);
 }
 
 LOOKUP3res *
 nfsproc3_lookup_3_svc(LOOKUP3args args,  struct svc_req *rqstp) {
 	dlog_begin("\t%s (handle), %s", args.what.dir.data.data_val, args.what.name);
 
-	static LOOKUP3res result;
+	LOOKUP3res *result = kfstransport_alloc(rqstp, sizeof(LOOKUP3res));
 	const char *path = NULL;
 	uint64_t identifier = 0;
 	const kfsfilesystem_t *filesystem = get_filesystem(args.what.dir, &path, &identifier);
 	if (filesystem) {
 		dlog("\t%s (path)", path);
-		static char filehandle[PATH_MAX];
-		static char fspath[PATH_MAX];
+		char fspath[PATH_MAX];
 		bool root = (strcmp(path, "/") == 0);
 		snprintf(fspath, PATH_MAX, root ? "%s%s" : "%s/%s", path, args.what.name);
-		snprintf(filehandle, PATH_MAX, "%llu:%llu", identifier, kfs_fileid(identifier, fspath));
 		
-		result.status = NFS3_OK;
-		result.LOOKUP3res_u.resok.object.data.data_val = filehandle;
-		result.LOOKUP3res_u.resok.object.data.data_len = strlen(filehandle) + 1;
+		// names looked up recently are answered from the cache, even ones that don't
+		// exist. a file id is only made for a name once it's known to exist.
+		uint64_t parent = 0;
+		uint64_t fileid = 0;
+		get_identifiers(args.what.dir, &(uint64_t){0}, &parent);
+		fattr3 *attributes = &result->LOOKUP3res_u.resok.obj_attributes.post_op_attr_u.attributes;
+		nfsstat3 objstatus = NFS3_OK;
+		bool cached = kfsnamecache_get(identifier, parent, args.what.name, &fileid);
+		if (cached && fileid == 0) {
+			objstatus = NFS3ERR_NOENT;
+		} else if (!(cached && kfsattrcache_get(identifier, fileid, attributes))) {
+			uint64_t version = kfsnamecache_version(identifier, parent);
+			objstatus = get_path_fattr(filesystem, identifier, fspath, attributes);
+			fileid = (objstatus == NFS3_OK) ? attributes->fileid : 0;
+			if (objstatus == NFS3_OK || objstatus == NFS3ERR_NOENT) {
+				kfsnamecache_set(identifier, filesystem, parent, args.what.name, fileid, version);
+			}
+		}
 		
-		nfsstat3 objstatus = get_required_post_op(&result.LOOKUP3res_u.resok.obj_attributes,
-												   result.LOOKUP3res_u.resok.object);
+		if (objstatus == NFS3_OK) {
+			char *filehandle = kfstransport_alloc(rqstp, PATH_MAX);
+			snprintf(filehandle, PATH_MAX, "%llu:%llu", identifier, fileid);
+			result->LOOKUP3res_u.resok.object.data.data_val = filehandle;
+			result->LOOKUP3res_u.resok.object.data.data_len = strlen(filehandle) + 1;
+			result->LOOKUP3res_u.resok.obj_attributes.attributes_follow = true;
+		}
 		switch (objstatus) {
 			case NFS3_OK:
 			case NFS3ERR_IO:
@@ -349,29 +625,29 @@ nfsproc3_lookup_3_svc(LOOKUP3args args,  struct svc_req *rqstp) {
 			case NFS3ERR_STALE:
 			case NFS3ERR_BADHANDLE:
 			case NFS3ERR_SERVERFAULT:
-				result.status = objstatus;
+				result->status = objstatus;
 				break;
 			default:
-				result.status = NFS3ERR_SERVERFAULT;
+				result->status = NFS3ERR_SERVERFAULT;
 				break;
 		}
 		
 	} else { // no filesystem
-		result.status = NFS3ERR_BADHANDLE;
+		result->status = NFS3ERR_BADHANDLE;
 	}
 	
-	post_op_attr *post_op = (result.status == NFS3_OK) ?
-		&result.LOOKUP3res_u.resok.dir_attributes :
-		&result.LOOKUP3res_u.resfail.dir_attributes;
+	post_op_attr *post_op = (result->status == NFS3_OK) ?
+		&result->LOOKUP3res_u.resok.dir_attributes :
+		&result->LOOKUP3res_u.resfail.dir_attributes;
 	get_post_op(post_op, args.what.dir);
 	dlog_end();
-	return(&result);
+	return(result);
 }
 
 ACCESS3res *
 nfsproc3_access_3_svc(ACCESS3args args,  struct svc_req *rqstp) {
 	dlog_begin("\t%s (handle), %i", args.object.data.data_val, args.access);
-	static ACCESS3res result;
+	ACCESS3res *result = kfstransport_alloc(rqstp, sizeof(ACCESS3res));
 	
 	fattr3 attr = {};
 	get_fattr(args.object, &attr);
@@ -393,21 +669,21 @@ nfsproc3_access_3_svc(ACCESS3args args,  struct svc_req *rqstp) {
 	else if ((attr.mode & NFS_IXGRP) && (attr.gid == getgid())) { flags |= flags_execute; }
 	else if ((attr.mode & NFS_IXOTH)) { flags |= flags_execute; }
 	
-	result.status = NFS3_OK;
-	result.ACCESS3res_u.resok.access = flags;
+	result->status = NFS3_OK;
+	result->ACCESS3res_u.resok.access = flags;
 	
-	post_op_attr *post_op = (result.status == NFS3_OK) ?
-		&result.ACCESS3res_u.resok.obj_attributes :
-		&result.ACCESS3res_u.resfail.obj_attributes;
+	post_op_attr *post_op = (result->status == NFS3_OK) ?
+		&result->ACCESS3res_u.resok.obj_attributes :
+		&result->ACCESS3res_u.resfail.obj_attributes;
 	get_post_op(post_op, args.object);
 	dlog_end();
-	return(&result);
+	return(result);
 }
 
 READLINK3res *
 nfsproc3_readlink_3_svc(READLINK3args args,  struct svc_req *rqstp) {
 	dlog_begin("\t%s (handle)", args.symlink.data.data_val);
-	static READLINK3res result;
+	READLINK3res *result = kfstransport_alloc(rqstp, sizeof(READLINK3res));
 	int error = 0;
 	const char *path = NULL;
 	const kfsfilesystem_t *filesystem = get_filesystem(args.symlink, &path, NULL);
@@ -415,13 +691,14 @@ nfsproc3_readlink_3_svc(READLINK3args args,  struct svc_req *rqstp) {
 		dlog("\t%s (path)", path);
 		char *data = NULL;
 		if (filesystem->readlink(path, &data, &error, filesystem->context)) {
-			static char buffer[PATH_MAX];
-			strncpy(buffer, data, PATH_MAX);
-			result.status = NFS3_OK;
-			result.READLINK3res_u.resok.data = buffer;
+			size_t length = strlen(data) + 1;
+			char *buffer = kfstransport_alloc(rqstp, length);
+			memcpy(buffer, data, length);
+			result->status = NFS3_OK;
+			result->READLINK3res_u.resok.data = buffer;
 		} else { // readlink failed
-			result.status = convert_status(error, NFS3ERR_INVAL);
-			switch (result.status) {
+			result->status = convert_status(error, NFS3ERR_INVAL);
+			switch (result->status) {
 				case NFS3_OK:
 				case NFS3ERR_IO:
 				case NFS3ERR_INVAL:
@@ -432,170 +709,315 @@ nfsproc3_readlink_3_svc(READLINK3args args,  struct svc_req *rqstp) {
 				case NFS3ERR_SERVERFAULT:
 					break;
 				default:
-					result.status = NFS3ERR_SERVERFAULT;
+					result->status = NFS3ERR_SERVERFAULT;
 					break;
 			}
 		}
 		free(data);
 	} else { // no filesystem
-		result.status = NFS3ERR_BADHANDLE;
+		result->status = NFS3ERR_BADHANDLE;
 	}
-	post_op_attr *post_op = (result.status == NFS3_OK) ?
-		&result.READLINK3res_u.resok.symlink_attributes :
-		&result.READLINK3res_u.resfail.symlink_attributes;
+	post_op_attr *post_op = (result->status == NFS3_OK) ?
+		&result->READLINK3res_u.resok.symlink_attributes :
+		&result->READLINK3res_u.resfail.symlink_attributes;
 	get_post_op(post_op, args.symlink);
 	dlog_end();
-	return(&result);
+	return(result);
+}
+
+typedef struct {
+	READ3res *result;
+	nfs_fh3 file;
+	char *buffer; // from the buffer pool, freed once the reply is sent
+	kfshandle_t *handle;
+} read_state_t;
+
+// the data is sent from the buffer it was read into (or from the file when fd
+// isn't -1), after the rest of the result.
+static void read_reply(struct svc_req *rqstp, READ3res *result, int fd, off_t offset);
+static void read_reply(struct svc_req *rqstp, READ3res *result, int fd, off_t offset) {
+	const char *data = NULL;
+	size_t length = 0;
+	if (result->status == NFS3_OK) {
+		data = result->READ3res_u.resok.data.data_val;
+		length = result->READ3res_u.resok.data.data_len;
+		result->READ3res_u.resok.data.data_val = NULL;
+		result->READ3res_u.resok.data.data_len = 0;
+	}
+
+	bool success = false;
+	if (result->status == NFS3_OK && fd != -1) {
+		success = kfstransport_sendreply_file(rqstp, (xdrproc_t)xdr_READ3res, (caddr_t)result, fd, offset, length);
+	}
+	else { success = kfstransport_sendreply_data(rqstp, (xdrproc_t)xdr_READ3res, (caddr_t)result, data, length); }
+	if (!success) {
+		svcerr_systemerr(rqstp->rq_xprt);
+	}
+}
+
+static void read_complete(READ3res *result, const char *buffer, ssize_t count, int error);
+static void read_complete(READ3res *result, const char *buffer, ssize_t count, int error) {
+	if (count != -1) {
+		result->status = NFS3_OK;
+		result->READ3res_u.resok.data.data_val = (char *)buffer;
+		result->READ3res_u.resok.data.data_len = (u_int)count;
+		result->READ3res_u.resok.count = (count3)count;
+		result->READ3res_u.resok.eof = (count == 0);
+
+	} else { // read failed
+		result->status = convert_status(error, NFS3ERR_IO);
+		switch (result->status) {
+			case NFS3_OK:
+			case NFS3ERR_IO:
+			case NFS3ERR_NXIO:
+			case NFS3ERR_ACCES:
+			case NFS3ERR_INVAL:
+			case NFS3ERR_STALE:
+			case NFS3ERR_BADHANDLE:
+			case NFS3ERR_SERVERFAULT:
+				break;
+			default:
+				result->status = NFS3ERR_SERVERFAULT;
+				break;
+		}
+	}
+}
+
+static void read_resume(struct svc_req *rqstp, void *state, ssize_t count, int error);
+static void read_resume(struct svc_req *rqstp, void *state, ssize_t count, int error) {
+	read_state_t *read = state;
+	READ3res *result = read->result;
+	read_complete(result, read->buffer, count, error);
+	kfshandle_release(read->handle);
+
+	post_op_attr *post_op = (result->status == NFS3_OK) ?
+		&result->READ3res_u.resok.file_attributes :
+		&result->READ3res_u.resfail.file_attributes;
+	get_post_op(post_op, read->file);
+	dlog_end();
+	read_reply(rqstp, result, -1, 0);
+	kfsbuffer_free(read->buffer);
 }
 
 READ3res *
 nfsproc3_read_3_svc(READ3args args,  struct svc_req *rqstp) {
 	dlog_begin("\t%s %lli %i", args.file.data.data_val, args.offset, args.count);
-	static READ3res result;
+	READ3res *result = kfstransport_alloc(rqstp, sizeof(READ3res));
+	const char *borrowed = NULL; // the filesystem's memory, released once the reply is sent
+	char *pooled = NULL; // from the buffer pool, freed once the reply is sent
+	int fd = -1; // the filesystem's file, released once the reply is sent
+	off_t fdoffset = 0;
+	kfshandle_t *handle = NULL;
+	uint64_t identifier = 0;
 	int error = 0;
 	const char *path = NULL;
-	const kfsfilesystem_t *filesystem = get_filesystem(args.file, &path, NULL);
+	const kfsfilesystem_t *filesystem = get_filesystem(args.file, &path, &identifier);
 	if (filesystem) {
 		dlog("\t%s (path)", path);
-		static char buffer[READ_MAX_LEN];
-		int count = 0;
 		int rsize = args.count;
-		if (rsize > READ_MAX_LEN) { rsize = READ_MAX_LEN; }
-		if ((count = filesystem->read(path, buffer, args.offset, rsize, &error, filesystem->context)) != -1) {
-			result.status = NFS3_OK;
-			result.READ3res_u.resok.data.data_val = buffer;
-			result.READ3res_u.resok.data.data_len = READ_MAX_LEN;
-			result.READ3res_u.resok.count = count;
-			result.READ3res_u.resok.eof = (count == 0);
-
-		} else { // read failed
-			result.status = convert_status(error, NFS3ERR_IO);
-			switch (result.status) {
-				case NFS3_OK:
-				case NFS3ERR_IO:
-				case NFS3ERR_NXIO:
-				case NFS3ERR_ACCES:
-				case NFS3ERR_INVAL:
-				case NFS3ERR_STALE:
-				case NFS3ERR_BADHANDLE:
-				case NFS3ERR_SERVERFAULT:
-					break;
-				default:
-					result.status = NFS3ERR_SERVERFAULT;
-					break;
-			}
+		if ((size_t)rsize > kfsfilesystem_rsize(filesystem)) { rsize = (int)kfsfilesystem_rsize(filesystem); }
+		if (!kfswriteback_flush(identifier, kfs_fileid(identifier, path), &error) || // buffered writes failed
+			!kfshandle_acquire(identifier, filesystem, path, &handle, &error)) { // open failed
+			read_complete(result, NULL, -1, error);
+		} else if (filesystem->read_async) { // reply once the filesystem completes the read
+			read_state_t *state = kfstransport_alloc(rqstp, sizeof(read_state_t));
+			state->result = result;
+			state->file = copy_fh(rqstp, args.file);
+			state->buffer = kfsbuffer_alloc(rsize, NULL);
+			state->handle = handle;
+			kfsreq_t *req = kfstransport_defer(rqstp, read_resume, state);
+			filesystem->read_async(copy_string(rqstp, path), kfshandle_value(handle),
+								   state->buffer, args.offset, rsize, req, filesystem->context);
+			return NULL;
+		} else if (filesystem->read_file) { // reply straight from the filesystem's file
+			ssize_t count = filesystem->read_file(path, kfshandle_value(handle), args.offset, rsize,
+												  &fd, &fdoffset, &error, filesystem->context);
+			if (count > rsize) { count = rsize; }
+			if (count == -1) { fd = -1; }
+			read_complete(result, NULL, count, error);
+		} else if (filesystem->read_buffer) { // reply straight from the filesystem's memory
+			const char *buffer = NULL;
+			ssize_t count = filesystem->read_buffer(path, kfshandle_value(handle), &buffer, args.offset, rsize,
+													&error, filesystem->context);
+			if (count > rsize) { count = rsize; }
+			if (count != -1) { borrowed = buffer; }
+			read_complete(result, buffer, count, error);
+		} else {
+			pooled = kfsbuffer_alloc(rsize, NULL);
+			ssize_t count = kfsblockcache_read(identifier, filesystem, path, kfshandle_value(handle), pooled,
+											   args.offset, rsize, &error);
+			read_complete(result, pooled, count, error);
 		}
 	} else { // no filesystem
-		result.status = NFS3ERR_BADHANDLE;
+		result->status = NFS3ERR_BADHANDLE;
 	}
 	
-	post_op_attr *post_op = (result.status == NFS3_OK) ?
-		&result.READ3res_u.resok.file_attributes :
-		&result.READ3res_u.resfail.file_attributes;
+	post_op_attr *post_op = (result->status == NFS3_OK) ?
+		&result->READ3res_u.resok.file_attributes :
+		&result->READ3res_u.resfail.file_attributes;
 	get_post_op(post_op, args.file);
 	dlog_end();
-	return(&result);
+	read_reply(rqstp, result, fd, fdoffset);
+	kfsbuffer_free(pooled);
+	if (borrowed && filesystem->release_buffer) { filesystem->release_buffer(borrowed, filesystem->context); }
+	if (fd != -1 && filesystem->release_file) { filesystem->release_file(fd, filesystem->context); }
+	kfshandle_release(handle);
+	return NULL; // already replied
+}
+
+typedef struct {
+	WRITE3res *result;
+	nfs_fh3 file;
+	kfshandle_t *handle;
+} write_state_t;
+
+static void write_complete(WRITE3res *result, ssize_t count, stable_how committed, int error);
+static void write_complete(WRITE3res *result, ssize_t count, stable_how committed, int error) {
+	if (count != -1) {
+		result->status = NFS3_OK;
+		result->WRITE3res_u.resok.count = (count3)count;
+		result->WRITE3res_u.resok.committed = committed;
+		kfswriteback_verifier(result->WRITE3res_u.resok.verf);
+	} else { // write failed
+		result->status = convert_status(error, NFS3ERR_IO);
+		switch (result->status) {
+			case NFS3_OK:
+			case NFS3ERR_IO:
+			case NFS3ERR_ACCES:
+			case NFS3ERR_FBIG:
+			case NFS3ERR_DQUOT:
+			case NFS3ERR_NOSPC:
+			case NFS3ERR_ROFS:
+			case NFS3ERR_INVAL:
+			case NFS3ERR_STALE:
+			case NFS3ERR_BADHANDLE:
+			case NFS3ERR_SERVERFAULT:
+				break;
+			default:
+				result->status = NFS3ERR_SERVERFAULT;
+				break;
+		}
+	}
+}
+
+static void write_resume(struct svc_req *rqstp, void *state, ssize_t count, int error);
+static void write_resume(struct svc_req *rqstp, void *state, ssize_t count, int error) {
+	write_state_t *write = state;
+	WRITE3res *result = write->result;
+	write_complete(result, count, FILE_SYNC, error);
+	kfshandle_release(write->handle);
+
+	post_op_attr *post_op = (result->status == NFS3_OK) ?
+		&result->WRITE3res_u.resok.file_wcc.after :
+		&result->WRITE3res_u.resfail.file_wcc.after;
+	get_changed_post_op(post_op, write->file);
+	dlog_end();
+	if (!svc_sendreply(rqstp->rq_xprt, (xdrproc_t)xdr_WRITE3res, (caddr_t)result)) {
+		svcerr_systemerr(rqstp->rq_xprt);
+	}
 }
 
 WRITE3res *
 nfsproc3_write_3_svc(WRITE3args args,  struct svc_req *rqstp) {
 	dlog_begin("\t%s (handle) %lli %i", args.file.data.data_val, args.offset, args.count);
-	static WRITE3res result;
+	WRITE3res *result = kfstransport_alloc(rqstp, sizeof(WRITE3res));
+	kfshandle_t *handle = NULL;
+	uint64_t identifier = 0;
 	int error = 0;
 	const char *path = NULL;
-	const kfsfilesystem_t *filesystem = get_filesystem(args.file, &path, NULL);
+	const kfsfilesystem_t *filesystem = get_filesystem(args.file, &path, &identifier);
 
-	pre_op_attr *pre_op = (result.status == NFS3_OK) ?
-		&result.WRITE3res_u.resok.file_wcc.before :
-		&result.WRITE3res_u.resfail.file_wcc.before;
+	pre_op_attr *pre_op = (result->status == NFS3_OK) ?
+		&result->WRITE3res_u.resok.file_wcc.before :
+		&result->WRITE3res_u.resfail.file_wcc.before;
 	get_pre_op(pre_op, args.file);
 	
 	if (filesystem) {
 		dlog("\t%s (path)", path);
-		int count = 0;
 		int wsize = args.count;
-		if (wsize > WRITE_MAX_LEN) { wsize = WRITE_MAX_LEN; }
-		if ((count = filesystem->write(path, args.data.data_val, args.offset, wsize, &error, filesystem->context)) != -1) {
-			result.status = NFS3_OK;
-			result.WRITE3res_u.resok.count = count;
-			result.WRITE3res_u.resok.committed = FILE_SYNC;
-		} else { // write failed
-			result.status = convert_status(error, NFS3ERR_IO);
-			switch (result.status) {
-				case NFS3_OK:
-				case NFS3ERR_IO:
-				case NFS3ERR_ACCES:
-				case NFS3ERR_FBIG:
-				case NFS3ERR_DQUOT:
-				case NFS3ERR_NOSPC:
-				case NFS3ERR_ROFS:
-				case NFS3ERR_INVAL:
-				case NFS3ERR_STALE:
-				case NFS3ERR_BADHANDLE:
-				case NFS3ERR_SERVERFAULT:
-					break;
-				default:
-					result.status = NFS3ERR_SERVERFAULT;
-					break;
-			}
+		if ((size_t)wsize > kfsfilesystem_wsize(filesystem)) { wsize = (int)kfsfilesystem_wsize(filesystem); }
+		if (wsize > args.data.data_len) { wsize = args.data.data_len; }
+		if (filesystem->options.writeback && args.stable == UNSTABLE) { // reply once the data is buffered
+			bool buffered = kfswriteback_write(identifier, filesystem, path, args.data.data_val, args.offset, wsize, &error);
+			write_complete(result, buffered ? wsize : -1, UNSTABLE, error);
+		} else if (!kfswriteback_flush(identifier, kfs_fileid(identifier, path), &error) || // buffered writes failed
+				   !kfshandle_acquire(identifier, filesystem, path, &handle, &error)) { // open failed
+			write_complete(result, -1, FILE_SYNC, error);
+		} else if (filesystem->write_async) { // reply once the filesystem completes the write
+			// the data is where the call was received, which is kept until the reply
+			const char *buffer = args.data.data_val;
+			write_state_t *state = kfstransport_alloc(rqstp, sizeof(write_state_t));
+			state->result = result;
+			state->file = copy_fh(rqstp, args.file);
+			state->handle = handle;
+			kfsreq_t *req = kfstransport_defer(rqstp, write_resume, state);
+			filesystem->write_async(copy_string(rqstp, path), kfshandle_value(handle),
+									buffer, args.offset, wsize, req, filesystem->context);
+			return NULL;
+		} else {
+			ssize_t count = filesystem->write(path, kfshandle_value(handle), args.data.data_val, args.offset, wsize,
+											  &error, filesystem->context);
+			write_complete(result, count, FILE_SYNC, error);
 		}
+		kfshandle_release(handle);
 	} else { // no filesystem
-		result.status = NFS3ERR_BADHANDLE;
+		result->status = NFS3ERR_BADHANDLE;
 	}
 	
-	post_op_attr *post_op = (result.status == NFS3_OK) ?
-		&result.WRITE3res_u.resok.file_wcc.after :
-		&result.WRITE3res_u.resfail.file_wcc.after;
-	get_post_op(post_op, args.file);
+	post_op_attr *post_op = (result->status == NFS3_OK) ?
+		&result->WRITE3res_u.resok.file_wcc.after :
+		&result->WRITE3res_u.resfail.file_wcc.after;
+	get_changed_post_op(post_op, args.file);
 	dlog_end();
-	return(&result);
+	return(result);
 }
 
 CREATE3res *
 nfsproc3_create_3_svc(CREATE3args args,  struct svc_req *rqstp) {
 	dlog_begin("\t%s (handle) %s", args.where.dir.data.data_val, args.where.name);
-	static CREATE3res result;
+	CREATE3res *result = kfstransport_alloc(rqstp, sizeof(CREATE3res));
 	uint64_t identifier = 0;
 	int error = 0;
 	const char *path = NULL;
 	const kfsfilesystem_t *filesystem = get_filesystem(args.where.dir, &path, &identifier);
 
-	pre_op_attr *pre_op = (result.status == NFS3_OK) ?
-		&result.CREATE3res_u.resok.dir_wcc.before :
-		&result.CREATE3res_u.resfail.dir_wcc.before;
+	pre_op_attr *pre_op = (result->status == NFS3_OK) ?
+		&result->CREATE3res_u.resok.dir_wcc.before :
+		&result->CREATE3res_u.resfail.dir_wcc.before;
 	get_pre_op(pre_op, args.where.dir);
 	
 	if (filesystem) {
 		dlog("\t%s (path)", path);
 
-		static char filehandle[PATH_MAX];
-		static char fspath[PATH_MAX];
+		char *filehandle = kfstransport_alloc(rqstp, PATH_MAX);
+		char fspath[PATH_MAX];
 		bool root = (strcmp(path, "/") == 0);
 		snprintf(fspath, PATH_MAX, root ? "%s%s" : "%s/%s", path, args.where.name);
 		snprintf(filehandle, PATH_MAX, "%llu:%llu", identifier, kfs_fileid(identifier, fspath));
 		nfs_fh3 fh = { .data = { .data_val = filehandle, .data_len = strlen(filehandle) + 1, } };
 		
 		// assume we're okay to start
-		result.status = NFS3_OK;
+		result->status = NFS3_OK;
 		
 		// mode check
 		if (args.how.mode == UNCHECKED) { } // no checks needed
 		else if (args.how.mode == GUARDED) {
 			fattr3 attrs;
 			if (get_fattr(fh, &attrs) != NFS3_OK) {
-				result.status = NFS3ERR_EXIST;
+				result->status = NFS3ERR_EXIST;
 			}
 		}
 		else if (args.how.mode == EXCLUSIVE) {
-			result.status = NFS3ERR_NOTSUPP;
+			result->status = NFS3ERR_NOTSUPP;
 		}
 
 		// after mode check
-		if (result.status == NFS3_OK) {
+		if (result->status == NFS3_OK) {
 			if (filesystem->create(fspath, &error, filesystem->context)) {
-				result.status = NFS3_OK;
-				result.CREATE3res_u.resok.obj.handle_follows = true;
-				result.CREATE3res_u.resok.obj.post_op_fh3_u.handle = fh;
+				invalidate_name(args.where.dir, args.where.name);
+				result->status = NFS3_OK;
+				result->CREATE3res_u.resok.obj.handle_follows = true;
+				result->CREATE3res_u.resok.obj.post_op_fh3_u.handle = fh;
 				
 				// set attributes now
 				nfsstat3 setstatus = set_fattr(fh, &args.how.createhow3_u.obj_attributes);
@@ -613,10 +1035,10 @@ nfsproc3_create_3_svc(CREATE3args args,  struct svc_req *rqstp) {
 					case NFS3ERR_BADHANDLE:
 					case NFS3ERR_NOTSUPP:
 					case NFS3ERR_SERVERFAULT:
-						result.status = setstatus;
+						result->status = setstatus;
 						break;
 					default:
-						result.status = NFS3ERR_SERVERFAULT;
+						result->status = NFS3ERR_SERVERFAULT;
 						break;
 				}
 				
@@ -626,11 +1048,11 @@ nfsproc3_create_3_svc(CREATE3args args,  struct svc_req *rqstp) {
 					filesystem->remove(fspath, &(int){0}, filesystem->context);
 				}
 				
-				get_required_post_op(&result.CREATE3res_u.resok.obj_attributes, fh);
+				get_required_post_op(&result->CREATE3res_u.resok.obj_attributes, fh);
 				
 			} else { // create failed
-				result.status = convert_status(error, NFS3ERR_IO);
-				switch (result.status) {
+				result->status = convert_status(error, NFS3ERR_IO);
+				switch (result->status) {
 					case NFS3_OK:
 					case NFS3ERR_IO:
 					case NFS3ERR_ACCES:
@@ -646,51 +1068,52 @@ nfsproc3_create_3_svc(CREATE3args args,  struct svc_req *rqstp) {
 					case NFS3ERR_SERVERFAULT:
 						break;
 					default:
-						result.status = NFS3ERR_SERVERFAULT;
+						result->status = NFS3ERR_SERVERFAULT;
 						break;
 				}
 			}
 		}
 	} else { // no filesystem
-		result.status = NFS3ERR_BADHANDLE;
+		result->status = NFS3ERR_BADHANDLE;
 	}
 	
-	post_op_attr *post_op = (result.status == NFS3_OK) ?
-		&result.CREATE3res_u.resok.dir_wcc.after :
-		&result.CREATE3res_u.resfail.dir_wcc.after;
-	get_post_op(post_op, args.where.dir);
+	post_op_attr *post_op = (result->status == NFS3_OK) ?
+		&result->CREATE3res_u.resok.dir_wcc.after :
+		&result->CREATE3res_u.resfail.dir_wcc.after;
+	get_changed_post_op(post_op, args.where.dir);
 	dlog_end();
-	return(&result);
+	return(result);
 }
 
 MKDIR3res *
 nfsproc3_mkdir_3_svc(MKDIR3args args,  struct svc_req *rqstp) {
 	dlog_begin("\t%s (handle) %s", args.where.dir.data.data_val, args.where.name);
-	static MKDIR3res result;
+	MKDIR3res *result = kfstransport_alloc(rqstp, sizeof(MKDIR3res));
 	uint64_t identifier = 0;
 	int error = 0;
 	const char *path = NULL;
 	const kfsfilesystem_t *filesystem = get_filesystem(args.where.dir, &path, &identifier);
 
-	pre_op_attr *pre_op = (result.status == NFS3_OK) ?
-		&result.MKDIR3res_u.resok.dir_wcc.before :
-		&result.MKDIR3res_u.resfail.dir_wcc.before;
+	pre_op_attr *pre_op = (result->status == NFS3_OK) ?
+		&result->MKDIR3res_u.resok.dir_wcc.before :
+		&result->MKDIR3res_u.resfail.dir_wcc.before;
 	get_pre_op(pre_op, args.where.dir);
 	
 	if (filesystem) {
 		dlog("\t%s (path)", path);
 
-		static char filehandle[PATH_MAX];
-		static char fspath[PATH_MAX];
+		char *filehandle = kfstransport_alloc(rqstp, PATH_MAX);
+		char fspath[PATH_MAX];
 		bool root = (strcmp(path, "/") == 0);
 		snprintf(fspath, PATH_MAX, root ? "%s%s" : "%s/%s", path, args.where.name);
 		snprintf(filehandle, PATH_MAX, "%llu:%llu", identifier, kfs_fileid(identifier, fspath));
 		nfs_fh3 fh = { .data = { .data_val = filehandle, .data_len = strlen(filehandle) + 1, } };
 		
 		if (filesystem->mkdir(fspath, &error, filesystem->context)) {
-			result.status = NFS3_OK;
-			result.MKDIR3res_u.resok.obj.handle_follows = true;
-			result.MKDIR3res_u.resok.obj.post_op_fh3_u.handle = fh;
+			invalidate_name(args.where.dir, args.where.name);
+			result->status = NFS3_OK;
+			result->MKDIR3res_u.resok.obj.handle_follows = true;
+			result->MKDIR3res_u.resok.obj.post_op_fh3_u.handle = fh;
 			
 			// set attributes
 			nfsstat3 setstatus = set_fattr(fh, &args.attributes);
@@ -708,10 +1131,10 @@ nfsproc3_mkdir_3_svc(MKDIR3args args,  struct svc_req *rqstp) {
 				case NFS3ERR_BADHANDLE:
 				case NFS3ERR_NOTSUPP:
 				case NFS3ERR_SERVERFAULT:
-					result.status = setstatus;
+					result->status = setstatus;
 					break;
 				default:
-					result.status = NFS3ERR_SERVERFAULT;
+					result->status = NFS3ERR_SERVERFAULT;
 					break;
 			}
 			
@@ -721,11 +1144,11 @@ nfsproc3_mkdir_3_svc(MKDIR3args args,  struct svc_req *rqstp) {
 				filesystem->rmdir(fspath, &(int){0}, filesystem->context);
 			}
 
-			get_required_post_op(&result.MKDIR3res_u.resok.obj_attributes, fh);
+			get_required_post_op(&result->MKDIR3res_u.resok.obj_attributes, fh);
 			
 		} else { // mkdir failed
-			result.status = convert_status(error, NFS3ERR_IO);
-			switch (result.status) {
+			result->status = convert_status(error, NFS3ERR_IO);
+			switch (result->status) {
 				case NFS3_OK:
 				case NFS3ERR_IO:
 				case NFS3ERR_ACCES:
@@ -741,50 +1164,51 @@ nfsproc3_mkdir_3_svc(MKDIR3args args,  struct svc_req *rqstp) {
 				case NFS3ERR_SERVERFAULT:
 					break;
 				default:
-					result.status = NFS3ERR_SERVERFAULT;
+					result->status = NFS3ERR_SERVERFAULT;
 					break;
 			}
 		}
 	} else { // no filesystem
-		result.status = NFS3ERR_BADHANDLE;
+		result->status = NFS3ERR_BADHANDLE;
 	}
 	
-	post_op_attr *post_op = (result.status == NFS3_OK) ?
-		&result.MKDIR3res_u.resok.dir_wcc.after :
-		&result.MKDIR3res_u.resfail.dir_wcc.after;
-	get_post_op(post_op, args.where.dir);
+	post_op_attr *post_op = (result->status == NFS3_OK) ?
+		&result->MKDIR3res_u.resok.dir_wcc.after :
+		&result->MKDIR3res_u.resfail.dir_wcc.after;
+	get_changed_post_op(post_op, args.where.dir);
 	dlog_end();
-	return(&result);
+	return(result);
 }
 
 SYMLINK3res *
 nfsproc3_symlink_3_svc(SYMLINK3args args,  struct svc_req *rqstp) {
 	dlog_begin("\t%s (handle) %s", args.where.dir.data.data_val, args.where.name);
-	static SYMLINK3res result;
+	SYMLINK3res *result = kfstransport_alloc(rqstp, sizeof(SYMLINK3res));
 	uint64_t identifier = 0;
 	int error = 0;
 	const char *path = NULL;
 	const kfsfilesystem_t *filesystem = get_filesystem(args.where.dir, &path, &identifier);
 
-	pre_op_attr *pre_op = (result.status == NFS3_OK) ?
-		&result.SYMLINK3res_u.resok.dir_wcc.before :
-		&result.SYMLINK3res_u.resfail.dir_wcc.before;
+	pre_op_attr *pre_op = (result->status == NFS3_OK) ?
+		&result->SYMLINK3res_u.resok.dir_wcc.before :
+		&result->SYMLINK3res_u.resfail.dir_wcc.before;
 	get_pre_op(pre_op, args.where.dir);
 	
 	if (filesystem) {
 		dlog("\t%s (path)", path);
 
-		static char filehandle[PATH_MAX];
-		static char fspath[PATH_MAX];
+		char *filehandle = kfstransport_alloc(rqstp, PATH_MAX);
+		char fspath[PATH_MAX];
 		bool root = (strcmp(path, "/") == 0);
 		snprintf(fspath, PATH_MAX, root ? "%s%s" : "%s/%s", path, args.where.name);
 		snprintf(filehandle, PATH_MAX, "%llu:%llu", identifier, kfs_fileid(identifier, fspath));
 		nfs_fh3 fh = { .data = { .data_val = filehandle, .data_len = strlen(filehandle) + 1, } };
 		
 		if (filesystem->symlink(fspath, args.symlink.symlink_data, &error, filesystem->context)) {
-			result.status = NFS3_OK;
-			result.SYMLINK3res_u.resok.obj.handle_follows = true;
-			result.SYMLINK3res_u.resok.obj.post_op_fh3_u.handle = fh;
+			invalidate_name(args.where.dir, args.where.name);
+			result->status = NFS3_OK;
+			result->SYMLINK3res_u.resok.obj.handle_follows = true;
+			result->SYMLINK3res_u.resok.obj.post_op_fh3_u.handle = fh;
 			
 			// set attributes
 			nfsstat3 setstatus = set_fattr(fh, &args.symlink.symlink_attributes);
@@ -802,18 +1226,18 @@ nfsproc3_symlink_3_svc(SYMLINK3args args,  struct svc_req *rqstp) {
 				case NFS3ERR_BADHANDLE:
 				case NFS3ERR_NOTSUPP:
 				case NFS3ERR_SERVERFAULT:
-					result.status = setstatus;
+					result->status = setstatus;
 					break;
 				default:
-					result.status = NFS3ERR_SERVERFAULT;
+					result->status = NFS3ERR_SERVERFAULT;
 					break;
 			}
 			
-			get_required_post_op(&result.SYMLINK3res_u.resok.obj_attributes, fh);
+			get_required_post_op(&result->SYMLINK3res_u.resok.obj_attributes, fh);
 			
 		} else { // symlink failed
-			result.status = convert_status(error, NFS3ERR_IO);
-			switch (result.status) {
+			result->status = convert_status(error, NFS3ERR_IO);
+			switch (result->status) {
 				case NFS3_OK:
 				case NFS3ERR_IO:
 				case NFS3ERR_ACCES:
@@ -829,56 +1253,65 @@ nfsproc3_symlink_3_svc(SYMLINK3args args,  struct svc_req *rqstp) {
 				case NFS3ERR_SERVERFAULT:
 					break;
 				default:
-					result.status = NFS3ERR_SERVERFAULT;
+					result->status = NFS3ERR_SERVERFAULT;
 					break;
 			}
 		}
 	} else { // no filesystem
-		result.status = NFS3ERR_BADHANDLE;
+		result->status = NFS3ERR_BADHANDLE;
 	}
 	
-	post_op_attr *post_op = (result.status == NFS3_OK) ?
-		&result.SYMLINK3res_u.resok.dir_wcc.after :
-		&result.SYMLINK3res_u.resfail.dir_wcc.after;
-	get_post_op(post_op, args.where.dir);
+	post_op_attr *post_op = (result->status == NFS3_OK) ?
+		&result->SYMLINK3res_u.resok.dir_wcc.after :
+		&result->SYMLINK3res_u.resfail.dir_wcc.after;
+	get_changed_post_op(post_op, args.where.dir);
 	dlog_end();
-	return(&result);
+	return(result);
 }
 
 MKNOD3res *
 nfsproc3_mknod_3_svc(MKNOD3args args,  struct svc_req *rqstp) {
 	dlog_begin("");
-	static MKNOD3res result;
-	result.status = NFS3ERR_NOTSUPP;
+	MKNOD3res *result = kfstransport_alloc(rqstp, sizeof(MKNOD3res));
+	result->status = NFS3ERR_NOTSUPP;
 	dlog_end();
-	return(&result);
+	return(result);
 }
 
 REMOVE3res *
 nfsproc3_remove_3_svc(REMOVE3args args,  struct svc_req *rqstp) {
 	dlog_begin("\t%s (handle) %s", args.object.dir.data.data_val, args.object.name);
-	static REMOVE3res result;
+	REMOVE3res *result = kfstransport_alloc(rqstp, sizeof(REMOVE3res));
+	uint64_t identifier = 0;
 	int error = 0;
 	const char *path = NULL;
-	const kfsfilesystem_t *filesystem = get_filesystem(args.object.dir, &path, NULL);
+	const kfsfilesystem_t *filesystem = get_filesystem(args.object.dir, &path, &identifier);
 
-	pre_op_attr *pre_op = (result.status == NFS3_OK) ?
-		&result.REMOVE3res_u.resok.dir_wcc.before :
-		&result.REMOVE3res_u.resfail.dir_wcc.before;
+	pre_op_attr *pre_op = (result->status == NFS3_OK) ?
+		&result->REMOVE3res_u.resok.dir_wcc.before :
+		&result->REMOVE3res_u.resfail.dir_wcc.before;
 	get_pre_op(pre_op, args.object.dir);
 	
 	if (filesystem) {
 		dlog("\t%s (path)", path);
 
-		static char fspath[PATH_MAX];
+		char fspath[PATH_MAX];
 		bool root = (strcmp(path, "/") == 0);
 		snprintf(fspath, PATH_MAX, root ? "%s%s" : "%s/%s", path, args.object.name);
 		
+		// anything buffered for the file has to be written now, or it would be
+		// written after the file is gone (which could create it again). a name
+		// without an id can't have anything buffered, and isn't given one.
+		uint64_t fileid = fileid_frompath(identifier, fspath);
+		if (fileid) { kfswriteback_flush(identifier, fileid, &(int){0}); }
 		if (filesystem->remove(fspath, &error, filesystem->context)) {
-			result.status = NFS3_OK;
+			kfshandle_forget(identifier, fspath);
+			if (fileid) { invalidate_fileid(identifier, fileid); }
+			invalidate_name(args.object.dir, args.object.name);
+			result->status = NFS3_OK;
 		} else { // remove failed
-			result.status = convert_status(error, NFS3ERR_IO);
-			switch (result.status) {
+			result->status = convert_status(error, NFS3ERR_IO);
+			switch (result->status) {
 				case NFS3_OK:
 				case NFS3ERR_NOENT:
 				case NFS3ERR_IO:
@@ -892,47 +1325,51 @@ nfsproc3_remove_3_svc(REMOVE3args args,  struct svc_req *rqstp) {
 				case NFS3ERR_SERVERFAULT:
 					break;
 				default:
-					result.status = NFS3ERR_SERVERFAULT;
+					result->status = NFS3ERR_SERVERFAULT;
 					break;
 			}
 		}
 	} else { // no filesystem
-		result.status = NFS3ERR_BADHANDLE;
+		result->status = NFS3ERR_BADHANDLE;
 	}
 	
-	post_op_attr *post_op = (result.status == NFS3_OK) ?
-		&result.REMOVE3res_u.resok.dir_wcc.after :
-		&result.REMOVE3res_u.resfail.dir_wcc.after;
-	get_post_op(post_op, args.object.dir);
+	post_op_attr *post_op = (result->status == NFS3_OK) ?
+		&result->REMOVE3res_u.resok.dir_wcc.after :
+		&result->REMOVE3res_u.resfail.dir_wcc.after;
+	get_changed_post_op(post_op, args.object.dir);
 	dlog_end();
-	return(&result);
+	return(result);
 }
 
 RMDIR3res *
 nfsproc3_rmdir_3_svc(RMDIR3args args,  struct svc_req *rqstp) {
 	dlog_begin("\t%s (handle) %s", args.object.dir.data.data_val, args.object.name);
-	static RMDIR3res result;
+	RMDIR3res *result = kfstransport_alloc(rqstp, sizeof(RMDIR3res));
+	uint64_t identifier = 0;
 	int error = 0;
 	const char *path = NULL;
-	const kfsfilesystem_t *filesystem = get_filesystem(args.object.dir, &path, NULL);
+	const kfsfilesystem_t *filesystem = get_filesystem(args.object.dir, &path, &identifier);
 
-	pre_op_attr *pre_op = (result.status == NFS3_OK) ?
-		&result.RMDIR3res_u.resok.dir_wcc.before :
-		&result.RMDIR3res_u.resfail.dir_wcc.before;
+	pre_op_attr *pre_op = (result->status == NFS3_OK) ?
+		&result->RMDIR3res_u.resok.dir_wcc.before :
+		&result->RMDIR3res_u.resfail.dir_wcc.before;
 	get_pre_op(pre_op, args.object.dir);
 	
 	if (filesystem) {
 		dlog("\t%s (path)", path);
 
-		static char fspath[PATH_MAX];
+		char fspath[PATH_MAX];
 		bool root = (strcmp(path, "/") == 0);
 		snprintf(fspath, PATH_MAX, root ? "%s%s" : "%s/%s", path, args.object.name);
 		
 		if (filesystem->rmdir(fspath, &error, filesystem->context)) {
-			result.status = NFS3_OK;
+			uint64_t fileid = fileid_frompath(identifier, fspath);
+			if (fileid) { invalidate_fileid(identifier, fileid); }
+			invalidate_name(args.object.dir, args.object.name);
+			result->status = NFS3_OK;
 		} else { // rmdir failed
-			result.status = convert_status(error, NFS3ERR_IO);
-			switch (result.status) {
+			result->status = convert_status(error, NFS3ERR_IO);
+			switch (result->status) {
 				case NFS3_OK:
 				case NFS3ERR_NOENT:
 				case NFS3ERR_IO:
@@ -949,26 +1386,26 @@ nfsproc3_rmdir_3_svc(RMDIR3args args,  struct svc_req *rqstp) {
 				case NFS3ERR_SERVERFAULT:
 					break;
 				default:
-					result.status = NFS3ERR_SERVERFAULT;
+					result->status = NFS3ERR_SERVERFAULT;
 					break;
 			}
 		}
 	} else { // no filesystem
-		result.status = NFS3ERR_BADHANDLE;
+		result->status = NFS3ERR_BADHANDLE;
 	}
 	
-	post_op_attr *post_op = (result.status == NFS3_OK) ?
-		&result.RMDIR3res_u.resok.dir_wcc.after :
-		&result.RMDIR3res_u.resfail.dir_wcc.after;
-	get_post_op(post_op, args.object.dir);
+	post_op_attr *post_op = (result->status == NFS3_OK) ?
+		&result->RMDIR3res_u.resok.dir_wcc.after :
+		&result->RMDIR3res_u.resfail.dir_wcc.after;
+	get_changed_post_op(post_op, args.object.dir);
 	dlog_end();
-	return(&result);
+	return(result);
 }
 
 RENAME3res *
 nfsproc3_rename_3_svc(RENAME3args args,  struct svc_req *rqstp) {
 	dlog_begin("\t%s (handle) %s", args.from.dir.data.data_val, args.to.dir.data.data_val);
-	static RENAME3res result;
+	RENAME3res *result = kfstransport_alloc(rqstp, sizeof(RENAME3res));
 	uint64_t from_identifier = 0;
 	uint64_t to_identifier = 0;
 	int error = 0;
@@ -977,12 +1414,12 @@ nfsproc3_rename_3_svc(RENAME3args args,  struct svc_req *rqstp) {
 	const kfsfilesystem_t *from_filesystem = get_filesystem(args.from.dir, &from_path, &from_identifier);
 	const kfsfilesystem_t *to_filesystem = get_filesystem(args.to.dir, &to_path, &to_identifier);
 
-	pre_op_attr *from_pre_op = (result.status == NFS3_OK) ?
-		&result.RENAME3res_u.resok.fromdir_wcc.before :
-		&result.RENAME3res_u.resfail.fromdir_wcc.before;
-	pre_op_attr *to_pre_op = (result.status == NFS3_OK) ?
-		&result.RENAME3res_u.resok.todir_wcc.before :
-		&result.RENAME3res_u.resfail.todir_wcc.before;
+	pre_op_attr *from_pre_op = (result->status == NFS3_OK) ?
+		&result->RENAME3res_u.resok.fromdir_wcc.before :
+		&result->RENAME3res_u.resfail.fromdir_wcc.before;
+	pre_op_attr *to_pre_op = (result->status == NFS3_OK) ?
+		&result->RENAME3res_u.resok.todir_wcc.before :
+		&result->RENAME3res_u.resfail.todir_wcc.before;
 	get_pre_op(from_pre_op, args.from.dir);
 	get_pre_op(to_pre_op, args.to.dir);
 	
@@ -991,15 +1428,31 @@ nfsproc3_rename_3_svc(RENAME3args args,  struct svc_req *rqstp) {
 		(from_identifier == to_identifier)) {
 		dlog("\t%s (path) %s (path)", from_path, to_path);
 
-		static char from_fspath[PATH_MAX];
+		char from_fspath[PATH_MAX];
 		bool from_root = (strcmp(from_path, "/") == 0);
 		snprintf(from_fspath, PATH_MAX, from_root ? "%s%s" : "%s/%s", from_path, args.from.name);
 
-		static char to_fspath[PATH_MAX];
+		char to_fspath[PATH_MAX];
 		bool to_root = (strcmp(to_path, "/") == 0);
 		snprintf(to_fspath, PATH_MAX, to_root ? "%s%s" : "%s/%s", to_path, args.to.name);
 		
+		// buffered data is written to the path it was meant for before it changes.
+		// a name without an id can't have anything buffered.
+		uint64_t from_fileid = fileid_frompath(from_identifier, from_fspath);
+		uint64_t to_fileid = fileid_frompath(to_identifier, to_fspath);
+		if (from_fileid) { kfswriteback_flush(from_identifier, from_fileid, &(int){0}); }
+		if (to_fileid) { kfswriteback_flush(to_identifier, to_fileid, &(int){0}); }
 		if (from_filesystem->rename(from_fspath, to_fspath, &error, from_filesystem->context)) {
+			// handles opened for either path no longer refer to the file there
+			kfshandle_forget(from_identifier, from_fspath);
+			kfshandle_forget(to_identifier, to_fspath);
+			invalidate_fileid(from_identifier, kfs_fileid(from_identifier, from_fspath));
+			invalidate_fileid(to_identifier, kfs_fileid(to_identifier, to_fspath));
+
+			// a directory that's moved takes every name beneath it along, and those
+			// can't be found by directory, so forget all names in the filesystem.
+			kfsnamecache_clear(from_identifier);
+
 			// swap ids so our file handle isn't stale
 			// the destination has been removed, so swapping (rather than overwriting
 			// and generating a new id for the destination path) should be just fine. the
@@ -1007,10 +1460,10 @@ nfsproc3_rename_3_svc(RENAME3args args,  struct svc_req *rqstp) {
 			kfs_idswap(from_identifier,
 					   kfs_fileid(from_identifier, from_fspath),
 					   kfs_fileid(to_identifier, to_fspath));
-			result.status = NFS3_OK;
+			result->status = NFS3_OK;
 		} else { // rename failed
-			result.status = convert_status(error, NFS3ERR_IO);
-			switch (result.status) {
+			result->status = convert_status(error, NFS3ERR_IO);
+			switch (result->status) {
 				case NFS3_OK:
 				case NFS3ERR_NOENT:
 				case NFS3ERR_IO:
@@ -1032,144 +1485,249 @@ nfsproc3_rename_3_svc(RENAME3args args,  struct svc_req *rqstp) {
 				case NFS3ERR_SERVERFAULT:
 					break;
 				default:
-					result.status = NFS3ERR_SERVERFAULT;
+					result->status = NFS3ERR_SERVERFAULT;
 					break;
 			}
 		}
 	} else { // no filesystem
-		result.status = NFS3ERR_BADHANDLE;
+		result->status = NFS3ERR_BADHANDLE;
 	}
 	
-	post_op_attr *from_post_op = (result.status == NFS3_OK) ?
-		&result.RENAME3res_u.resok.fromdir_wcc.after :
-		&result.RENAME3res_u.resfail.fromdir_wcc.after;
-	post_op_attr *to_post_op = (result.status == NFS3_OK) ?
-		&result.RENAME3res_u.resok.todir_wcc.after :
-		&result.RENAME3res_u.resfail.todir_wcc.after;
-	get_post_op(from_post_op, args.from.dir);
-	get_post_op(to_post_op, args.to.dir);
+	post_op_attr *from_post_op = (result->status == NFS3_OK) ?
+		&result->RENAME3res_u.resok.fromdir_wcc.after :
+		&result->RENAME3res_u.resfail.fromdir_wcc.after;
+	post_op_attr *to_post_op = (result->status == NFS3_OK) ?
+		&result->RENAME3res_u.resok.todir_wcc.after :
+		&result->RENAME3res_u.resfail.todir_wcc.after;
+	get_changed_post_op(from_post_op, args.from.dir);
+	get_changed_post_op(to_post_op, args.to.dir);
 	dlog_end();
-	return(&result);
+	return(result);
 }
 
 LINK3res *
 nfsproc3_link_3_svc(LINK3args args,  struct svc_req *rqstp) {
 	dlog_begin("");
-	static LINK3res result;
-	result.status = NFS3ERR_NOTSUPP;
+	LINK3res *result = kfstransport_alloc(rqstp, sizeof(LINK3res));
+	result->status = NFS3ERR_NOTSUPP;
 	dlog_end();
-	return(&result);
+	return(result);
 }
 
 READDIR3res *
 nfsproc3_readdir_3_svc(READDIR3args args,  struct svc_req *rqstp) {
 	dlog_begin("\t%s (handle) %i %s", args.dir.data.data_val, (int)args.cookie, args.cookieverf);
 
-	typedef char pathname[NAME_MAX];
-	static uint32 timemask = (~(~0LL << (NFS3_COOKIEVERFSIZE << 2)));
-	static pathname names[DIR_MAX_LEN];
-	static entry3 entries[DIR_MAX_LEN];
-	static READDIR3res result;
+	READDIR3res *result = kfstransport_alloc(rqstp, sizeof(READDIR3res));
 	
-	// doing this first to use the attributes to verify cookie
+	// cookies are made from the names of entries, so they stay good while the
+	// directory changes and the cookie verifier is left empty. the modification
+	// time tells whether a kept listing is still current.
 	fattr3 dirattr = {};
 	get_fattr(args.dir, &dirattr);
 
-	bool newrequest = (args.cookie == 0) && (args.cookieverf == NULL || (strlen(args.cookieverf) == 0));
-	bool cookie_valid = true;
-	snprintf(result.READDIR3res_u.resok.cookieverf, NFS3_COOKIEVERFSIZE, "%x",
-		dirattr.mtime.seconds & timemask);
-	
-	if ((newrequest == false) && (strcmp(args.cookieverf, result.READDIR3res_u.resok.cookieverf) != 0)) {
-		cookie_valid = false;
-	}
-	
-	if (cookie_valid) {
-		uint64_t identifier = 0;
-		int error = 0;
-		const char *path = NULL;
-		const kfsfilesystem_t *filesystem = get_filesystem(args.dir, &path, &identifier);
-		if (filesystem) {
-			dlog("\t%s (path)", path);
-			kfscontents_t *contents = kfscontents_create();
-			if (filesystem->readdir(path, contents, &error, filesystem->context)) {
-				uint64_t cnt_i = 0;
-				uint64_t ent_i = 0;
-				uint64_t cnt_count = kfscontents_count(contents);
-				uint64_t ent_count = (args.count > DIR_MAX_LEN) ? DIR_MAX_LEN : args.count;
-				// start searching through contents at args.cookie (the requested index), and
-				// iterate through until we've filled the entries or we've reached the end of the
-				// directory listing.
-				for (cnt_i = args.cookie; cnt_i < cnt_count && ent_i < ent_count; cnt_i++, ent_i++) {
-					const char *entry = kfscontents_at(contents, cnt_i);
-					strncpy(names[ent_i], entry, sizeof(pathname));
-					
-					uint64_t fileid = 0;
-					char *fullpath = NULL;
-					bool root = (strcmp(path, "/") == 0);
-					asprintf(&fullpath, root ? "%s%s" : "%s/%s", path, entry);
-					fileid = kfs_fileid(identifier, fullpath);
-					free(fullpath);
-					
-					entries[ent_i].fileid = fileid;
-					entries[ent_i].name = names[ent_i];
-					entries[ent_i].cookie = cnt_i;
-					entries[ent_i].nextentry = NULL;
-					if (ent_i > 0) {
-						entries[ent_i-1].nextentry = &entries[ent_i]; // set up linked list
-					}
-				}
-				result.status = NFS3_OK;
-				result.READDIR3res_u.resok.reply.entries = entries;
-				result.READDIR3res_u.resok.reply.eof = (cnt_i == cnt_count);
-			} else { // lsdir failed
-				result.status = convert_status(error, NFS3ERR_NOTDIR);
-				switch (result.status) {
-					case NFS3_OK:
-					case NFS3ERR_IO:
-					case NFS3ERR_ACCES:
-					case NFS3ERR_NOTDIR:
-					case NFS3ERR_BAD_COOKIE:
-					case NFS3ERR_TOOSMALL:
-					case NFS3ERR_STALE:
-					case NFS3ERR_BADHANDLE:
-					case NFS3ERR_NOTSUPP:
-					case NFS3ERR_SERVERFAULT:
-						break;
-					default:
-						result.status = NFS3ERR_SERVERFAULT;
-						break;
+	uint64_t identifier = 0;
+	uint64_t fileid = 0;
+	int error = 0;
+	const char *path = NULL;
+	const kfsfilesystem_t *filesystem = get_filesystem(args.dir, &path, &identifier);
+	get_identifiers(args.dir, &(uint64_t){0}, &fileid);
+	if (filesystem) {
+		dlog("\t%s (path)", path);
+		// the listing is kept between pages, so a large directory is listed once
+		// rather than once for each page the client reads.
+		uint64_t ent_count = (args.count > DIR_MAX_LEN) ? DIR_MAX_LEN : args.count;
+		kfsdirsnapshot_t *snapshot = kfsdircache_get(identifier, fileid, &dirattr.mtime, false,
+			args.cookie, ent_count, filesystem, path, &error);
+		uint64_t start = 0;
+		if (snapshot && !kfsdircache_find(snapshot, args.cookie, &start)) {
+			result->status = NFS3ERR_BAD_COOKIE;
+			kfsdircache_release(snapshot, start);
+		} else if (snapshot) {
+			uint64_t cnt_i = 0;
+			uint64_t ent_i = 0;
+			uint64_t cnt_count = kfsdircache_count(snapshot);
+			if (start >= cnt_count) { ent_count = 0; }
+			else if (ent_count > cnt_count - start) { ent_count = cnt_count - start; }
+			entry3 *entries = ent_count ? kfstransport_alloc(rqstp, sizeof(entry3) * ent_count) : NULL;
+			// start at the entry after the one with the cookie, and iterate through until
+			// we've filled the entries or we've reached the end of the directory listing.
+			for (cnt_i = start; cnt_i < cnt_count && ent_i < ent_count; cnt_i++, ent_i++) {
+				entries[ent_i].fileid = kfsdircache_fileid(snapshot, cnt_i);
+				entries[ent_i].name = copy_string(rqstp, kfsdircache_name(snapshot, cnt_i));
+				entries[ent_i].cookie = kfsdircache_cookie(snapshot, cnt_i);
+				entries[ent_i].nextentry = NULL;
+				if (ent_i > 0) {
+					entries[ent_i-1].nextentry = &entries[ent_i]; // set up linked list
 				}
 			}
-			kfscontents_destroy(contents);
-		} else { // no filesystem
-			result.status = NFS3ERR_BADHANDLE;
+			result->status = NFS3_OK;
+			result->READDIR3res_u.resok.reply.entries = entries;
+			result->READDIR3res_u.resok.reply.eof = (cnt_i == cnt_count) && kfsdircache_eof(snapshot);
+			kfsdircache_release(snapshot, cnt_i);
+		} else { // lsdir failed
+			result->status = convert_status(error, NFS3ERR_NOTDIR);
+			switch (result->status) {
+				case NFS3_OK:
+				case NFS3ERR_IO:
+				case NFS3ERR_ACCES:
+				case NFS3ERR_NOTDIR:
+				case NFS3ERR_BAD_COOKIE:
+				case NFS3ERR_TOOSMALL:
+				case NFS3ERR_STALE:
+				case NFS3ERR_BADHANDLE:
+				case NFS3ERR_NOTSUPP:
+				case NFS3ERR_SERVERFAULT:
+					break;
+				default:
+					result->status = NFS3ERR_SERVERFAULT;
+					break;
+			}
 		}
-	} else { // cookie invalid
-		result.status = NFS3ERR_BAD_COOKIE;
+	} else { // no filesystem
+		result->status = NFS3ERR_BADHANDLE;
 	}
 
-	post_op_attr *post_op = (result.status == NFS3_OK) ?
-		&result.READDIR3res_u.resok.dir_attributes :
-		&result.READDIR3res_u.resfail.dir_attributes;
+	post_op_attr *post_op = (result->status == NFS3_OK) ?
+		&result->READDIR3res_u.resok.dir_attributes :
+		&result->READDIR3res_u.resfail.dir_attributes;
 	get_post_op(post_op, args.dir);
 	dlog_end();
-	return(&result);
+	return(result);
 }
 
+// encoded sizes used to keep a readdirplus reply within what the client asked for
+#define FATTR3_XDR_LEN				84
+#define READDIRPLUS3_HEADER_LEN		(4 + (4 + FATTR3_XDR_LEN) + NFS3_COOKIEVERFSIZE + 4 + 4)
+#define ENTRYPLUS3_DIR_LEN(name)	(4 + 8 + 4 + RNDUP(name) + 8)
+#define ENTRYPLUS3_LEN(name, fh)	(ENTRYPLUS3_DIR_LEN(name) + (4 + FATTR3_XDR_LEN) + (4 + 4 + RNDUP(fh)))
+
 READDIRPLUS3res *
 nfsproc3_readdirplus_3_svc(READDIRPLUS3args args,  struct svc_req *rqstp) {
-	dlog_begin("");
-	static READDIRPLUS3res result;
-	result.status = NFS3ERR_NOTSUPP;
+	dlog_begin("\t%s (handle) %i %s", args.dir.data.data_val, (int)args.cookie, args.cookieverf);
+
+	READDIRPLUS3res *result = kfstransport_alloc(rqstp, sizeof(READDIRPLUS3res));
+
+	// cookies and the cookie verifier work just as they do for readdir.
+	fattr3 dirattr = {};
+	get_fattr(args.dir, &dirattr);
+
+	uint64_t identifier = 0;
+	uint64_t fileid = 0;
+	int error = 0;
+	const char *path = NULL;
+	const kfsfilesystem_t *filesystem = get_filesystem(args.dir, &path, &identifier);
+	get_identifiers(args.dir, &(uint64_t){0}, &fileid);
+	if (filesystem) {
+		dlog("\t%s (path)", path);
+
+		// without readdirplus, stat each entry here. that's still far cheaper
+		// than the client looking up and getting the attributes of each one.
+		uint64_t wanted = args.dircount / ENTRYPLUS3_DIR_LEN(1) + 1;
+		if (wanted > DIR_MAX_LEN) { wanted = DIR_MAX_LEN; }
+		kfsdirsnapshot_t *snapshot = kfsdircache_get(identifier, fileid, &dirattr.mtime, true,
+			args.cookie, wanted, filesystem, path, &error);
+		uint64_t index = 0;
+		if (snapshot && !kfsdircache_find(snapshot, args.cookie, &index)) {
+			result->status = NFS3ERR_BAD_COOKIE;
+			kfsdircache_release(snapshot, index);
+		} else if (snapshot) {
+			uint64_t count = kfsdircache_count(snapshot);
+			size_t size = READDIRPLUS3_HEADER_LEN;
+			size_t dirsize = 0;
+			bool root = (strcmp(path, "/") == 0);
+			entryplus3 *last = NULL;
+
+			for (; index < count; index++) {
+				const char *entry = kfsdircache_name(snapshot, index);
+				uint64_t entryid = kfsdircache_fileid(snapshot, index);
+
+				char filehandle[PATH_MAX];
+				snprintf(filehandle, PATH_MAX, "%llu:%llu", identifier, entryid);
+				size_t namelen = strlen(entry);
+				size_t fhlen = strlen(filehandle) + 1;
+				size += ENTRYPLUS3_LEN(namelen, fhlen);
+				dirsize += ENTRYPLUS3_DIR_LEN(namelen);
+				if (size > args.maxcount || dirsize > args.dircount) { break; }
+
+				entryplus3 *current = kfstransport_alloc(rqstp, sizeof(entryplus3));
+				current->fileid = entryid;
+				current->name = copy_string(rqstp, entry);
+				current->cookie = kfsdircache_cookie(snapshot, index);
+
+				// attributes come from the cache, then from the listing while it's new,
+				// and only then from the filesystem.
+				fattr3 *attributes = &current->name_attributes.post_op_attr_u.attributes;
+				if (kfsattrcache_get(identifier, entryid, attributes)) {
+					current->name_attributes.attributes_follow = true;
+				} else {
+					kfsstat_t sbuf = {};
+					uint64_t version = kfsattrcache_version(identifier, entryid);
+					const kfsstat_t *stat = kfsdircache_stat(snapshot, index);
+					if (stat == NULL) {
+						char fspath[PATH_MAX];
+						snprintf(fspath, PATH_MAX, root ? "%s%s" : "%s/%s", path, entry);
+						if (filesystem->stat(fspath, &sbuf, &(int){0}, filesystem->context)) { stat = &sbuf; }
+					}
+					if (stat) {
+						current->name_attributes.attributes_follow = true;
+						fattr_from_stat(stat, entryid, attributes);
+						kfswriteback_size(identifier, entryid, &attributes->size);
+						kfsattrcache_set(identifier, filesystem, entryid, attributes, version);
+					}
+				}
+
+				current->name_handle.handle_follows = true;
+				current->name_handle.post_op_fh3_u.handle.data.data_val = copy_string(rqstp, filehandle);
+				current->name_handle.post_op_fh3_u.handle.data.data_len = fhlen;
+
+				if (last) { last->nextentry = current; }
+				else { result->READDIRPLUS3res_u.resok.reply.entries = current; }
+				last = current;
+			}
+
+			if (last == NULL && index < count) { // not even one entry fits
+				result->status = NFS3ERR_TOOSMALL;
+			} else {
+				result->status = NFS3_OK;
+				result->READDIRPLUS3res_u.resok.reply.eof = (index >= count) && kfsdircache_eof(snapshot);
+			}
+			kfsdircache_release(snapshot, index);
+		} else { // listing failed
+			result->status = convert_status(error, NFS3ERR_NOTDIR);
+			switch (result->status) {
+				case NFS3_OK:
+				case NFS3ERR_IO:
+				case NFS3ERR_ACCES:
+				case NFS3ERR_NOTDIR:
+				case NFS3ERR_BAD_COOKIE:
+				case NFS3ERR_TOOSMALL:
+				case NFS3ERR_STALE:
+				case NFS3ERR_BADHANDLE:
+				case NFS3ERR_NOTSUPP:
+				case NFS3ERR_SERVERFAULT:
+					break;
+				default:
+					result->status = NFS3ERR_SERVERFAULT;
+					break;
+			}
+		}
+	} else { // no filesystem
+		result->status = NFS3ERR_BADHANDLE;
+	}
+
+	post_op_attr *post_op = (result->status == NFS3_OK) ?
+		&result->READDIRPLUS3res_u.resok.dir_attributes :
+		&result->READDIRPLUS3res_u.resfail.dir_attributes;
+	get_post_op(post_op, args.dir);
 	dlog_end();
-	return(&result);
+	return(result);
 }
 
 FSSTAT3res *
 nfsproc3_fsstat_3_svc(FSSTAT3args args,  struct svc_req *rqstp) {
 	dlog_begin("\t%s (handle)", args.fsroot.data.data_val);
-	static FSSTAT3res result;
+	FSSTAT3res *result = kfstransport_alloc(rqstp, sizeof(FSSTAT3res));
 	int error = 0;
 	const char *path = NULL;
 	const kfsfilesystem_t *filesystem = get_filesystem(args.fsroot, &path, NULL);
@@ -1177,17 +1735,17 @@ nfsproc3_fsstat_3_svc(FSSTAT3args args,  struct svc_req *rqstp) {
 		dlog("\t%s (path)", path);
 		kfsstatfs_t sbuf = {};
 		if (filesystem->statfs(path, &sbuf, &error, filesystem->context)) {
-			result.status = NFS3_OK;
-			result.FSSTAT3res_u.resok.tbytes = sbuf.size;
-			result.FSSTAT3res_u.resok.fbytes = sbuf.free;
-			result.FSSTAT3res_u.resok.abytes = sbuf.free;
-			result.FSSTAT3res_u.resok.tfiles = 0;
-			result.FSSTAT3res_u.resok.ffiles = 0;
-			result.FSSTAT3res_u.resok.afiles = 0;
-			result.FSSTAT3res_u.resok.invarsec = 0;
+			result->status = NFS3_OK;
+			result->FSSTAT3res_u.resok.tbytes = sbuf.size;
+			result->FSSTAT3res_u.resok.fbytes = sbuf.free;
+			result->FSSTAT3res_u.resok.abytes = sbuf.free;
+			result->FSSTAT3res_u.resok.tfiles = 0;
+			result->FSSTAT3res_u.resok.ffiles = 0;
+			result->FSSTAT3res_u.resok.afiles = 0;
+			result->FSSTAT3res_u.resok.invarsec = 0;
 		} else { // statfs failed
-			result.status = convert_status(error, NFS3ERR_IO);
-			switch (result.status) {
+			result->status = convert_status(error, NFS3ERR_IO);
+			switch (result->status) {
 				case NFS3_OK:
 				case NFS3ERR_IO:
 				case NFS3ERR_STALE:
@@ -1195,69 +1753,110 @@ nfsproc3_fsstat_3_svc(FSSTAT3args args,  struct svc_req *rqstp) {
 				case NFS3ERR_SERVERFAULT:
 					break;
 				default:
-					result.status = NFS3ERR_SERVERFAULT;
+					result->status = NFS3ERR_SERVERFAULT;
 					break;
 			}
 		}
 	} else { // no filesystem
-		result.status = NFS3ERR_BADHANDLE;
+		result->status = NFS3ERR_BADHANDLE;
 	}
 	
-	post_op_attr *post_op = (result.status == NFS3_OK) ?
-		&result.FSSTAT3res_u.resok.obj_attributes :
-		&result.FSSTAT3res_u.resfail.obj_attributes;
+	post_op_attr *post_op = (result->status == NFS3_OK) ?
+		&result->FSSTAT3res_u.resok.obj_attributes :
+		&result->FSSTAT3res_u.resfail.obj_attributes;
 	get_post_op(post_op, args.fsroot);
 	dlog_end();
-	return(&result);
+	return(result);
 }
 
 
 FSINFO3res *
 nfsproc3_fsinfo_3_svc(FSINFO3args args,  struct svc_req *rqstp) {
 	dlog_begin("\t%s (handle)", args.fsroot.data.data_val);
-	static FSINFO3res result;
-	result.status = NFS3_OK;
-	result.FSINFO3res_u.resok.rtmax = READ_MAX_LEN;
-	result.FSINFO3res_u.resok.rtpref = READ_MAX_LEN;
-	result.FSINFO3res_u.resok.rtmult = 1;
-	result.FSINFO3res_u.resok.wtmax = WRITE_MAX_LEN;
-	result.FSINFO3res_u.resok.wtpref = WRITE_MAX_LEN;
-	result.FSINFO3res_u.resok.wtmult = 1;
-	result.FSINFO3res_u.resok.dtpref = DIR_MAX_LEN;
-	result.FSINFO3res_u.resok.maxfilesize = UINT_MAX;
-	result.FSINFO3res_u.resok.time_delta = (nfstime3){ 1, 0 };
-	result.FSINFO3res_u.resok.properties = FSF3_HOMOGENEOUS | FSF3_SYMLINK | FSF3_CANSETTIME; /* FSF3_LINK */
-
-	post_op_attr *post_op = (result.status == NFS3_OK) ?
-		&result.FSINFO3res_u.resok.obj_attributes :
-		&result.FSINFO3res_u.resfail.obj_attributes;
+	FSINFO3res *result = kfstransport_alloc(rqstp, sizeof(FSINFO3res));
+	const kfsfilesystem_t *filesystem = get_filesystem(args.fsroot, NULL, NULL);
+	size_t rsize = filesystem ? kfsfilesystem_rsize(filesystem) : READ_MAX_LEN;
+	size_t wsize = filesystem ? kfsfilesystem_wsize(filesystem) : WRITE_MAX_LEN;
+	result->status = NFS3_OK;
+	result->FSINFO3res_u.resok.rtmax = (uint32)rsize;
+	result->FSINFO3res_u.resok.rtpref = (uint32)rsize;
+	result->FSINFO3res_u.resok.rtmult = 1;
+	result->FSINFO3res_u.resok.wtmax = (uint32)wsize;
+	result->FSINFO3res_u.resok.wtpref = (uint32)wsize;
+	result->FSINFO3res_u.resok.wtmult = 1;
+	result->FSINFO3res_u.resok.dtpref = DIR_MAX_LEN;
+	result->FSINFO3res_u.resok.maxfilesize = UINT_MAX;
+	result->FSINFO3res_u.resok.time_delta = (nfstime3){ 1, 0 };
+	result->FSINFO3res_u.resok.properties = FSF3_HOMOGENEOUS | FSF3_SYMLINK | FSF3_CANSETTIME; /* FSF3_LINK */
+
+	post_op_attr *post_op = (result->status == NFS3_OK) ?
+		&result->FSINFO3res_u.resok.obj_attributes :
+		&result->FSINFO3res_u.resfail.obj_attributes;
 	get_post_op(post_op, args.fsroot);
 	dlog_end();
-	return(&result);
+	return(result);
 }
 
 PATHCONF3res *
 nfsproc3_pathconf_3_svc(PATHCONF3args args,  struct svc_req *rqstp) {
 	dlog_begin("\t%s (handle)", args.object.data.data_val);
-	static PATHCONF3res result;
-	result.status = NFS3_OK;
-	result.PATHCONF3res_u.resok.linkmax = LINK_MAX;
-	result.PATHCONF3res_u.resok.name_max = NAME_MAX;
-	result.PATHCONF3res_u.resok.no_trunc = true;
-	result.PATHCONF3res_u.resok.chown_restricted = false;
-	result.PATHCONF3res_u.resok.case_insensitive = true;
-	result.PATHCONF3res_u.resok.case_preserving = true;
+	PATHCONF3res *result = kfstransport_alloc(rqstp, sizeof(PATHCONF3res));
+	result->status = NFS3_OK;
+	result->PATHCONF3res_u.resok.linkmax = LINK_MAX;
+	result->PATHCONF3res_u.resok.name_max = NAME_MAX;
+	result->PATHCONF3res_u.resok.no_trunc = true;
+	result->PATHCONF3res_u.resok.chown_restricted = false;
+	result->PATHCONF3res_u.resok.case_insensitive = true;
+	result->PATHCONF3res_u.resok.case_preserving = true;
 	dlog_end();
-	return(&result);
+	return(result);
 }
 
 COMMIT3res *
 nfsproc3_commit_3_svc(COMMIT3args args,  struct svc_req *rqstp) {
-	dlog_begin("");
-	static COMMIT3res result;
-	result.status = NFS3ERR_NOTSUPP;
+	dlog_begin("\t%s (handle) %lli %i", args.file.data.data_val, args.offset, args.count);
+	COMMIT3res *result = kfstransport_alloc(rqstp, sizeof(COMMIT3res));
+	uint64_t identifier = 0;
+	int error = 0;
+	const char *path = NULL;
+	const kfsfilesystem_t *filesystem = get_filesystem(args.file, &path, &identifier);
+
+	pre_op_attr *pre_op = (result->status == NFS3_OK) ?
+		&result->COMMIT3res_u.resok.file_wcc.before :
+		&result->COMMIT3res_u.resfail.file_wcc.before;
+	get_pre_op(pre_op, args.file);
+
+	if (filesystem) {
+		dlog("\t%s (path)", path);
+
+		// everything buffered for the file is written, not just the range asked for
+		if (kfswriteback_commit(identifier, kfs_fileid(identifier, path), &error)) {
+			result->status = NFS3_OK;
+			kfswriteback_verifier(result->COMMIT3res_u.resok.verf);
+		} else { // buffered writes failed
+			result->status = convert_status(error, NFS3ERR_IO);
+			switch (result->status) {
+				case NFS3_OK:
+				case NFS3ERR_IO:
+				case NFS3ERR_STALE:
+				case NFS3ERR_BADHANDLE:
+				case NFS3ERR_SERVERFAULT:
+					break;
+				default:
+					result->status = NFS3ERR_SERVERFAULT;
+					break;
+			}
+		}
+	} else { // no filesystem
+		result->status = NFS3ERR_BADHANDLE;
+	}
+
+	post_op_attr *post_op = (result->status == NFS3_OK) ?
+		&result->COMMIT3res_u.resok.file_wcc.after :
+		&result->COMMIT3res_u.resfail.file_wcc.after;
+	get_changed_post_op(post_op, args.file);
 	dlog_end();
-	return(&result);
+	return(result);
 }
 
 void *
@@ -2,8 +2,12 @@
 #define _NFS_PROGRAMS_
 
 #include "nfs3.h"
+#include "kfslib.h"
+#include "transport.h"
 
 void nfs_program_3(struct svc_req *rqstp, SVCXPRT *transp);
+void nfs_route_3(struct svc_req *rqstp, XDR *xdrs, kfsroute_t *route);
+void nfs_busy_3(struct svc_req *rqstp, SVCXPRT *transp);
 void mount_program_3(struct svc_req *rqstp, SVCXPRT *transp);
 
 #endif
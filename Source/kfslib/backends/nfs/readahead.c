@@ -0,0 +1,343 @@
+//
+//  readahead.c
+//  KFS
+//
+//  Copyright (c) 2012, FadingRed LLC
+//  All rights reserved.
+//  
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+//  following conditions are met:
+//  
+//    - Redistributions of source code must retain the above copyright notice, this list of conditions and the
+//      following disclaimer.
+//    - Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+//      following disclaimer in the documentation and/or other materials provided with the distribution.
+//    - Neither the name of the FadingRed LLC nor the names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior written permission.
+//  
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+//  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+#include "readahead.h"
+#include "internal.h"
+#include "fileid.h"
+#include "handlecache.h"
+#include "threadpool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define READAHEAD_BLOCK			READ_MAX_LEN
+#define READAHEAD_BUCKETS		1024
+#define READAHEAD_MAX_BYTES		0x2000000	/* 32M of blocks kept for all files */
+#define READAHEAD_STREAMS		64			/* files whose reads are followed at once */
+#define READAHEAD_WORKERS		4
+#define READAHEAD_MIN_WINDOW	2			/* reads worth of blocks read ahead once reads are sequential */
+
+typedef struct kfsreadblock kfsreadblock_t;
+struct kfsreadblock {
+	kfsjob_t job;				// reads the block in the background
+	kfsid_t identifier;
+	uint64_t fileid;
+	uint64_t offset;
+	char *path;
+	char *data;
+	ssize_t length;				// -1 if the read failed
+	bool loading;
+	bool detached;				// no longer in the table, freed once it's not in use
+	int refs;
+	kfsreadblock_t *chain;		// next in the bucket
+	kfsreadblock_t *older;		// least recently read first, for eviction
+	kfsreadblock_t *newer;
+};
+
+typedef struct kfsstream kfsstream_t;
+struct kfsstream {
+	kfsid_t identifier;
+	uint64_t fileid;
+	uint64_t next;				// where the next read starts if it's sequential
+	uint64_t eof;				// where a block read ahead came up short
+	unsigned int window;		// blocks to keep read ahead
+	uint64_t used;
+};
+
+static kfsreadblock_t *buckets[READAHEAD_BUCKETS];
+static kfsreadblock_t *oldest = NULL;
+static kfsreadblock_t *newest = NULL;
+static size_t total = 0;
+static kfsstream_t streams[READAHEAD_STREAMS];
+static uint64_t uses = 0;
+static unsigned int loading[MAX_FIELSYSTEMS];
+static kfspool_t *pool = NULL;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t loaded = PTHREAD_COND_INITIALIZER;
+static pthread_once_t poolonce = PTHREAD_ONCE_INIT;
+
+
+#pragma mark -
+#pragma mark blocks
+// ----------------------------------------------------------------------------------------------------
+// blocks
+// ----------------------------------------------------------------------------------------------------
+
+static kfsreadblock_t **kfsreadahead_bucket(kfsid_t identifier, uint64_t fileid, uint64_t offset);
+static kfsreadblock_t **kfsreadahead_bucket(kfsid_t identifier, uint64_t fileid, uint64_t offset) {
+	uint64_t hash = ((fileid ^ (offset / READAHEAD_BLOCK)) * 0x9E3779B97F4A7C15ull) ^ (uint64_t)identifier;
+	return &buckets[(hash >> 32) % READAHEAD_BUCKETS];
+}
+
+static kfsreadblock_t *kfsreadahead_find_nolock(kfsid_t identifier, uint64_t fileid, uint64_t offset);
+static kfsreadblock_t *kfsreadahead_find_nolock(kfsid_t identifier, uint64_t fileid, uint64_t offset) {
+	kfsreadblock_t *block = *kfsreadahead_bucket(identifier, fileid, offset);
+	while (block && !(block->identifier == identifier && block->fileid == fileid && block->offset == offset)) {
+		block = block->chain;
+	}
+	return block;
+}
+
+static void kfsreadahead_release_nolock(kfsreadblock_t *block);
+static void kfsreadahead_release_nolock(kfsreadblock_t *block) {
+	if (--block->refs == 0 && block->detached) {
+		free(block->path);
+		free(block->data);
+		free(block);
+	}
+}
+
+// take the block out of the table. it's freed once it's not in use. the lock
+// must be held.
+static void kfsreadahead_detach_nolock(kfsreadblock_t *block);
+static void kfsreadahead_detach_nolock(kfsreadblock_t *block) {
+	kfsreadblock_t **link = kfsreadahead_bucket(block->identifier, block->fileid, block->offset);
+	while (*link != block) { link = &(*link)->chain; }
+	*link = block->chain;
+
+	if (block->older) { block->older->newer = block->newer; }
+	else { oldest = block->newer; }
+	if (block->newer) { block->newer->older = block->older; }
+	else { newest = block->older; }
+	total -= READAHEAD_BLOCK;
+
+	block->detached = true;
+	block->refs++;
+	kfsreadahead_release_nolock(block);
+}
+
+static void kfsreadahead_load(kfsjob_t *job);
+static void kfsreadahead_load(kfsjob_t *job) {
+	kfsreadblock_t *block = (kfsreadblock_t *)job;
+	const kfsfilesystem_t *filesystem = kfstable_get(block->identifier);
+	char *data = malloc(READAHEAD_BLOCK);
+	ssize_t length = -1;
+	int error = 0;
+	kfshandle_t *handle = NULL;
+	if (filesystem && kfshandle_acquire(block->identifier, filesystem, block->path, &handle, &error)) {
+		length = filesystem->read(block->path, kfshandle_value(handle), data, block->offset, READAHEAD_BLOCK,
+								  &error, filesystem->context);
+	}
+	kfshandle_release(handle);
+
+	pthread_mutex_lock(&lock);
+	block->data = data;
+	block->length = length;
+	block->loading = false;
+	loading[block->identifier]--;
+
+	// don't read ahead past the end of the file
+	if (length != -1 && length < READAHEAD_BLOCK) {
+		for (unsigned int index = 0; index < READAHEAD_STREAMS; index++) {
+			kfsstream_t *stream = &streams[index];
+			if (stream->used && stream->identifier == block->identifier && stream->fileid == block->fileid &&
+				stream->eof > block->offset + length) {
+				stream->eof = block->offset + length;
+			}
+		}
+	}
+
+	pthread_cond_broadcast(&loaded);
+	kfsreadahead_release_nolock(block);
+	pthread_mutex_unlock(&lock);
+}
+
+static void kfsreadahead_start_pool(void);
+static void kfsreadahead_start_pool(void) {
+	pool = kfspool_create(READAHEAD_WORKERS, NULL, NULL);
+}
+
+// start reading the block at offset in the background unless it's already
+// been read. the lock must be held.
+static void kfsreadahead_schedule_nolock(kfsid_t identifier, uint64_t fileid, const char *path, uint64_t offset);
+static void kfsreadahead_schedule_nolock(kfsid_t identifier, uint64_t fileid, const char *path, uint64_t offset) {
+	if (pool == NULL || kfsreadahead_find_nolock(identifier, fileid, offset)) { return; }
+
+	// make room by forgetting the blocks read longest ago
+	for (kfsreadblock_t *block = oldest, *next = NULL; block && total + READAHEAD_BLOCK > READAHEAD_MAX_BYTES; block = next) {
+		next = block->newer;
+		if (!block->loading) { kfsreadahead_detach_nolock(block); }
+	}
+	if (total + READAHEAD_BLOCK > READAHEAD_MAX_BYTES) { return; }
+
+	kfsreadblock_t *block = calloc(1, sizeof(kfsreadblock_t));
+	block->job.perform = kfsreadahead_load;
+	block->identifier = identifier;
+	block->fileid = fileid;
+	block->offset = offset;
+	block->path = strdup(path);
+	block->loading = true;
+	block->refs = 2; // one for the table and one for the job
+
+	kfsreadblock_t **bucket = kfsreadahead_bucket(identifier, fileid, offset);
+	block->chain = *bucket;
+	*bucket = block;
+	block->older = newest;
+	if (newest) { newest->newer = block; }
+	else { oldest = block; }
+	newest = block;
+	total += READAHEAD_BLOCK;
+	loading[identifier]++;
+
+	kfspool_submit(pool, &block->job);
+}
+
+
+#pragma mark -
+#pragma mark streams
+// ----------------------------------------------------------------------------------------------------
+// streams
+// ----------------------------------------------------------------------------------------------------
+
+// follow a read of the file, and return its stream if blocks should be read
+// ahead. the lock must be held.
+static kfsstream_t *kfsreadahead_follow_nolock(kfsid_t identifier, uint64_t fileid, uint64_t offset, size_t length,
+											   bool hit, unsigned int minimum, unsigned int limit);
+static kfsstream_t *kfsreadahead_follow_nolock(kfsid_t identifier, uint64_t fileid, uint64_t offset, size_t length,
+											   bool hit, unsigned int minimum, unsigned int limit) {
+	kfsstream_t *stream = NULL;
+	kfsstream_t *unused = &streams[0];
+	for (unsigned int index = 0; index < READAHEAD_STREAMS && stream == NULL; index++) {
+		kfsstream_t *candidate = &streams[index];
+		if (candidate->used && candidate->identifier == identifier && candidate->fileid == fileid) { stream = candidate; }
+		else if (candidate->used < unused->used) { unused = candidate; }
+	}
+
+	bool sequential = (stream && offset == stream->next);
+	if (stream == NULL) {
+		stream = unused;
+		*stream = (kfsstream_t){ .identifier = identifier, .fileid = fileid, .eof = UINT64_MAX };
+	}
+	stream->used = ++uses;
+	stream->next = offset + length;
+
+	// the window grows each time a read finds its data already read, and closes
+	// as soon as reads stop being sequential.
+	if (!sequential) { stream->window = 0; }
+	else if (stream->window == 0) { stream->window = minimum; }
+	else if (hit) { stream->window *= 2; }
+	if (stream->window > limit) { stream->window = limit; }
+	return stream->window ? stream : NULL;
+}
+
+
+#pragma mark -
+#pragma mark function implementation
+// ----------------------------------------------------------------------------------------------------
+// function implementation
+// ----------------------------------------------------------------------------------------------------
+
+ssize_t kfsreadahead_read(kfsid_t identifier, const kfsfilesystem_t *filesystem, const char *path, void *handle,
+						  char *buf, uint64_t offset, size_t length, int *error) {
+	unsigned int limit = (unsigned int)(((uint64_t)filesystem->options.readahead * 1024) / READAHEAD_BLOCK);
+	if (limit == 0) {
+		return filesystem->read(path, handle, buf, offset, length, error, filesystem->context);
+	}
+	pthread_once(&poolonce, kfsreadahead_start_pool);
+
+	uint64_t fileid = kfs_fileid(identifier, path);
+	unsigned int span = (unsigned int)((length + READAHEAD_BLOCK - 1) / READAHEAD_BLOCK);
+	size_t count = 0;
+	bool ended = false; // a block came up short at the end of the file
+
+	pthread_mutex_lock(&lock);
+
+	// use the blocks that were read ahead for as much of the read as they cover,
+	// wherever in a block the read starts (reads may be smaller than blocks, or
+	// not line up with them). a block is dropped once a read reaches its end,
+	// since the client keeps what it's read.
+	while (count < length && !ended) {
+		uint64_t position = offset + count;
+		uint64_t blockoffset = position - (position % READAHEAD_BLOCK);
+		kfsreadblock_t *block = kfsreadahead_find_nolock(identifier, fileid, blockoffset);
+		if (block == NULL) { break; }
+
+		block->refs++;
+		while (block->loading) { pthread_cond_wait(&loaded, &lock); }
+		bool usable = (!block->detached && block->length != -1);
+		if (usable) {
+			size_t within = (size_t)(position - blockoffset);
+			size_t available = ((size_t)block->length > within) ? (size_t)block->length - within : 0;
+			size_t copied = (available < length - count) ? available : length - count;
+			memcpy(buf + count, block->data + within, copied);
+			count += copied;
+			ended = (block->length < READAHEAD_BLOCK && within + copied >= (size_t)block->length);
+			if (within + copied >= (size_t)block->length) { kfsreadahead_detach_nolock(block); }
+		}
+		kfsreadahead_release_nolock(block);
+		if (!usable) { break; }
+	}
+
+	kfsstream_t *stream = kfsreadahead_follow_nolock(identifier, fileid, offset, length, (count > 0 || ended),
+													 READAHEAD_MIN_WINDOW * span, limit);
+	if (stream) {
+		// start with the block the next read begins in, which this one may have only
+		// read part of
+		uint64_t start = ((offset + length) / READAHEAD_BLOCK) * READAHEAD_BLOCK;
+		for (unsigned int index = 0; index < stream->window; index++) {
+			uint64_t blockoffset = start + (uint64_t)index * READAHEAD_BLOCK;
+			if (blockoffset >= stream->eof) { break; }
+			kfsreadahead_schedule_nolock(identifier, fileid, path, blockoffset);
+		}
+	}
+	pthread_mutex_unlock(&lock);
+
+	// read whatever the blocks didn't have. if that fails after some of the read
+	// was found, the read is just short.
+	if (count < length && !ended) {
+		ssize_t result = filesystem->read(path, handle, buf + count, offset + count, length - count, error,
+										  filesystem->context);
+		if (result == -1 && count == 0) { return -1; }
+		if (result > 0) { count += result; }
+	}
+	return (ssize_t)count;
+}
+
+void kfsreadahead_invalidate(kfsid_t identifier, uint64_t fileid) {
+	pthread_mutex_lock(&lock);
+	for (kfsreadblock_t *block = oldest, *next = NULL; block; block = next) {
+		next = block->newer;
+		if (block->identifier == identifier && block->fileid == fileid) { kfsreadahead_detach_nolock(block); }
+	}
+	for (unsigned int index = 0; index < READAHEAD_STREAMS; index++) {
+		kfsstream_t *stream = &streams[index];
+		if (stream->used && stream->identifier == identifier && stream->fileid == fileid) { stream->eof = UINT64_MAX; }
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void kfsreadahead_clear(kfsid_t identifier) {
+	pthread_mutex_lock(&lock);
+	for (kfsreadblock_t *block = oldest, *next = NULL; block; block = next) {
+		next = block->newer;
+		if (block->identifier == identifier) { kfsreadahead_detach_nolock(block); }
+	}
+	for (unsigned int index = 0; index < READAHEAD_STREAMS; index++) {
+		if (streams[index].identifier == identifier) { streams[index] = (kfsstream_t){}; }
+	}
+	while (loading[identifier]) { pthread_cond_wait(&loaded, &lock); }
+	pthread_mutex_unlock(&lock);
+}
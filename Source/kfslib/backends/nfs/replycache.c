@@ -0,0 +1,264 @@
+//
+//  replycache.c
+//  KFS
+//
+//  Copyright (c) 2012, FadingRed LLC
+//  All rights reserved.
+//  
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+//  following conditions are met:
+//  
+//    - Redistributions of source code must retain the above copyright notice, this list of conditions and the
+//      following disclaimer.
+//    - Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+//      following disclaimer in the documentation and/or other materials provided with the distribution.
+//    - Neither the name of the FadingRed LLC nor the names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior written permission.
+//  
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+//  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "replycache.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+#define CACHE_BUCKETS		256
+#define CACHE_MAX_ENTRIES	1024
+#define CACHE_TTL			120		/* seconds a finished reply is kept */
+#define PARKED_TTL			5		/* seconds a finished reply to a parked call is kept */
+#define CACHE_MAX_LEN		0x1000000	/* 16M, most bytes of finished replies kept */
+
+struct kfsreply {
+	kfsreplykey_t key;
+	uint32_t hash;
+	kfsreplystate_t state;
+	bool stale;			// forget the reply when it's finished
+	char *data;
+	size_t length;
+	time_t finished;
+	kfsreply_t *chain;	// next in the bucket
+	kfsreply_t *older;	// insertion order, for eviction
+	kfsreply_t *newer;
+};
+
+static kfsreply_t *buckets[CACHE_BUCKETS];
+static kfsreply_t *oldest = NULL;
+static kfsreply_t *newest = NULL;
+static unsigned int count = 0;
+static size_t bytes = 0;
+static unsigned int changeable = 0; // parked idempotent calls, forgotten when something changes
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+#pragma mark -
+#pragma mark entries
+// ----------------------------------------------------------------------------------------------------
+// entries
+// ----------------------------------------------------------------------------------------------------
+
+static uint32_t kfsreply_hash(const kfsreplykey_t *key);
+static uint32_t kfsreply_hash(const kfsreplykey_t *key) {
+	uint32_t hash = 2166136261u ^ key->xid ^ (key->procedure << 24); // fnv-1a
+	for (size_t i = 0; i < key->args_length; i++) {
+		hash = (hash ^ (uint8_t)key->args[i]) * 16777619u;
+	}
+	return hash;
+}
+
+static kfsreply_t **kfsreply_bucket(uint32_t hash);
+static kfsreply_t **kfsreply_bucket(uint32_t hash) {
+	return &buckets[(hash ^ (hash >> 8) ^ (hash >> 16)) % CACHE_BUCKETS];
+}
+
+static kfsreply_t *kfsreply_find_nolock(const kfsreplykey_t *key, uint32_t hash);
+static kfsreply_t *kfsreply_find_nolock(const kfsreplykey_t *key, uint32_t hash) {
+	kfsreply_t *entry = *kfsreply_bucket(hash);
+	while (entry && !(entry->hash == hash &&
+					  entry->key.xid == key->xid &&
+					  entry->key.program == key->program &&
+					  entry->key.version == key->version &&
+					  entry->key.procedure == key->procedure &&
+					  entry->key.args_length == key->args_length &&
+					  (key->args_length == 0 || memcmp(entry->key.args, key->args, key->args_length) == 0))) {
+		entry = entry->chain;
+	}
+	return entry;
+}
+
+static void kfsreply_remove_nolock(kfsreply_t *entry);
+static void kfsreply_remove_nolock(kfsreply_t *entry) {
+	kfsreply_t **link = kfsreply_bucket(entry->hash);
+	while (*link != entry) { link = &(*link)->chain; }
+	*link = entry->chain;
+
+	if (entry->older) { entry->older->newer = entry->newer; }
+	else { oldest = entry->newer; }
+	if (entry->newer) { entry->newer->older = entry->older; }
+	else { newest = entry->older; }
+
+	count--;
+	bytes -= entry->length;
+	if (entry->key.xid == 0 && entry->key.idempotent) { changeable--; }
+	free((void *)entry->key.args);
+	free(entry->data);
+	free(entry);
+}
+
+// parked calls are found by their arguments, which an unrelated call could share,
+// so their replies aren't kept long.
+static bool kfsreply_expired(const kfsreply_t *entry, time_t now);
+static bool kfsreply_expired(const kfsreply_t *entry, time_t now) {
+	return entry->state == KFSREPLY_DONE && now - entry->finished > (entry->key.xid ? CACHE_TTL : PARKED_TTL);
+}
+
+// discard finished replies that are too old to be asked for again
+static void kfsreply_expire_nolock(void);
+static void kfsreply_expire_nolock(void) {
+	time_t now = time(NULL);
+	while (oldest && kfsreply_expired(oldest, now)) {
+		kfsreply_remove_nolock(oldest);
+	}
+}
+
+// make room for another entry by discarding the oldest finished one. calls that
+// are still in progress can't be discarded since their callers hold on to them.
+static bool kfsreply_evict_nolock(void);
+static bool kfsreply_evict_nolock(void) {
+	for (kfsreply_t *entry = oldest; entry; entry = entry->newer) {
+		if (entry->state == KFSREPLY_DONE) {
+			kfsreply_remove_nolock(entry);
+			return true;
+		}
+	}
+	return false;
+}
+
+
+#pragma mark -
+#pragma mark function implementation
+// ----------------------------------------------------------------------------------------------------
+// function implementation
+// ----------------------------------------------------------------------------------------------------
+
+kfsreplystate_t kfsreplycache_begin(const kfsreplykey_t *key, kfsreply_t **outEntry, char **outReply, size_t *outLength) {
+	kfsreplystate_t state = KFSREPLY_NEW;
+	uint32_t hash = kfsreply_hash(key);
+	*outEntry = NULL;
+	*outReply = NULL;
+	*outLength = 0;
+
+	pthread_mutex_lock(&lock);
+	kfsreply_expire_nolock();
+
+	kfsreply_t *entry = kfsreply_find_nolock(key, hash);
+	if (entry && kfsreply_expired(entry, time(NULL))) {
+		kfsreply_remove_nolock(entry);
+		entry = NULL;
+	}
+	if (entry) {
+		state = entry->state;
+		if (state == KFSREPLY_DONE) {
+			*outReply = malloc(entry->length);
+			memcpy(*outReply, entry->data, entry->length);
+			*outLength = entry->length;
+		}
+	} else if (count < CACHE_MAX_ENTRIES || kfsreply_evict_nolock()) {
+		entry = calloc(1, sizeof(kfsreply_t));
+		entry->key = *key;
+		if (key->args_length) {
+			entry->key.args = malloc(key->args_length);
+			memcpy((void *)entry->key.args, key->args, key->args_length);
+		}
+		entry->hash = hash;
+		entry->state = KFSREPLY_IN_PROGRESS;
+
+		kfsreply_t **bucket = kfsreply_bucket(hash);
+		entry->chain = *bucket;
+		*bucket = entry;
+
+		entry->older = newest;
+		if (newest) { newest->newer = entry; }
+		else { oldest = entry; }
+		newest = entry;
+		count++;
+		if (key->xid == 0 && key->idempotent) { changeable++; }
+
+		*outEntry = entry;
+	}
+
+	pthread_mutex_unlock(&lock);
+
+	return state;
+}
+
+kfsreplystate_t kfsreplycache_take(const kfsreplykey_t *key, char **outReply, size_t *outLength) {
+	kfsreplystate_t state = KFSREPLY_NEW;
+	uint32_t hash = kfsreply_hash(key);
+	*outReply = NULL;
+	*outLength = 0;
+
+	pthread_mutex_lock(&lock);
+	kfsreply_expire_nolock();
+
+	kfsreply_t *entry = kfsreply_find_nolock(key, hash);
+	if (entry && kfsreply_expired(entry, time(NULL))) {
+		kfsreply_remove_nolock(entry);
+		entry = NULL;
+	}
+	if (entry) {
+		state = entry->state;
+		if (state == KFSREPLY_DONE) {
+			*outReply = entry->data;
+			*outLength = entry->length;
+			bytes -= entry->length;
+			entry->data = NULL;
+			entry->length = 0;
+			kfsreply_remove_nolock(entry);
+		}
+	}
+
+	pthread_mutex_unlock(&lock);
+
+	return state;
+}
+
+void kfsreplycache_finish(kfsreply_t *entry, const char *reply, size_t length) {
+	if (entry == NULL) { return; }
+
+	pthread_mutex_lock(&lock);
+	if (reply && !entry->stale) {
+		entry->data = malloc(length);
+		memcpy(entry->data, reply, length);
+		entry->length = length;
+		entry->finished = time(NULL);
+		entry->state = KFSREPLY_DONE;
+		bytes += length;
+
+		// large replies (whole reads) are only kept while there's room for them
+		while (bytes > CACHE_MAX_LEN && kfsreply_evict_nolock()) {}
+	} else {
+		kfsreply_remove_nolock(entry);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void kfsreplycache_changed(void) {
+	pthread_mutex_lock(&lock);
+	for (kfsreply_t *entry = changeable ? oldest : NULL, *newer = NULL; entry; entry = newer) {
+		newer = entry->newer;
+		if (entry->key.xid == 0 && entry->key.idempotent) {
+			if (entry->state == KFSREPLY_DONE) { kfsreply_remove_nolock(entry); }
+			else { entry->stale = true; }
+		}
+	}
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,96 @@
+//
+//  replycache.h
+//  KFS
+//
+//  Copyright (c) 2012, FadingRed LLC
+//  All rights reserved.
+//  
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+//  following conditions are met:
+//  
+//    - Redistributions of source code must retain the above copyright notice, this list of conditions and the
+//      following disclaimer.
+//    - Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+//      following disclaimer in the documentation and/or other materials provided with the distribution.
+//    - Neither the name of the FadingRed LLC nor the names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior written permission.
+//  
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+//  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _KFSREPLYCACHE_H_
+#define _KFSREPLYCACHE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct kfsreply kfsreply_t;
+
+/*!
+ \brief		Reply key
+ \details	Replies to retransmitted calls are found by xid (with no arguments). Replies to
+			calls that are tried again later (with a new xid) are found by their arguments
+			(with an xid of 0), and are only kept for a few seconds since an unrelated call
+			could have the same arguments. Whether the call is idempotent isn't part of the
+			key, but a parked reply to one is forgotten once something changes.
+ */
+typedef struct {
+	uint32_t xid;
+	uint32_t program;
+	uint32_t version;
+	uint32_t procedure;
+	const char *args;
+	size_t args_length;
+	bool idempotent;
+} kfsreplykey_t;
+
+typedef enum {
+	KFSREPLY_NEW,
+	KFSREPLY_IN_PROGRESS,
+	KFSREPLY_DONE,
+} kfsreplystate_t;
+
+/*!
+ \brief		Begin a call
+ \details	Looks up a call by its key. When the call hasn't been seen before, this returns
+			KFSREPLY_NEW and an entry (which may be NULL if the cache is full of calls in
+			progress) that must be passed to kfsreplycache_finish once the reply is known.
+			If the call is a retransmission of one that is still being performed, this
+			returns KFSREPLY_IN_PROGRESS. If it's a retransmission of one that has finished,
+			this returns KFSREPLY_DONE along with a copy of the encoded reply that the caller
+			must free.
+ */
+kfsreplystate_t kfsreplycache_begin(const kfsreplykey_t *key, kfsreply_t **entry, char **reply, size_t *length);
+
+/*!
+ \brief		Take a reply
+ \details	Like begin, but returns KFSREPLY_NEW without adding an entry when the call hasn't
+			been seen. A finished reply is removed once it has been taken.
+ */
+kfsreplystate_t kfsreplycache_take(const kfsreplykey_t *key, char **reply, size_t *length);
+
+/*!
+ \brief		Finish a call
+ \details	Stores a copy of the encoded reply for the entry so that it can be replayed. Pass
+			a NULL reply if the call finished without one, and the entry will be forgotten.
+			Entries are kept for a while and then discarded.
+ */
+void kfsreplycache_finish(kfsreply_t *entry, const char *reply, size_t length);
+
+/*!
+ \brief		Forget replies that may be out of date
+ \details	Call before performing a call that changes something. Replies kept for parked
+			calls that are idempotent (reads of data or attributes that may be changing) are
+			forgotten, and ones still in progress are forgotten when they finish, so a client
+			trying again gets a fresh reply.
+ */
+void kfsreplycache_changed(void);
+
+#endif
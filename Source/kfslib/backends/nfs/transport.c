@@ -0,0 +1,1391 @@
+//
+//  transport.c
+//  KFS
+//
+//  Copyright (c) 2012, FadingRed LLC
+//  All rights reserved.
+//  
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+//  following conditions are met:
+//  
+//    - Redistributions of source code must retain the above copyright notice, this list of conditions and the
+//      following disclaimer.
+//    - Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+//      following disclaimer in the documentation and/or other materials provided with the distribution.
+//    - Neither the name of the FadingRed LLC nor the names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior written permission.
+//  
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+//  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include "transport.h"
+#include "internal.h"
+#include "arena.h"
+#include "bufferpool.h"
+#include "replycache.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#define USE_EPOLL 1
+#else
+#include <sys/event.h>
+#endif
+
+#define MAX_PROGRAMS		4
+#define MAX_EVENTS			64
+#define MAX_CALLS			128							/* calls in flight per connection */
+#define MAX_SPARE_ARENAS	64
+#define DEFAULT_CONCURRENCY	4							/* calls in flight per filesystem */
+#define RECORD_MAX_LEN		(TRANSFER_MAX_LEN + 0x1000)	/* largest call we'll accept */
+#define RECEIVE_CHUNK_LEN	0x10000						/* 64K, read at a time */
+#define RECEIVE_BLOCK_LEN	0x40000						/* 256K, smallest block read into (with its header) */
+#define RECEIVE_WAKEUP_LEN	0x100000					/* 1M, read per wakeup before moving on */
+#define REPLY_INITIAL_LEN	0x1000						/* 4K, grown as needed */
+#define REPLY_MAX_LEN		0x400000					/* 4M */
+#define RECORD_LAST_FRAG	0x80000000
+
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+#define _errout(format, ...) do { fprintf(stderr, format " %i: %s\n", ##__VA_ARGS__, errno, strerror(errno)); } while (0)
+
+typedef struct kfsconnection kfsconnection_t;
+typedef struct kfscall kfscall_t;
+typedef struct kfsblock kfsblock_t;
+
+typedef enum {
+	KFSCALL_WAITING,	// no reply has been sent yet
+	KFSCALL_REPLIED,
+	KFSCALL_PARKED,		// the client was told to try again, so the reply is kept for then
+} kfsreplied_t;
+
+struct kfsconnection {
+	int sock;
+	pthread_mutex_t lock;		// guards refs, calls, paused and closed
+	pthread_mutex_t sendlock;	// held while a reply is written to the socket
+	int refs;
+	int calls;
+	bool paused;
+	bool closed;				// never watched again once set
+
+	// receive state, only touched by the transport thread
+	kfsblock_t *block;			// being read into
+	size_t position;			// how much of the block has been parsed
+	char *record;				// the fragments of a record that came in more than one
+	size_t record_length;
+};
+
+// data is read from a connection into a block, and calls are decoded from the
+// block in place. each call holds on to the block it was read into.
+struct kfsblock {
+	int refs;					// guarded by the block lock
+	size_t length;
+	size_t capacity;
+	char data[];
+};
+
+struct kfsreq {
+	kfscall_t *call;
+	kfsresume_f resume;
+	void *state;
+	ssize_t result;
+	int error;
+};
+
+struct kfscall {
+	kfsjob_t job;
+	SVCXPRT xprt;
+	struct svc_req request;
+	kfsconnection_t *connection;
+	kfsarena_t *arena;
+	kfsqueue_t *queue;
+	kfsreply_t *cached;		// where the reply is kept in case the call is retransmitted
+	kfsreply_t *parked;		// where the reply is kept once the call is parked
+	kfsdispatch_f busy;
+	unsigned int timeout;	// milliseconds before the call is parked (0 for never)
+	bool idempotent;		// performing the call again gives the same reply
+	struct timeval deadline;
+	kfsreplied_t replied;	// guarded by the watch lock
+	bool watched;
+	bool parking;			// the watch thread is using the call (guarded by the watch lock)
+	kfscall_t *watch_next;
+	kfscall_t *watch_prev;
+	kfsreq_t req;
+	bool deferred;		// the reply will be sent once the request completes
+	bool dispatched;	// the dispatch function has returned (guarded by the connection lock)
+	bool completed;		// the request has completed (guarded by the connection lock)
+	uint32_t xid;
+	char *record;			// in the block, or allocated if there's no block
+	size_t record_length;
+	kfsblock_t *block;
+	xdrproc_t args;			// decodes the arguments in place of the program's own decoder
+	size_t args_offset;
+	const char *data;		// sent after the encoded reply (only while the reply is being sent)
+	size_t data_length;
+	bool data_file;			// the data is sent from a file rather than from memory
+	int data_fd;
+	off_t data_offset;
+	XDR xdrs;
+	char credentials[2 * MAX_AUTH_BYTES];
+};
+
+static struct {
+	uint32_t program;
+	uint32_t version;
+	kfsdispatch_f dispatch;
+	kfsroute_f route;
+	kfsdispatch_f busy;
+} programs[MAX_PROGRAMS];
+static int program_count = 0;
+
+static kfspool_t *pool = NULL;
+
+// queues for each filesystem and lane, only used by the transport thread
+static kfsqueue_t *queues[MAX_FIELSYSTEMS][KFSLANE_COUNT];
+static unsigned int limits[MAX_FIELSYSTEMS];
+static int events = -1;
+
+// paused connections to read from again are written here (each holding a
+// reference) so the transport thread picks them up.
+static int wakeup[2] = { -1, -1 };
+
+// each worker gets its own arena the first time it performs a call. everything
+// allocated while handling a call is released at once after the reply is sent.
+static pthread_key_t arenakey;
+static pthread_once_t arenaonce = PTHREAD_ONCE_INIT;
+
+// a call whose reply is deferred takes the arena of the worker that started it,
+// and the worker gets another one. arenas are kept here once those calls finish.
+static kfsarena_t *spare_arenas[MAX_SPARE_ARENAS];
+static int spare_count = 0;
+static pthread_mutex_t sparelock = PTHREAD_MUTEX_INITIALIZER;
+
+// guards the reference counts of receive blocks
+static pthread_mutex_t blocklock = PTHREAD_MUTEX_INITIALIZER;
+
+// calls with a deadline, checked by the watch thread
+static kfscall_t *watched = NULL;
+static pthread_mutex_t watchlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t watchcond = PTHREAD_COND_INITIALIZER;
+
+
+#pragma mark -
+#pragma mark event helpers
+// ----------------------------------------------------------------------------------------------------
+// event helpers
+// ----------------------------------------------------------------------------------------------------
+
+#if USE_EPOLL
+typedef struct epoll_event kfsevent_t;
+#define kfsevent_data(event) ((event)->data.ptr)
+#else
+typedef struct kevent kfsevent_t;
+#define kfsevent_data(event) ((event)->udata)
+#endif
+
+static int events_create(void);
+static int events_create(void) {
+#if USE_EPOLL
+	return epoll_create(MAX_EVENTS);
+#else
+	return kqueue();
+#endif
+}
+
+static bool events_add(int sock, void *data);
+static bool events_add(int sock, void *data) {
+#if USE_EPOLL
+	struct epoll_event event = { .events = EPOLLIN, .data = { .ptr = data } };
+	return epoll_ctl(events, EPOLL_CTL_ADD, sock, &event) == 0;
+#else
+	struct kevent event;
+	EV_SET(&event, sock, EVFILT_READ, EV_ADD, 0, 0, data);
+	return kevent(events, &event, 1, NULL, 0, NULL) == 0;
+#endif
+}
+
+static void events_remove(int sock);
+static void events_remove(int sock) {
+#if USE_EPOLL
+	struct epoll_event event = {};
+	epoll_ctl(events, EPOLL_CTL_DEL, sock, &event);
+#else
+	struct kevent event;
+	EV_SET(&event, sock, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+	kevent(events, &event, 1, NULL, 0, NULL);
+#endif
+}
+
+static int events_wait(kfsevent_t *list, int max);
+static int events_wait(kfsevent_t *list, int max) {
+#if USE_EPOLL
+	return epoll_wait(events, list, max, -1);
+#else
+	return kevent(events, NULL, 0, list, max, NULL);
+#endif
+}
+
+
+#pragma mark -
+#pragma mark socket helpers
+// ----------------------------------------------------------------------------------------------------
+// socket helpers
+// ----------------------------------------------------------------------------------------------------
+
+static bool set_nonblocking(int sock);
+static bool set_nonblocking(int sock) {
+	int flags = fcntl(sock, F_GETFL);
+	return flags >= 0 && fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+// sockets are non-blocking so the transport thread never stalls on a single
+// connection. a worker sending a reply waits for room instead.
+static bool send_fully(int sock, struct iovec *iov, int iovcnt);
+static bool send_fully(int sock, struct iovec *iov, int iovcnt) {
+	while (iovcnt > 0) {
+		struct msghdr msg = { .msg_iov = iov, .msg_iovlen = iovcnt };
+		ssize_t count = sendmsg(sock, &msg, SEND_FLAGS);
+		if (count < 0) {
+			if (errno == EINTR) { continue; }
+			if (errno == EAGAIN) {
+				struct pollfd fd = { .fd = sock, .events = POLLOUT };
+				poll(&fd, 1, -1);
+				continue;
+			}
+			return false;
+		}
+		while (iovcnt > 0 && (size_t)count >= iov->iov_len) {
+			count -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + count;
+			iov->iov_len -= count;
+		}
+	}
+	return true;
+}
+
+
+#pragma mark -
+#pragma mark arenas
+// ----------------------------------------------------------------------------------------------------
+// arenas
+// ----------------------------------------------------------------------------------------------------
+
+static void arena_key_create(void);
+static void arena_key_create(void) {
+	pthread_key_create(&arenakey, (void (*)(void *))kfsarena_destroy);
+}
+
+static kfsarena_t *arena_for_worker(void);
+static kfsarena_t *arena_for_worker(void) {
+	pthread_once(&arenaonce, arena_key_create);
+	kfsarena_t *arena = pthread_getspecific(arenakey);
+	if (arena == NULL) {
+		pthread_mutex_lock(&sparelock);
+		if (spare_count > 0) { arena = spare_arenas[--spare_count]; }
+		pthread_mutex_unlock(&sparelock);
+
+		if (arena == NULL) { arena = kfsarena_create(); }
+		pthread_setspecific(arenakey, arena);
+	}
+	return arena;
+}
+
+static void arena_recycle(kfsarena_t *arena);
+static void arena_recycle(kfsarena_t *arena) {
+	kfsarena_reset(arena);
+
+	pthread_mutex_lock(&sparelock);
+	bool kept = (spare_count < MAX_SPARE_ARENAS);
+	if (kept) { spare_arenas[spare_count++] = arena; }
+	pthread_mutex_unlock(&sparelock);
+
+	if (!kept) { kfsarena_destroy(arena); }
+}
+
+
+#pragma mark -
+#pragma mark blocks
+// ----------------------------------------------------------------------------------------------------
+// blocks
+// ----------------------------------------------------------------------------------------------------
+
+// blocks come from the buffer pool, so the large ones that big writes need are
+// reused rather than allocated for each one.
+static kfsblock_t *kfsblock_create(size_t capacity);
+static kfsblock_t *kfsblock_create(size_t capacity) {
+	size_t size = 0;
+	kfsblock_t *block = kfsbuffer_alloc(sizeof(kfsblock_t) + capacity, &size);
+	block->refs = 1;
+	block->length = 0;
+	block->capacity = size - sizeof(kfsblock_t);
+	return block;
+}
+
+static void kfsblock_retain(kfsblock_t *block);
+static void kfsblock_retain(kfsblock_t *block) {
+	pthread_mutex_lock(&blocklock);
+	block->refs++;
+	pthread_mutex_unlock(&blocklock);
+}
+
+static void kfsblock_release(kfsblock_t *block);
+static void kfsblock_release(kfsblock_t *block) {
+	pthread_mutex_lock(&blocklock);
+	bool last = (--block->refs == 0);
+	pthread_mutex_unlock(&blocklock);
+
+	if (last) { kfsbuffer_free(block); }
+}
+
+// true if nothing but the connection reading into it is using the block
+static bool kfsblock_unshared(kfsblock_t *block);
+static bool kfsblock_unshared(kfsblock_t *block) {
+	pthread_mutex_lock(&blocklock);
+	bool unshared = (block->refs == 1);
+	pthread_mutex_unlock(&blocklock);
+	return unshared;
+}
+
+
+#pragma mark -
+#pragma mark call transport operations
+// ----------------------------------------------------------------------------------------------------
+// call transport operations
+// ----------------------------------------------------------------------------------------------------
+
+static bool_t kfscall_recv(SVCXPRT *xprt, struct rpc_msg *msg);
+static bool_t kfscall_recv(SVCXPRT *xprt, struct rpc_msg *msg) {
+	return FALSE; // calls are read by the transport thread, never through the transport
+}
+
+static enum xprt_stat kfscall_stat(SVCXPRT *xprt);
+static enum xprt_stat kfscall_stat(SVCXPRT *xprt) {
+	return XPRT_IDLE;
+}
+
+static bool_t kfscall_getargs(SVCXPRT *xprt, xdrproc_t xdr_args, void *args_ptr);
+static bool_t kfscall_getargs(SVCXPRT *xprt, xdrproc_t xdr_args, void *args_ptr) {
+	kfscall_t *call = (kfscall_t *)xprt->xp_p1;
+	if (call->args) { xdr_args = call->args; }
+	return (*xdr_args)(&call->xdrs, args_ptr);
+}
+
+// send part of a file straight to the socket, with zeros for anything past its end.
+static bool send_file(int sock, int fd, off_t offset, size_t count);
+static bool send_file(int sock, int fd, off_t offset, size_t count) {
+	while (count > 0) {
+#if defined(__linux__)
+		ssize_t sent = sendfile(sock, fd, &offset, count);
+		bool failed = (sent < 0);
+		if (sent > 0) { count -= sent; }
+#else
+		off_t sent = (off_t)count;
+		bool failed = (sendfile(fd, sock, offset, &sent, NULL, 0) != 0);
+		offset += sent;
+		count -= sent;
+#endif
+		if (failed) {
+			if (errno == EINTR) { continue; }
+			if (errno == EAGAIN) {
+				struct pollfd pfd = { .fd = sock, .events = POLLOUT };
+				poll(&pfd, 1, -1);
+				continue;
+			}
+			return false;
+		}
+		if (sent == 0) { break; } // end of file
+	}
+
+	static const char zeros[0x1000] = {};
+	while (count > 0) {
+		size_t length = (count < sizeof(zeros)) ? count : sizeof(zeros);
+		struct iovec iov = { .iov_base = (char *)zeros, .iov_len = length };
+		if (!send_fully(sock, &iov, 1)) { return false; }
+		count -= length;
+	}
+	return true;
+}
+
+// like send_record_data, but the data comes from a file. the header, file and
+// padding can't go out with one write, so they're sent in turn.
+static bool send_record_file(kfsconnection_t *connection, char *buffer, size_t length, int fd, off_t offset, size_t data_length);
+static bool send_record_file(kfsconnection_t *connection, char *buffer, size_t length, int fd, off_t offset, size_t data_length) {
+	static const char padding[BYTES_PER_XDR_UNIT] = {};
+	size_t pad = RNDUP(data_length) - data_length;
+	uint32_t mark = htonl(RECORD_LAST_FRAG | (uint32_t)(length + data_length + pad));
+	struct iovec header[] = {
+		{ .iov_base = &mark, .iov_len = sizeof(mark) },
+		{ .iov_base = buffer, .iov_len = length },
+	};
+	struct iovec trailer = { .iov_base = (char *)padding, .iov_len = pad };
+	pthread_mutex_lock(&connection->sendlock);
+	bool success = send_fully(connection->sock, header, 2) &&
+		send_file(connection->sock, fd, offset, data_length) &&
+		send_fully(connection->sock, &trailer, pad ? 1 : 0);
+	pthread_mutex_unlock(&connection->sendlock);
+	return success;
+}
+
+// send a record made up of the buffer followed by data (padded to a multiple of
+// 4 bytes as xdr requires), all with a single write.
+static bool send_record_data(kfsconnection_t *connection, char *buffer, size_t length, const char *data, size_t data_length);
+static bool send_record_data(kfsconnection_t *connection, char *buffer, size_t length, const char *data, size_t data_length) {
+	static const char padding[BYTES_PER_XDR_UNIT] = {};
+	size_t pad = RNDUP(data_length) - data_length;
+	uint32_t mark = htonl(RECORD_LAST_FRAG | (uint32_t)(length + data_length + pad));
+	struct iovec iov[] = {
+		{ .iov_base = &mark, .iov_len = sizeof(mark) },
+		{ .iov_base = buffer, .iov_len = length },
+		{ .iov_base = (char *)data, .iov_len = data_length },
+		{ .iov_base = (char *)padding, .iov_len = pad },
+	};
+	pthread_mutex_lock(&connection->sendlock);
+	bool success = send_fully(connection->sock, iov, (data_length || pad) ? 4 : 2);
+	pthread_mutex_unlock(&connection->sendlock);
+	return success;
+}
+
+static bool send_record(kfsconnection_t *connection, char *buffer, size_t length);
+static bool send_record(kfsconnection_t *connection, char *buffer, size_t length) {
+	return send_record_data(connection, buffer, length, NULL, 0);
+}
+
+static bool encode_reply(struct rpc_msg *msg, char **outBuffer, size_t *outLength);
+static bool encode_reply(struct rpc_msg *msg, char **outBuffer, size_t *outLength) {
+	// we don't know how large the reply will be ahead of time, so encode into
+	// a buffer that we grow until the whole reply fits.
+	bool success = false;
+	char *buffer = NULL;
+	size_t length = 0;
+	for (size_t capacity = REPLY_INITIAL_LEN; !success && capacity <= REPLY_MAX_LEN; capacity *= 2) {
+		buffer = realloc(buffer, capacity);
+		XDR xdrs;
+		xdrmem_create(&xdrs, buffer, (u_int)capacity, XDR_ENCODE);
+		if (xdr_replymsg(&xdrs, msg)) {
+			length = XDR_GETPOS(&xdrs);
+			success = true;
+		}
+		XDR_DESTROY(&xdrs);
+	}
+
+	if (!success) {
+		free(buffer);
+		buffer = NULL;
+	}
+
+	*outBuffer = buffer;
+	*outLength = length;
+	return success;
+}
+
+static bool_t kfscall_reply(SVCXPRT *xprt, struct rpc_msg *msg);
+static bool_t kfscall_reply(SVCXPRT *xprt, struct rpc_msg *msg) {
+	kfscall_t *call = (kfscall_t *)xprt->xp_p1;
+	msg->rm_xid = call->xid;
+
+	char *buffer = NULL;
+	size_t length = 0;
+	bool_t success = encode_reply(msg, &buffer, &length);
+	if (success && call->data) {
+		// the result was encoded with empty data, whose length is the last thing
+		// in the buffer. fill in the real length and send the data after it.
+		uint32_t data_length = htonl((uint32_t)call->data_length);
+		memcpy(buffer + length - sizeof(data_length), &data_length, sizeof(data_length));
+	}
+
+	if (success) {
+		pthread_mutex_lock(&watchlock);
+		bool parked = (call->replied == KFSCALL_PARKED);
+		if (!parked) { call->replied = KFSCALL_REPLIED; }
+		pthread_mutex_unlock(&watchlock);
+
+		if (call->data && (parked || call->cached)) { // cached replies are kept whole
+			size_t total = length + RNDUP(call->data_length);
+			buffer = realloc(buffer, total);
+			memset(buffer + length, 0, total - length);
+			if (call->data_file) {
+				for (size_t position = 0; position < call->data_length;) {
+					ssize_t count = pread(call->data_fd, buffer + length + position,
+										  call->data_length - position, call->data_offset + position);
+					if (count < 0 && errno == EINTR) { continue; }
+					if (count <= 0) { break; }
+					position += count;
+				}
+			}
+			else { memcpy(buffer + length, call->data, call->data_length); }
+			length = total;
+			call->data = NULL;
+			call->data_length = 0;
+			call->data_file = false;
+		}
+
+		if (parked) { // keep the reply until the client tries again
+			if (call->parked) { kfsreplycache_finish(call->parked, buffer, length); }
+			call->parked = NULL;
+		} else {
+			if (call->cached) {
+				kfsreplycache_finish(call->cached, buffer, length);
+				call->cached = NULL;
+			}
+			if (call->data_file) {
+				success = send_record_file(call->connection, buffer, length,
+										   call->data_fd, call->data_offset, call->data_length);
+			}
+			else { success = send_record_data(call->connection, buffer, length, call->data, call->data_length); }
+		}
+	}
+	free(buffer);
+
+	return success;
+}
+
+// replies sent by the busy function go straight to the client
+static bool_t kfscall_busy_reply(SVCXPRT *xprt, struct rpc_msg *msg);
+static bool_t kfscall_busy_reply(SVCXPRT *xprt, struct rpc_msg *msg) {
+	kfscall_t *call = (kfscall_t *)xprt->xp_p1;
+	msg->rm_xid = call->xid;
+
+	char *buffer = NULL;
+	size_t length = 0;
+	bool_t success = encode_reply(msg, &buffer, &length);
+	if (success) {
+		if (call->cached) {
+			kfsreplycache_finish(call->cached, buffer, length);
+			call->cached = NULL;
+		}
+		success = send_record(call->connection, buffer, length);
+	}
+	free(buffer);
+
+	return success;
+}
+
+static bool_t kfscall_freeargs(SVCXPRT *xprt, xdrproc_t xdr_args, void *args_ptr);
+static bool_t kfscall_freeargs(SVCXPRT *xprt, xdrproc_t xdr_args, void *args_ptr) {
+	kfscall_t *call = (kfscall_t *)xprt->xp_p1;
+	if (call->args) { xdr_args = call->args; }
+	XDR xdrs = { .x_op = XDR_FREE };
+	return (*xdr_args)(&xdrs, args_ptr);
+}
+
+static void kfscall_destroy(SVCXPRT *xprt);
+static void kfscall_destroy(SVCXPRT *xprt) {
+	// calls are destroyed by the transport once the dispatch function returns
+}
+
+static struct xp_ops kfscall_ops = {
+	.xp_recv = kfscall_recv,
+	.xp_stat = kfscall_stat,
+	.xp_getargs = kfscall_getargs,
+	.xp_reply = kfscall_reply,
+	.xp_freeargs = kfscall_freeargs,
+	.xp_destroy = kfscall_destroy,
+};
+
+static struct xp_ops kfscall_busy_ops = {
+	.xp_recv = kfscall_recv,
+	.xp_stat = kfscall_stat,
+	.xp_getargs = kfscall_getargs,
+	.xp_reply = kfscall_busy_reply,
+	.xp_freeargs = kfscall_freeargs,
+	.xp_destroy = kfscall_destroy,
+};
+
+
+#pragma mark -
+#pragma mark connection references
+// ----------------------------------------------------------------------------------------------------
+// connection references
+// ----------------------------------------------------------------------------------------------------
+
+static void kfsconnection_retain(kfsconnection_t *connection);
+static void kfsconnection_retain(kfsconnection_t *connection) {
+	pthread_mutex_lock(&connection->lock);
+	connection->refs++;
+	pthread_mutex_unlock(&connection->lock);
+}
+
+// the socket stays open until the last call using the connection is done with
+// it so that a descriptor can't be reused out from under a worker.
+static void kfsconnection_release(kfsconnection_t *connection);
+static void kfsconnection_release(kfsconnection_t *connection) {
+	pthread_mutex_lock(&connection->lock);
+	bool last = (--connection->refs == 0);
+	pthread_mutex_unlock(&connection->lock);
+
+	if (last) {
+		close(connection->sock);
+		pthread_mutex_destroy(&connection->sendlock);
+		pthread_mutex_destroy(&connection->lock);
+		if (connection->block) { kfsblock_release(connection->block); }
+		free(connection->record);
+		free(connection);
+	}
+}
+
+
+#pragma mark -
+#pragma mark watching calls
+// ----------------------------------------------------------------------------------------------------
+// watching calls
+// ----------------------------------------------------------------------------------------------------
+
+// parked calls are found by their arguments when they're tried again, since the
+// client uses a new xid.
+static kfsreplykey_t kfscall_args_key(kfscall_t *call);
+static kfsreplykey_t kfscall_args_key(kfscall_t *call) {
+	return (kfsreplykey_t){
+		.xid = 0,
+		.program = call->request.rq_prog,
+		.version = call->request.rq_vers,
+		.procedure = call->request.rq_proc,
+		.args = call->record + call->args_offset,
+		.args_length = call->record_length - call->args_offset,
+		.idempotent = call->idempotent,
+	};
+}
+
+static void kfscall_send_busy(kfscall_t *call);
+static void kfscall_send_busy(kfscall_t *call) {
+	SVCXPRT xprt = call->xprt;
+	xprt.xp_ops = &kfscall_busy_ops;
+	struct svc_req request = call->request;
+	request.rq_xprt = &xprt;
+	call->busy(&request, &xprt);
+}
+
+static void kfscall_watch(kfscall_t *call);
+static void kfscall_watch(kfscall_t *call) {
+	struct timeval now, timeout = {
+		.tv_sec = call->timeout / 1000,
+		.tv_usec = (call->timeout % 1000) * 1000,
+	};
+	gettimeofday(&now, NULL);
+	timeradd(&now, &timeout, &call->deadline);
+
+	pthread_mutex_lock(&watchlock);
+	call->watched = true;
+	call->watch_prev = NULL;
+	call->watch_next = watched;
+	if (watched) { watched->watch_prev = call; }
+	watched = call;
+	pthread_cond_broadcast(&watchcond);
+	pthread_mutex_unlock(&watchlock);
+}
+
+// the watch lock must be held
+static void kfscall_unwatch_nolock(kfscall_t *call);
+static void kfscall_unwatch_nolock(kfscall_t *call) {
+	if (call->watched) {
+		if (call->watch_prev) { call->watch_prev->watch_next = call->watch_next; }
+		else { watched = call->watch_next; }
+		if (call->watch_next) { call->watch_next->watch_prev = call->watch_prev; }
+		call->watch_next = call->watch_prev = NULL;
+		call->watched = false;
+	}
+}
+
+// stop watching a call before it's freed. if it's being parked right now, wait
+// for that to finish since the watch thread is still using it.
+static void kfscall_unwatch(kfscall_t *call);
+static void kfscall_unwatch(kfscall_t *call) {
+	pthread_mutex_lock(&watchlock);
+	kfscall_unwatch_nolock(call);
+	while (call->parking) { pthread_cond_wait(&watchcond, &watchlock); }
+	pthread_mutex_unlock(&watchlock);
+}
+
+// tell the client to try again later, and keep the reply for when it does. the
+// call carries on as usual.
+static void kfscall_park(kfscall_t *call);
+static void kfscall_park(kfscall_t *call) {
+	kfsreplykey_t key = kfscall_args_key(call);
+	char *reply = NULL;
+	size_t reply_length = 0;
+	kfsreply_t *entry = NULL;
+	if (kfsreplycache_begin(&key, &entry, &reply, &reply_length) != KFSREPLY_NEW) {
+		free(reply);
+		return; // the same call is already parked, so this one just gets a reply
+	}
+
+	pthread_mutex_lock(&watchlock);
+	bool waiting = (call->replied == KFSCALL_WAITING);
+	if (waiting) {
+		call->replied = KFSCALL_PARKED;
+		call->parked = entry;
+	}
+	pthread_mutex_unlock(&watchlock);
+
+	if (waiting) { kfscall_send_busy(call); }
+	else { kfsreplycache_finish(entry, NULL, 0); }
+}
+
+
+#pragma mark -
+#pragma mark calls
+// ----------------------------------------------------------------------------------------------------
+// calls
+// ----------------------------------------------------------------------------------------------------
+
+static void kfscall_perform(kfsjob_t *job);
+
+static void kfscall_submit(kfscall_t *call);
+static void kfscall_submit(kfscall_t *call) {
+	if (call->queue) { kfsqueue_submit(call->queue, &call->job); }
+	else { kfspool_submit(pool, &call->job); }
+}
+
+// find the queue for the filesystem the call is for. calls that aren't for a
+// filesystem (or that are for one that's been unmounted) use the default queue.
+static kfsqueue_t *kfscall_route(kfscall_t *call, kfsroute_t *route);
+static kfsqueue_t *kfscall_route(kfscall_t *call, kfsroute_t *route) {
+	*route = (kfsroute_t){ .filesystem = -1, .lane = KFSLANE_METADATA, .idempotent = true };
+	for (int i = 0; i < program_count; i++) {
+		if (programs[i].program == call->request.rq_prog &&
+			programs[i].version == call->request.rq_vers &&
+			programs[i].route) { programs[i].route(&call->request, &call->xdrs, route); }
+	}
+	call->args = route->args;
+
+	kfsdispatch_f busy = NULL;
+	for (int i = 0; i < program_count; i++) {
+		if (programs[i].program == call->request.rq_prog &&
+			programs[i].version == call->request.rq_vers) { busy = programs[i].busy; }
+	}
+
+	kfsid_t identifier = route->filesystem;
+	kfslane_t lane = route->lane;
+	const kfsfilesystem_t *filesystem = NULL;
+	if (identifier >= 0 && identifier < MAX_FIELSYSTEMS) { filesystem = kfstable_get(identifier); }
+	if (filesystem == NULL) { return NULL; }
+
+	if (busy) {
+		call->busy = busy;
+		call->timeout = filesystem->options.busy_timeout;
+	}
+
+	// a filesystem's queues share one limit, so calls in every lane count against
+	// it. identifiers are reused, so the limit may have changed since last time.
+	unsigned int limit = filesystem->options.concurrency ? filesystem->options.concurrency : DEFAULT_CONCURRENCY;
+	kfsqueue_t *other = NULL;
+	for (int i = 0; i < KFSLANE_COUNT; i++) {
+		if (queues[identifier][i]) { other = queues[identifier][i]; }
+	}
+	if (other && limits[identifier] != limit) { kfsqueue_set_limit(other, limit); }
+	limits[identifier] = limit;
+	if (queues[identifier][lane] == NULL) {
+		queues[identifier][lane] = other ?
+			kfsqueue_create_shared(other, lane) :
+			kfsqueue_create(pool, lane, limit);
+	}
+
+	return queues[identifier][lane];
+}
+
+static kfscall_t *kfscall_create(kfsconnection_t *connection, char *record, size_t length, kfsblock_t *block);
+static kfscall_t *kfscall_create(kfsconnection_t *connection, char *record, size_t length, kfsblock_t *block) {
+	kfscall_t *call = calloc(1, sizeof(kfscall_t));
+	call->job.perform = kfscall_perform;
+	call->connection = connection;
+	call->record = record;
+	call->record_length = length;
+	call->block = block;
+
+	struct rpc_msg msg = {};
+	msg.rm_call.cb_cred.oa_base = call->credentials;
+	msg.rm_call.cb_verf.oa_base = call->credentials + MAX_AUTH_BYTES;
+
+	xdrmem_create(&call->xdrs, record, (u_int)length, XDR_DECODE);
+	if (!xdr_callmsg(&call->xdrs, &msg) ||
+		msg.rm_direction != CALL ||
+		msg.rm_call.cb_rpcvers != RPC_MSG_VERSION) {
+		XDR_DESTROY(&call->xdrs);
+		free(call);
+		return NULL;
+	}
+
+	call->xid = msg.rm_xid;
+	call->args_offset = XDR_GETPOS(&call->xdrs);
+	call->xprt.xp_sock = connection->sock;
+	call->xprt.xp_ops = &kfscall_ops;
+	call->xprt.xp_verf = _null_auth;
+	call->xprt.xp_p1 = (void *)call;
+	call->request.rq_prog = msg.rm_call.cb_prog;
+	call->request.rq_vers = msg.rm_call.cb_vers;
+	call->request.rq_proc = msg.rm_call.cb_proc;
+	call->request.rq_cred = msg.rm_call.cb_cred;
+	call->request.rq_clntcred = NULL;
+	call->request.rq_xprt = &call->xprt;
+
+	kfsconnection_retain(connection);
+	if (block) { kfsblock_retain(block); }
+
+	return call;
+}
+
+static void kfscall_free(kfscall_t *call);
+static void kfscall_free(kfscall_t *call) {
+	kfsconnection_t *connection = call->connection;
+	XDR_DESTROY(&call->xdrs);
+	if (call->block) { kfsblock_release(call->block); }
+	else { free(call->record); }
+	free(call);
+	kfsconnection_release(connection);
+}
+
+// finish a call once its reply has been sent (or dropped). nothing allocated for
+// the call is referenced any longer.
+static void kfscall_finish(kfscall_t *call);
+static void kfscall_finish(kfscall_t *call) {
+	kfsconnection_t *connection = call->connection;
+	kfscall_unwatch(call);
+	if (call->parked) { kfsreplycache_finish(call->parked, NULL, 0); } // never replied to
+	if (call->cached) { kfsreplycache_finish(call->cached, NULL, 0); }
+	if (call->deferred) { arena_recycle(call->arena); }
+	else { kfsarena_reset(call->arena); }
+
+	// once enough of the calls on a paused connection have finished, have the
+	// transport thread start reading from it again.
+	pthread_mutex_lock(&connection->lock);
+	connection->calls--;
+	bool resume = connection->paused && !connection->closed && connection->calls <= MAX_CALLS / 2;
+	if (resume) {
+		connection->paused = false;
+		connection->refs++;
+	}
+	pthread_mutex_unlock(&connection->lock);
+	if (resume && write(wakeup[1], &connection, sizeof(connection)) != sizeof(connection)) {
+		_errout("could not resume connection.");
+		kfsconnection_release(connection);
+	}
+
+	kfscall_free(call);
+}
+
+static void kfscall_resume(kfsjob_t *job);
+static void kfscall_resume(kfsjob_t *job) {
+	kfscall_t *call = (kfscall_t *)job;
+	call->req.resume(&call->request, call->req.state, call->req.result, call->req.error);
+	kfscall_finish(call);
+}
+
+static void kfscall_perform(kfsjob_t *job) {
+	kfscall_t *call = (kfscall_t *)job;
+	kfsconnection_t *connection = call->connection;
+	SVCXPRT *xprt = &call->xprt;
+	call->arena = arena_for_worker();
+
+	kfsdispatch_f dispatch = NULL;
+	bool program_found = false;
+	uint32_t low = UINT32_MAX;
+	uint32_t high = 0;
+	for (int i = 0; i < program_count; i++) {
+		if (programs[i].program == call->request.rq_prog) {
+			if (programs[i].version == call->request.rq_vers) { dispatch = programs[i].dispatch; }
+			if (programs[i].version < low) { low = programs[i].version; }
+			if (programs[i].version > high) { high = programs[i].version; }
+			program_found = true;
+		}
+	}
+
+	if (dispatch) { dispatch(&call->request, xprt); }
+	else if (program_found) { svcerr_progvers(xprt, low, high); }
+	else { svcerr_noprog(xprt); }
+
+	if (call->deferred) {
+		// the call keeps this worker's arena until it finishes. if the request
+		// completed before dispatch returned, resume right away. otherwise
+		// kfs_complete will hand the call back to the pool.
+		pthread_setspecific(arenakey, NULL);
+
+		pthread_mutex_lock(&connection->lock);
+		call->dispatched = true;
+		bool completed = call->completed;
+		pthread_mutex_unlock(&connection->lock);
+
+		if (completed) { kfscall_resume(job); }
+	}
+	else { kfscall_finish(call); }
+}
+
+
+#pragma mark -
+#pragma mark connections
+// ----------------------------------------------------------------------------------------------------
+// connections
+// ----------------------------------------------------------------------------------------------------
+
+static void kfsconnection_accept(int listener);
+static void kfsconnection_accept(int listener) {
+	while (true) {
+		int sock = accept(listener, NULL, NULL);
+		if (sock < 0) {
+			if (errno == EINTR) { continue; }
+			if (errno != EAGAIN && errno != ECONNABORTED) { _errout("accept failed."); }
+			return;
+		}
+
+#ifdef SO_NOSIGPIPE
+		setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &(int){1}, sizeof(int));
+#endif
+		set_nonblocking(sock);
+
+		kfsconnection_t *connection = calloc(1, sizeof(kfsconnection_t));
+		connection->sock = sock;
+		connection->refs = 1; // released by the transport thread when the connection closes
+		pthread_mutex_init(&connection->lock, NULL);
+		pthread_mutex_init(&connection->sendlock, NULL);
+
+		if (!events_add(sock, connection)) {
+			_errout("could not watch connection.");
+			kfsconnection_release(connection);
+		}
+	}
+}
+
+static void kfsconnection_close(kfsconnection_t *connection);
+static void kfsconnection_close(kfsconnection_t *connection) {
+	// calls still being performed hold on to the connection. their replies
+	// will fail to send, which is fine since there's no one to receive them.
+	pthread_mutex_lock(&connection->lock);
+	connection->closed = true;
+	pthread_mutex_unlock(&connection->lock);
+	events_remove(connection->sock);
+	shutdown(connection->sock, SHUT_RDWR);
+	kfsconnection_release(connection);
+}
+
+// a record is either in the block it was read into, or (when it came in more
+// than one fragment) was allocated and is owned by the call.
+static void kfsconnection_received(kfsconnection_t *connection, char *record, size_t length, kfsblock_t *block);
+static void kfsconnection_received(kfsconnection_t *connection, char *record, size_t length, kfsblock_t *block) {
+	kfscall_t *call = kfscall_create(connection, record, length, block);
+	if (call == NULL) { // garbage, there's no one to reply to
+		if (block == NULL) { free(record); }
+		return;
+	}
+
+	kfsroute_t route;
+	call->queue = kfscall_route(call, &route);
+	call->idempotent = route.idempotent;
+
+	// a call that was parked earlier is being tried again (with a new xid). if
+	// the original has finished, send its reply. otherwise ask again later.
+	if (call->timeout) {
+		kfsreplykey_t key = kfscall_args_key(call);
+		char *reply = NULL;
+		size_t reply_length = 0;
+		kfsreplystate_t state = kfsreplycache_take(&key, &reply, &reply_length);
+		if (state != KFSREPLY_NEW) {
+			if (state == KFSREPLY_DONE) {
+				uint32_t xid = htonl(call->xid);
+				memcpy(reply, &xid, sizeof(xid));
+				send_record(connection, reply, reply_length);
+			}
+			else { kfscall_send_busy(call); }
+			free(reply);
+			kfscall_free(call);
+			return;
+		}
+	}
+
+	// a call that's being retransmitted is either answered with the reply that
+	// was already sent or ignored until the original finishes.
+	if (!route.idempotent) {
+		char *reply = NULL;
+		size_t reply_length = 0;
+		kfsreplykey_t key = {
+			.xid = call->xid,
+			.program = call->request.rq_prog,
+			.version = call->request.rq_vers,
+			.procedure = call->request.rq_proc,
+		};
+		kfsreplystate_t state = kfsreplycache_begin(&key, &call->cached, &reply, &reply_length);
+		if (state != KFSREPLY_NEW) {
+			if (state == KFSREPLY_DONE) { send_record(connection, reply, reply_length); }
+			free(reply);
+			kfscall_free(call);
+			return;
+		}
+
+		// the call changes something, so parked reads may no longer be right
+		kfsreplycache_changed();
+	}
+
+	// every call is handed to the pool right away and replied to as soon as it
+	// completes (clients match replies to calls by xid), so a slow call doesn't
+	// hold up the ones read after it. if too many calls are in flight, stop
+	// reading from the connection until some of them finish.
+	pthread_mutex_lock(&connection->lock);
+	connection->calls++;
+	if (connection->calls >= MAX_CALLS && !connection->paused) {
+		connection->paused = true;
+		events_remove(connection->sock);
+	}
+	pthread_mutex_unlock(&connection->lock);
+
+	if (call->timeout) { kfscall_watch(call); }
+	kfscall_submit(call);
+}
+
+static bool kfsconnection_paused(kfsconnection_t *connection);
+static bool kfsconnection_paused(kfsconnection_t *connection) {
+	pthread_mutex_lock(&connection->lock);
+	bool paused = connection->paused;
+	pthread_mutex_unlock(&connection->lock);
+	return paused;
+}
+
+// pull every complete fragment out of the block. a record that's a single
+// fragment (nearly all of them) is dispatched right where it is. otherwise its
+// fragments are joined until the last one arrives.
+static bool kfsconnection_parse(kfsconnection_t *connection);
+static bool kfsconnection_parse(kfsconnection_t *connection) {
+	kfsblock_t *block = connection->block;
+	bool valid = true;
+	if (block == NULL) { return valid; }
+	while (valid && block->length - connection->position >= sizeof(uint32_t) && !kfsconnection_paused(connection)) {
+		char *position = block->data + connection->position;
+		uint32_t mark = 0;
+		memcpy(&mark, position, sizeof(mark));
+		mark = ntohl(mark);
+
+		bool last = (mark & RECORD_LAST_FRAG) != 0;
+		size_t fragment = mark & ~RECORD_LAST_FRAG;
+		if (connection->record_length + fragment > RECORD_MAX_LEN) { valid = false; break; }
+		if (block->length - connection->position - sizeof(uint32_t) < fragment) { break; }
+
+		position += sizeof(uint32_t);
+		connection->position += sizeof(uint32_t) + fragment;
+
+		if (last && connection->record_length == 0) {
+			kfsconnection_received(connection, position, fragment, block);
+		} else {
+			connection->record = realloc(connection->record, connection->record_length + fragment);
+			memcpy(connection->record + connection->record_length, position, fragment);
+			connection->record_length += fragment;
+			if (last) {
+				kfsconnection_received(connection, connection->record, connection->record_length, NULL);
+				connection->record = NULL;
+				connection->record_length = 0;
+			}
+		}
+	}
+
+	return valid;
+}
+
+// make room to read into. once no calls are using the block it's reused from
+// the start. otherwise the part that hasn't been parsed yet is moved to a new one,
+// big enough to hold the whole fragment that's been started (so large writes are
+// still decoded in place).
+static void kfsconnection_reserve(kfsconnection_t *connection);
+static void kfsconnection_reserve(kfsconnection_t *connection) {
+	kfsblock_t *block = connection->block;
+	if (block && block->length == connection->position && kfsblock_unshared(block)) {
+		block->length = 0;
+		connection->position = 0;
+	}
+
+	size_t pending = block ? block->length - connection->position : 0;
+	size_t wanted = RECEIVE_CHUNK_LEN;
+	if (pending >= sizeof(uint32_t)) {
+		uint32_t mark = 0;
+		memcpy(&mark, block->data + connection->position, sizeof(mark));
+		size_t fragment = sizeof(uint32_t) + (ntohl(mark) & ~RECORD_LAST_FRAG);
+		if (fragment <= RECORD_MAX_LEN + sizeof(uint32_t) && fragment - pending > wanted) { wanted = fragment - pending; }
+	}
+
+	if (block == NULL || block->capacity - block->length < wanted) {
+		size_t capacity = pending + wanted;
+		if (capacity < RECEIVE_BLOCK_LEN - sizeof(kfsblock_t)) { capacity = RECEIVE_BLOCK_LEN - sizeof(kfsblock_t); }
+		kfsblock_t *next = kfsblock_create(capacity);
+		if (block) {
+			next->length = block->length - connection->position;
+			memcpy(next->data, block->data + connection->position, next->length);
+			kfsblock_release(block);
+		}
+		connection->block = next;
+		connection->position = 0;
+	}
+}
+
+static void kfsconnection_readable(kfsconnection_t *connection);
+static void kfsconnection_readable(kfsconnection_t *connection) {
+	// read whatever is available (up to a limit so other connections get a
+	// turn) and dispatch all of the records that are now complete.
+	bool open = true;
+	size_t received = 0;
+	while (open && received < RECEIVE_WAKEUP_LEN && !kfsconnection_paused(connection)) {
+		kfsconnection_reserve(connection);
+
+		kfsblock_t *block = connection->block;
+		ssize_t count = read(connection->sock, block->data + block->length, block->capacity - block->length);
+		if (count > 0) {
+			block->length += count;
+			received += count;
+			open = kfsconnection_parse(connection);
+		}
+		else if (count < 0 && errno == EINTR) { continue; }
+		else if (count < 0 && errno == EAGAIN) { break; }
+		else { open = false; } // closed by the client or unreadable
+	}
+
+	if (!open) { kfsconnection_close(connection); }
+}
+
+// start reading from a connection that was paused. records that were read before
+// it paused are dispatched first, since the client may not send anything more
+// until they're replied to.
+static void kfsconnection_resume(kfsconnection_t *connection);
+static void kfsconnection_resume(kfsconnection_t *connection) {
+	pthread_mutex_lock(&connection->lock);
+	bool closed = connection->closed;
+	pthread_mutex_unlock(&connection->lock);
+
+	if (!closed) {
+		if (!kfsconnection_parse(connection)) { kfsconnection_close(connection); }
+		else if (!kfsconnection_paused(connection) && !events_add(connection->sock, connection)) {
+			_errout("could not watch connection.");
+			kfsconnection_close(connection);
+		}
+	}
+	kfsconnection_release(connection); // the reference taken to resume it
+}
+
+static void kfsconnection_wakeup(void);
+static void kfsconnection_wakeup(void) {
+	kfsconnection_t *connection = NULL;
+	while (read(wakeup[0], &connection, sizeof(connection)) == sizeof(connection)) {
+		kfsconnection_resume(connection);
+	}
+}
+
+
+#pragma mark -
+#pragma mark running the transport
+// ----------------------------------------------------------------------------------------------------
+// running the transport
+// ----------------------------------------------------------------------------------------------------
+
+static void *kfstransport_run(int *listener);
+static void *kfstransport_run(int *listener) {
+	kfsevent_t list[MAX_EVENTS];
+	while (true) {
+		int count = events_wait(list, MAX_EVENTS);
+		if (count < 0) {
+			if (errno != EINTR) { _errout("waiting for events failed."); }
+			continue;
+		}
+
+		// connections are resumed after the rest of the events, since resuming one
+		// can close it and it may still be in the list.
+		bool woken = false;
+		for (int i = 0; i < count; i++) {
+			void *data = kfsevent_data(&list[i]);
+			if (data == wakeup) { woken = true; }
+			else if (data) { kfsconnection_readable(data); }
+			else { kfsconnection_accept(*listener); }
+		}
+		if (woken) { kfsconnection_wakeup(); }
+	}
+
+	return NULL; // should never reach here
+}
+
+// park calls that haven't been replied to by their deadline
+static void *kfstransport_watch(void *unused);
+static void *kfstransport_watch(void *unused) {
+	pthread_mutex_lock(&watchlock);
+	while (true) {
+		struct timeval now;
+		gettimeofday(&now, NULL);
+
+		kfscall_t *expired = NULL;
+		kfscall_t *next = NULL;
+		for (kfscall_t *call = watched; call && !expired; call = call->watch_next) {
+			if (!timercmp(&call->deadline, &now, >)) { expired = call; }
+			else if (next == NULL || timercmp(&call->deadline, &next->deadline, <)) { next = call; }
+		}
+
+		if (expired) {
+			kfscall_unwatch_nolock(expired);
+			if (expired->replied == KFSCALL_WAITING) {
+				expired->parking = true;
+				pthread_mutex_unlock(&watchlock);
+				kfscall_park(expired);
+				pthread_mutex_lock(&watchlock);
+				expired->parking = false;
+				pthread_cond_broadcast(&watchcond);
+			}
+		}
+		else if (next) {
+			struct timespec deadline = {
+				.tv_sec = next->deadline.tv_sec,
+				.tv_nsec = next->deadline.tv_usec * 1000,
+			};
+			pthread_cond_timedwait(&watchcond, &watchlock, &deadline);
+		}
+		else { pthread_cond_wait(&watchcond, &watchlock); }
+	}
+	pthread_mutex_unlock(&watchlock);
+
+	return NULL; // should never reach here
+}
+
+
+#pragma mark -
+#pragma mark function implementation
+// ----------------------------------------------------------------------------------------------------
+// function implementation
+// ----------------------------------------------------------------------------------------------------
+
+bool kfstransport_register(uint32_t program, uint32_t version, kfsdispatch_f dispatch, kfsroute_f route, kfsdispatch_f busy) {
+	bool success = false;
+	if (program_count < MAX_PROGRAMS) {
+		programs[program_count].program = program;
+		programs[program_count].version = version;
+		programs[program_count].dispatch = dispatch;
+		programs[program_count].route = route;
+		programs[program_count].busy = busy;
+		program_count++;
+		success = true;
+	}
+	return success;
+}
+
+void *kfstransport_alloc(struct svc_req *rqstp, size_t size) {
+	kfscall_t *call = (kfscall_t *)rqstp->rq_xprt->xp_p1;
+	return kfsarena_alloc(call->arena, size);
+}
+
+bool kfstransport_sendreply_data(struct svc_req *rqstp, xdrproc_t xdr_result, void *result, const char *data, size_t length) {
+	kfscall_t *call = (kfscall_t *)rqstp->rq_xprt->xp_p1;
+	call->data = data;
+	call->data_length = length;
+	bool success = svc_sendreply(rqstp->rq_xprt, xdr_result, (caddr_t)result);
+	call->data = NULL;
+	call->data_length = 0;
+	return success;
+}
+
+bool kfstransport_sendreply_file(struct svc_req *rqstp, xdrproc_t xdr_result, void *result, int fd, off_t offset, size_t length) {
+	// only regular files can be sent from directly. anything else is read first.
+	struct stat info;
+	if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+		char *data = kfstransport_alloc(rqstp, length);
+		size_t position = 0;
+		while (position < length) {
+			ssize_t count = pread(fd, data + position, length - position, offset + position);
+			if (count < 0 && errno == EINTR) { continue; }
+			if (count <= 0) { break; }
+			position += count;
+		}
+		return kfstransport_sendreply_data(rqstp, xdr_result, result, data, length);
+	}
+
+	kfscall_t *call = (kfscall_t *)rqstp->rq_xprt->xp_p1;
+	call->data = ""; // anything but NULL
+	call->data_length = length;
+	call->data_file = true;
+	call->data_fd = fd;
+	call->data_offset = offset;
+	bool success = svc_sendreply(rqstp->rq_xprt, xdr_result, (caddr_t)result);
+	call->data = NULL;
+	call->data_length = 0;
+	call->data_file = false;
+	return success;
+}
+
+kfsreq_t *kfstransport_defer(struct svc_req *rqstp, kfsresume_f resume, void *state) {
+	kfscall_t *call = (kfscall_t *)rqstp->rq_xprt->xp_p1;
+	call->deferred = true;
+	call->req.call = call;
+	call->req.resume = resume;
+	call->req.state = state;
+	return &call->req;
+}
+
+void kfs_complete(kfsreq_t *req, ssize_t result, int error) {
+	kfscall_t *call = req->call;
+	kfsconnection_t *connection = call->connection;
+	req->result = result;
+	req->error = error;
+
+	pthread_mutex_lock(&connection->lock);
+	call->completed = true;
+	bool dispatched = call->dispatched;
+	pthread_mutex_unlock(&connection->lock);
+
+	// don't run the rest of the call on the caller's thread (it's likely one
+	// the filesystem uses to talk to its store).
+	if (dispatched) {
+		call->job.perform = kfscall_resume;
+		kfscall_submit(call);
+	}
+}
+
+bool kfstransport_start(int sock, kfspool_t *workers) {
+	static int listener = -1;
+	if ((events = events_create()) < 0) {
+		_errout("could not create event queue.");
+		return false;
+	}
+
+	// the listener is the only thing watched without a connection
+	set_nonblocking(sock);
+	if (!events_add(sock, NULL)) {
+		_errout("could not watch listener.");
+		return false;
+	}
+
+	if (pipe(wakeup) != 0 || !set_nonblocking(wakeup[0]) || !events_add(wakeup[0], wakeup)) {
+		_errout("could not watch for connections to resume.");
+		return false;
+	}
+
+	pool = workers;
+	listener = sock;
+
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, (void *(*)(void *))kfstransport_run, &listener) != 0) {
+		_errout("pthread_create failed.");
+		return false;
+	}
+	pthread_detach(thread);
+
+	if (pthread_create(&thread, NULL, (void *(*)(void *))kfstransport_watch, NULL) != 0) {
+		_errout("pthread_create failed.");
+		return false;
+	}
+	pthread_detach(thread);
+
+	return true;
+}
@@ -0,0 +1,117 @@
+//
+//  transport.h
+//  KFS
+//
+//  Copyright (c) 2012, FadingRed LLC
+//  All rights reserved.
+//  
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+//  following conditions are met:
+//  
+//    - Redistributions of source code must retain the above copyright notice, this list of conditions and the
+//      following disclaimer.
+//    - Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+//      following disclaimer in the documentation and/or other materials provided with the distribution.
+//    - Neither the name of the FadingRed LLC nor the names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior written permission.
+//  
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+//  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _KFSTRANSPORT_H_
+#define _KFSTRANSPORT_H_
+
+#include <rpc/rpc.h>
+#include "threadpool.h"
+
+typedef void (*kfsdispatch_f)(struct svc_req *rqstp, SVCXPRT *transp);
+typedef struct {
+	kfsid_t filesystem;	// the filesystem the call is for, or -1
+	kfslane_t lane;
+	bool idempotent;	// false if performing the call twice could differ from performing it once
+	xdrproc_t args;		// decodes (and frees) the arguments in place of the program's decoder, or NULL
+} kfsroute_t;
+
+typedef void (*kfsroute_f)(struct svc_req *rqstp, XDR *xdrs, kfsroute_t *route);
+typedef void (*kfsresume_f)(struct svc_req *rqstp, void *state, ssize_t result, int error);
+
+/*!
+ \brief		Register a program
+ \details	Register the dispatch function for a program and version. Calls for the program
+			are dispatched on the worker pool with a transport that supports svc_getargs,
+			svc_sendreply, svc_freeargs and the svcerr functions. This must be called
+			before the transport is started.
+			
+			The route function (which may be NULL) is called on the transport thread with
+			the undecoded arguments of each call, and describes the call. Each filesystem
+			has its own queue in each lane of the pool, limited by its concurrency option,
+			so a slow filesystem can't hold up calls for the others. Replies to calls that
+			aren't idempotent are cached, and a retransmitted call is answered from the
+			cache (or ignored while the original is still being performed) rather than
+			being performed again. The stream must be left where it was found.
+			
+			Calls are decoded from the memory they were received into, which stays valid
+			until the call finishes, so a route may give an args decoder that points into
+			the stream (with xdr_inline) rather than copying large opaque data.
+			
+			The busy function (which may be NULL) sends a reply that tells the client to
+			try the call again later. When a call for a filesystem with a busy timeout has
+			not been replied to in time, it's sent in place of the reply, and the call keeps
+			going. Its reply is kept for a few seconds and sent when the client tries the same
+			call again (unless the call is idempotent and something has changed since).
+ */
+bool kfstransport_register(uint32_t program, uint32_t version, kfsdispatch_f dispatch, kfsroute_f route, kfsdispatch_f busy);
+
+/*!
+ \brief		Start the transport
+ \details	Starts a thread that runs an event loop (kqueue, or epoll on Linux) which
+			accepts connections on the given (bound and listening) socket, reassembles
+			RPC records from everything available on each connection, and hands the
+			decoded calls to the workers in the pool. Returns false if the transport
+			could not be started.
+ */
+bool kfstransport_start(int sock, kfspool_t *pool);
+
+/*!
+ \brief		Allocate memory for a call
+ \details	Allocates zeroed memory for use while handling a call. The memory remains
+			valid until the reply has been sent, so results and any buffers they
+			reference can be allocated here. It must not be freed.
+ */
+void *kfstransport_alloc(struct svc_req *rqstp, size_t size);
+
+/*!
+ \brief		Send a reply that ends with data
+ \details	Like svc_sendreply, for results whose last field is variable length opaque data.
+			The result must be given with that field empty. The data is sent from where it is,
+			after the rest of the reply and with the same write, rather than being copied into
+			the encoded reply. Pass NULL data to send the result as it is.
+ */
+bool kfstransport_sendreply_data(struct svc_req *rqstp, xdrproc_t xdr_result, void *result, const char *data, size_t length);
+
+/*!
+ \brief		Send a reply that ends with data from a file
+ \details	Like kfstransport_sendreply_data, but the data is length bytes of the file at
+			offset, which are sent straight from the file to the socket (with sendfile) after
+			the rest of the reply. The file must stay open until this returns.
+ */
+bool kfstransport_sendreply_file(struct svc_req *rqstp, xdrproc_t xdr_result, void *result, int fd, off_t offset, size_t length);
+
+/*!
+ \brief		Defer the reply for a call
+ \details	Keeps the call (and everything allocated for it) alive after the dispatch
+			function returns. The procedure must then return NULL so that no reply is
+			sent. Once kfs_complete is called with the returned request, resume is called
+			on a worker with the result and error, and it should send the reply. Arguments
+			are freed when the dispatch function returns, so anything resume needs must
+			be kept in state.
+ */
+kfsreq_t *kfstransport_defer(struct svc_req *rqstp, kfsresume_f resume, void *state);
+
+#endif
@@ -0,0 +1,456 @@
+//
+//  writeback.c
+//  KFS
+//
+//  Copyright (c) 2012, FadingRed LLC
+//  All rights reserved.
+//  
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+//  following conditions are met:
+//  
+//    - Redistributions of source code must retain the above copyright notice, this list of conditions and the
+//      following disclaimer.
+//    - Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+//      following disclaimer in the documentation and/or other materials provided with the distribution.
+//    - Neither the name of the FadingRed LLC nor the names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior written permission.
+//  
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+//  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+#include "writeback.h"
+#include "internal.h"
+#include "fileid.h"
+#include "handlecache.h"
+#include "attrcache.h"
+#include "readahead.h"
+#include "blockcache.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#define WRITEBACK_BUCKETS	256
+#define WRITEBACK_MAX_TOTAL	0x4000000	/* 64M buffered for all files before the oldest is written */
+#define WRITEBACK_DELAY		2000		/* milliseconds data is kept before it's written */
+#define WRITEBACK_MAX_RUNS	64			/* separate runs of data buffered per file */
+
+// a run of data to be written at offset. runs don't overlap or touch, since
+// writes that would make them are merged.
+typedef struct kfsrun kfsrun_t;
+struct kfsrun {
+	uint64_t offset;
+	size_t length;
+	size_t capacity;
+	char *data;
+	kfsrun_t *next;			// ordered by offset
+};
+
+typedef struct kfsdirty kfsdirty_t;
+struct kfsdirty {
+	kfsid_t identifier;
+	uint64_t fileid;
+	char *path;
+	kfsrun_t *runs;
+	unsigned int count;		// number of runs
+	size_t length;			// bytes in all runs
+	uint64_t end;			// end of data that's buffered or being written
+	uint64_t dirtied;		// in milliseconds
+	int error;				// from a failed write, reported by the next commit
+	bool flushing;			// data taken from the entry is being written
+	int refs;				// held while the lock is let go
+	kfsdirty_t *chain;		// next in the bucket
+	kfsdirty_t *older;		// entries with data, least recently dirtied first
+	kfsdirty_t *newer;
+};
+
+static kfsdirty_t *buckets[WRITEBACK_BUCKETS];
+static kfsdirty_t *oldest = NULL;
+static kfsdirty_t *newest = NULL;
+static size_t total = 0;
+static uint64_t verifier = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flushed = PTHREAD_COND_INITIALIZER;
+static pthread_once_t sweeponce = PTHREAD_ONCE_INIT;
+
+
+#pragma mark -
+#pragma mark entries
+// ----------------------------------------------------------------------------------------------------
+// entries
+// ----------------------------------------------------------------------------------------------------
+
+static uint64_t kfswriteback_now(void);
+static uint64_t kfswriteback_now(void) {
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_usec / 1000;
+}
+
+static kfsdirty_t **kfswriteback_bucket(kfsid_t identifier, uint64_t fileid);
+static kfsdirty_t **kfswriteback_bucket(kfsid_t identifier, uint64_t fileid) {
+	uint64_t hash = (fileid * 0x9E3779B97F4A7C15ull) ^ (uint64_t)identifier;
+	return &buckets[(hash >> 32) % WRITEBACK_BUCKETS];
+}
+
+static kfsdirty_t *kfswriteback_find_nolock(kfsid_t identifier, uint64_t fileid);
+static kfsdirty_t *kfswriteback_find_nolock(kfsid_t identifier, uint64_t fileid) {
+	kfsdirty_t *entry = *kfswriteback_bucket(identifier, fileid);
+	while (entry && !(entry->identifier == identifier && entry->fileid == fileid)) {
+		entry = entry->chain;
+	}
+	if (entry) { entry->refs++; }
+	return entry;
+}
+
+static kfsdirty_t *kfswriteback_create_nolock(kfsid_t identifier, uint64_t fileid, const char *path);
+static kfsdirty_t *kfswriteback_create_nolock(kfsid_t identifier, uint64_t fileid, const char *path) {
+	kfsdirty_t *entry = calloc(1, sizeof(kfsdirty_t));
+	entry->identifier = identifier;
+	entry->fileid = fileid;
+	entry->path = strdup(path);
+	entry->refs = 1;
+
+	kfsdirty_t **bucket = kfswriteback_bucket(identifier, fileid);
+	entry->chain = *bucket;
+	*bucket = entry;
+	return entry;
+}
+
+// let go of an entry from find or create, and free it once there's nothing
+// left to do with it. the lock must be held.
+static void kfswriteback_release_nolock(kfsdirty_t *entry);
+static void kfswriteback_release_nolock(kfsdirty_t *entry) {
+	if (--entry->refs == 0 && entry->length == 0 && !entry->flushing && entry->error == 0) {
+		kfsdirty_t **link = kfswriteback_bucket(entry->identifier, entry->fileid);
+		while (*link != entry) { link = &(*link)->chain; }
+		*link = entry->chain;
+		free(entry->path);
+		free(entry);
+	}
+}
+
+static void kfswriteback_unlist_nolock(kfsdirty_t *entry);
+static void kfswriteback_unlist_nolock(kfsdirty_t *entry) {
+	if (entry->older) { entry->older->newer = entry->newer; }
+	else { oldest = entry->newer; }
+	if (entry->newer) { entry->newer->older = entry->older; }
+	else { newest = entry->older; }
+	entry->older = NULL;
+	entry->newer = NULL;
+}
+
+// take runs of at least minimum length out of the entry (all of them for a
+// minimum of 0). the caller frees them.
+static kfsrun_t *kfswriteback_take_nolock(kfsdirty_t *entry, size_t minimum);
+static kfsrun_t *kfswriteback_take_nolock(kfsdirty_t *entry, size_t minimum) {
+	kfsrun_t *taken = NULL;
+	kfsrun_t **tail = &taken;
+	for (kfsrun_t **link = &entry->runs; *link;) {
+		kfsrun_t *run = *link;
+		if (run->length >= minimum) {
+			*link = run->next;
+			run->next = NULL;
+			*tail = run;
+			tail = &run->next;
+			entry->count--;
+			entry->length -= run->length;
+			total -= run->length;
+		}
+		else { link = &run->next; }
+	}
+	if (taken && entry->runs == NULL) { kfswriteback_unlist_nolock(entry); }
+	return taken;
+}
+
+static void kfswriteback_free_runs(kfsrun_t *runs);
+static void kfswriteback_free_runs(kfsrun_t *runs) {
+	while (runs) {
+		kfsrun_t *next = runs->next;
+		free(runs->data);
+		free(runs);
+		runs = next;
+	}
+}
+
+// put data in the entry, merging it with any runs it overlaps or touches so
+// that sequential writes end up in a single run. returns the run it's in.
+static kfsrun_t *kfswriteback_merge_nolock(kfsdirty_t *entry, const char *buf, uint64_t offset, size_t length);
+static kfsrun_t *kfswriteback_merge_nolock(kfsdirty_t *entry, const char *buf, uint64_t offset, size_t length) {
+	kfsrun_t **link = &entry->runs;
+	while (*link && (*link)->offset + (*link)->length < offset) { link = &(*link)->next; }
+
+	kfsrun_t *run = *link;
+	if (run == NULL || run->offset > offset + length) { // nothing to merge with
+		run = calloc(1, sizeof(kfsrun_t));
+		run->offset = offset;
+		run->next = *link;
+		*link = run;
+		entry->count++;
+	}
+
+	// the run grows to cover the data and every run after it that the data reaches
+	uint64_t start = (offset < run->offset) ? offset : run->offset;
+	uint64_t end = run->offset + run->length;
+	if (offset + length > end) { end = offset + length; }
+	for (kfsrun_t *next = run->next; next && next->offset <= end; next = next->next) {
+		if (next->offset + next->length > end) { end = next->offset + next->length; }
+	}
+
+	size_t needed = (size_t)(end - start);
+	size_t shift = (size_t)(run->offset - start);
+	if (needed > run->capacity) {
+		size_t capacity = run->capacity ? run->capacity : WRITE_MAX_LEN;
+		while (capacity < needed) { capacity *= 2; }
+		run->data = realloc(run->data, capacity);
+		run->capacity = capacity;
+	}
+	if (shift) { memmove(run->data + shift, run->data, run->length); }
+	entry->length -= run->length;
+	total -= run->length;
+	run->offset = start;
+	run->length = needed;
+	while (run->next && run->next->offset <= end) {
+		kfsrun_t *next = run->next;
+		memcpy(run->data + (next->offset - start), next->data, next->length);
+		entry->length -= next->length;
+		total -= next->length;
+		entry->count--;
+		run->next = next->next;
+		free(next->data);
+		free(next);
+	}
+	memcpy(run->data + (offset - start), buf, length);
+	entry->length += run->length;
+	total += run->length;
+	return run;
+}
+
+
+#pragma mark -
+#pragma mark flushing
+// ----------------------------------------------------------------------------------------------------
+// flushing
+// ----------------------------------------------------------------------------------------------------
+
+static bool kfswriteback_write_all(kfsid_t identifier, const char *path, const char *data, uint64_t offset, size_t length, int *error);
+static bool kfswriteback_write_all(kfsid_t identifier, const char *path, const char *data, uint64_t offset, size_t length, int *error) {
+	const kfsfilesystem_t *filesystem = kfstable_get(identifier);
+	if (filesystem == NULL) {
+		*error = ENODEV;
+		return false;
+	}
+
+	kfshandle_t *handle = NULL;
+	bool success = kfshandle_acquire(identifier, filesystem, path, &handle, error);
+	for (size_t written = 0; success && written < length;) {
+		ssize_t count = filesystem->write(path, kfshandle_value(handle), data + written, offset + written,
+										  length - written, error, filesystem->context);
+		if (count <= 0) {
+			if (count == 0) { *error = EIO; }
+			success = false;
+		}
+		else { written += count; }
+	}
+	kfshandle_release(handle);
+	return success;
+}
+
+// write the entry's runs of at least minimum length (all of them for 0), waiting
+// for any write already in progress to finish first so that writes to the file
+// stay in order. the lock must be held, and is let go while writing.
+static bool kfswriteback_flush_nolock(kfsdirty_t *entry, size_t minimum, int *error);
+static bool kfswriteback_flush_nolock(kfsdirty_t *entry, size_t minimum, int *error) {
+	while (entry->flushing) { pthread_cond_wait(&flushed, &lock); }
+	kfsrun_t *runs = kfswriteback_take_nolock(entry, minimum);
+	if (runs == NULL) { return true; }
+
+	entry->flushing = true;
+	pthread_mutex_unlock(&lock);
+
+	bool success = true;
+	for (kfsrun_t *run = runs; run && success; run = run->next) {
+		success = kfswriteback_write_all(entry->identifier, entry->path, run->data, run->offset, run->length, error);
+	}
+	kfsattrcache_invalidate(entry->identifier, entry->fileid);
+	kfsreadahead_invalidate(entry->identifier, entry->fileid);
+	kfsblockcache_invalidate(entry->identifier, entry->fileid);
+	kfswriteback_free_runs(runs);
+
+	pthread_mutex_lock(&lock);
+	entry->flushing = false;
+	entry->end = 0;
+	for (kfsrun_t *run = entry->runs; run; run = run->next) { entry->end = run->offset + run->length; }
+	if (!success) {
+		// the data is gone. changing the verifier makes clients send everything
+		// they haven't seen committed again.
+		entry->error = *error;
+		verifier++;
+	}
+	pthread_cond_broadcast(&flushed);
+	return success;
+}
+
+static void *kfswriteback_sweep(void *unused);
+static void *kfswriteback_sweep(void *unused) {
+	while (true) {
+		sleep(1);
+		pthread_mutex_lock(&lock);
+		uint64_t now = kfswriteback_now();
+		while (oldest && now - oldest->dirtied >= WRITEBACK_DELAY) {
+			kfsdirty_t *entry = oldest;
+			entry->refs++;
+			kfswriteback_flush_nolock(entry, 0, &(int){0});
+			kfswriteback_release_nolock(entry);
+		}
+		pthread_mutex_unlock(&lock);
+	}
+	return NULL; // should never reach here
+}
+
+static void kfswriteback_start_sweeping(void);
+static void kfswriteback_start_sweeping(void) {
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, kfswriteback_sweep, NULL) == 0) {
+		pthread_detach(thread);
+	}
+}
+
+
+#pragma mark -
+#pragma mark function implementation
+// ----------------------------------------------------------------------------------------------------
+// function implementation
+// ----------------------------------------------------------------------------------------------------
+
+bool kfswriteback_write(kfsid_t identifier, const kfsfilesystem_t *filesystem, const char *path,
+						const char *buf, uint64_t offset, size_t length, int *error) {
+	pthread_once(&sweeponce, kfswriteback_start_sweeping);
+
+	size_t limit = (size_t)filesystem->options.writeback * 1024;
+	if (limit < kfsfilesystem_wsize(filesystem)) { limit = kfsfilesystem_wsize(filesystem); }
+	size_t chunk = (size_t)filesystem->options.write_chunk * 1024;
+	if (chunk == 0 || chunk > limit) { chunk = limit; }
+	uint64_t fileid = kfs_fileid(identifier, path);
+	bool success = true;
+
+	pthread_mutex_lock(&lock);
+	kfsdirty_t *entry = kfswriteback_find_nolock(identifier, fileid);
+	if (entry == NULL) { entry = kfswriteback_create_nolock(identifier, fileid, path); }
+
+	// write everything that's there first if there wouldn't be room, or if the
+	// writes are so scattered that they aren't worth keeping apart.
+	if (entry->length + length > limit || entry->count >= WRITEBACK_MAX_RUNS) {
+		success = kfswriteback_flush_nolock(entry, 0, error);
+	}
+
+	if (success) {
+		if (entry->runs == NULL) {
+			if (!entry->flushing && strcmp(entry->path, path) != 0) {
+				free(entry->path);
+				entry->path = strdup(path);
+			}
+			entry->dirtied = kfswriteback_now();
+			entry->older = newest;
+			if (newest) { newest->newer = entry; }
+			else { oldest = entry; }
+			newest = entry;
+		}
+
+		kfsrun_t *run = kfswriteback_merge_nolock(entry, buf, offset, length);
+		if (offset + length > entry->end) { entry->end = offset + length; }
+
+		// a run that's grown to a full chunk is written right away, so a file being
+		// written from start to end goes to the filesystem in chunks of that size.
+		if (run->length >= chunk) {
+			success = kfswriteback_flush_nolock(entry, chunk, error);
+		}
+	}
+
+	// write the files that have had data the longest while too much is buffered
+	while (total > WRITEBACK_MAX_TOTAL && oldest) {
+		kfsdirty_t *victim = oldest;
+		victim->refs++;
+		kfswriteback_flush_nolock(victim, 0, &(int){0});
+		kfswriteback_release_nolock(victim);
+	}
+
+	kfswriteback_release_nolock(entry);
+	pthread_mutex_unlock(&lock);
+	return success;
+}
+
+bool kfswriteback_flush(kfsid_t identifier, uint64_t fileid, int *error) {
+	bool success = true;
+	pthread_mutex_lock(&lock);
+	kfsdirty_t *entry = kfswriteback_find_nolock(identifier, fileid);
+	if (entry) {
+		success = kfswriteback_flush_nolock(entry, 0, error);
+		kfswriteback_release_nolock(entry);
+	}
+	pthread_mutex_unlock(&lock);
+	return success;
+}
+
+bool kfswriteback_commit(kfsid_t identifier, uint64_t fileid, int *error) {
+	bool success = true;
+	pthread_mutex_lock(&lock);
+	kfsdirty_t *entry = kfswriteback_find_nolock(identifier, fileid);
+	if (entry) {
+		success = kfswriteback_flush_nolock(entry, 0, error);
+		if (success && entry->error) {
+			*error = entry->error;
+			success = false;
+		}
+		entry->error = 0;
+		kfswriteback_release_nolock(entry);
+	}
+	pthread_mutex_unlock(&lock);
+	return success;
+}
+
+void kfswriteback_size(kfsid_t identifier, uint64_t fileid, uint64_t *size) {
+	pthread_mutex_lock(&lock);
+	kfsdirty_t *entry = kfswriteback_find_nolock(identifier, fileid);
+	if (entry) {
+		if (entry->end > *size) { *size = entry->end; }
+		kfswriteback_release_nolock(entry);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void kfswriteback_verifier(writeverf3 result) {
+	pthread_mutex_lock(&lock);
+	if (verifier == 0) { verifier = ((uint64_t)time(NULL) << 16) ^ (uint64_t)getpid(); }
+	memcpy(result, &verifier, sizeof(writeverf3));
+	pthread_mutex_unlock(&lock);
+}
+
+void kfswriteback_clear(kfsid_t identifier) {
+	pthread_mutex_lock(&lock);
+	// the lock is let go while data is written, so start over after each write
+	for (bool pending = true; pending;) {
+		pending = false;
+		for (unsigned int index = 0; index < WRITEBACK_BUCKETS && !pending; index++) {
+			for (kfsdirty_t *entry = buckets[index], *next = NULL; entry && !pending; entry = next) {
+				next = entry->chain;
+				if (entry->identifier == identifier) {
+					entry->refs++;
+					pending = (entry->length || entry->flushing);
+					if (pending) { kfswriteback_flush_nolock(entry, 0, &(int){0}); }
+					entry->error = 0;
+					kfswriteback_release_nolock(entry);
+				}
+			}
+		}
+	}
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,77 @@
+//
+//  writeback.h
+//  KFS
+//
+//  Copyright (c) 2012, FadingRed LLC
+//  All rights reserved.
+//  
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+//  following conditions are met:
+//  
+//    - Redistributions of source code must retain the above copyright notice, this list of conditions and the
+//      following disclaimer.
+//    - Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+//      following disclaimer in the documentation and/or other materials provided with the distribution.
+//    - Neither the name of the FadingRed LLC nor the names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior written permission.
+//  
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+//  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+#ifndef _KFSWRITEBACK_H_
+#define _KFSWRITEBACK_H_
+
+#include <stdbool.h>
+#include "kfslib.h"
+#include "nfs3.h"
+
+/*!
+ \brief		Buffer an unstable write
+ \details	Keeps the data to be written to the file at path later, when it's committed, when too
+			much data is buffered, or after a short delay. Writes next to each other are merged,
+			and a run of them is written as soon as it's as long as the filesystem's write_chunk
+			option. Buffered data is written with the filesystem's write callback. If data has to
+			be written here and that fails, this returns false with an error.
+ */
+bool kfswriteback_write(kfsid_t identifier, const kfsfilesystem_t *filesystem, const char *path,
+						const char *buf, uint64_t offset, size_t length, int *error);
+
+/*!
+ \brief		Write buffered data
+ \details	Writes any data buffered for a file. Call this before the file is read or changed
+			in any other way. Returns false with an error if the data couldn't be written.
+ */
+bool kfswriteback_flush(kfsid_t identifier, uint64_t fileid, int *error);
+
+/*!
+ \brief		Commit buffered data
+ \details	Like kfswriteback_flush, but also returns false with an error if buffered data for
+			the file failed to be written earlier (and forgets that error).
+ */
+bool kfswriteback_commit(kfsid_t identifier, uint64_t fileid, int *error);
+
+/*!
+ \brief		Adjust a file's size
+ \details	Increases size to include data buffered for the file past its end.
+ */
+void kfswriteback_size(kfsid_t identifier, uint64_t fileid, uint64_t *size);
+
+/*!
+ \brief		Get the write verifier
+ \details	The verifier stays the same until buffered data fails to be written, so clients know
+			to send any writes that haven't been committed again.
+ */
+void kfswriteback_verifier(writeverf3 verifier);
+
+/*!
+ \brief		Write buffered data for a filesystem
+ \details	Writes all data buffered for the filesystem and forgets about it.
+ */
+void kfswriteback_clear(kfsid_t identifier);
+
+#endif
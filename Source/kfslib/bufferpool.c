@@ -0,0 +1,109 @@
+//
+//  bufferpool.c
+//  KFS
+//
+//  Copyright (c) 2012, FadingRed LLC
+//  All rights reserved.
+//  
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+//  following conditions are met:
+//  
+//    - Redistributions of source code must retain the above copyright notice, this list of conditions and the
+//      following disclaimer.
+//    - Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+//      following disclaimer in the documentation and/or other materials provided with the distribution.
+//    - Neither the name of the FadingRed LLC nor the names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior written permission.
+//  
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+//  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "bufferpool.h"
+
+#define CLASS_MIN_SHIFT		16			/* 64K */
+#define CLASS_COUNT			7			/* up to 4M */
+#define SPARE_LEN			0x800000	/* 8M kept for each class */
+#define HEADER_LEN			16			/* keeps buffers aligned */
+
+typedef struct kfsbuffer kfsbuffer_t;
+
+// the header that precedes each buffer
+struct kfsbuffer {
+	unsigned int sizeclass;		// CLASS_COUNT for buffers too large to keep
+	kfsbuffer_t *next;			// while it's spare
+};
+
+typedef struct kfsbufferclass kfsbufferclass_t;
+
+struct kfsbufferclass {
+	pthread_mutex_t lock;
+	kfsbuffer_t *spare;
+	size_t count;
+};
+
+static kfsbufferclass_t classes[CLASS_COUNT] = {
+	{ PTHREAD_MUTEX_INITIALIZER }, { PTHREAD_MUTEX_INITIALIZER }, { PTHREAD_MUTEX_INITIALIZER },
+	{ PTHREAD_MUTEX_INITIALIZER }, { PTHREAD_MUTEX_INITIALIZER }, { PTHREAD_MUTEX_INITIALIZER },
+	{ PTHREAD_MUTEX_INITIALIZER },
+};
+
+
+#pragma mark -
+#pragma mark function implementation
+// ----------------------------------------------------------------------------------------------------
+// function implementation
+// ----------------------------------------------------------------------------------------------------
+
+void *kfsbuffer_alloc(size_t size, size_t *capacity) {
+	unsigned int sizeclass = 0;
+	while (sizeclass < CLASS_COUNT && ((size_t)1 << (CLASS_MIN_SHIFT + sizeclass)) < size) { sizeclass++; }
+	size_t length = (sizeclass < CLASS_COUNT) ? ((size_t)1 << (CLASS_MIN_SHIFT + sizeclass)) : size;
+
+	kfsbuffer_t *buffer = NULL;
+	if (sizeclass < CLASS_COUNT) {
+		kfsbufferclass_t *class = &classes[sizeclass];
+		pthread_mutex_lock(&class->lock);
+		buffer = class->spare;
+		if (buffer) {
+			class->spare = buffer->next;
+			class->count--;
+		}
+		pthread_mutex_unlock(&class->lock);
+	}
+
+	if (buffer == NULL) {
+		buffer = malloc(HEADER_LEN + length);
+		buffer->sizeclass = sizeclass;
+	}
+	if (capacity) { *capacity = length; }
+	return (char *)buffer + HEADER_LEN;
+}
+
+void kfsbuffer_free(void *data) {
+	if (data) {
+		kfsbuffer_t *buffer = (kfsbuffer_t *)((char *)data - HEADER_LEN);
+		bool kept = false;
+		if (buffer->sizeclass < CLASS_COUNT) {
+			kfsbufferclass_t *class = &classes[buffer->sizeclass];
+			size_t limit = SPARE_LEN >> (CLASS_MIN_SHIFT + buffer->sizeclass);
+			pthread_mutex_lock(&class->lock);
+			kept = (class->count < (limit ? limit : 1));
+			if (kept) {
+				buffer->next = class->spare;
+				class->spare = buffer;
+				class->count++;
+			}
+			pthread_mutex_unlock(&class->lock);
+		}
+		if (!kept) { free(buffer); }
+	}
+}
@@ -0,0 +1,48 @@
+//
+//  bufferpool.h
+//  KFS
+//
+//  Copyright (c) 2012, FadingRed LLC
+//  All rights reserved.
+//  
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+//  following conditions are met:
+//  
+//    - Redistributions of source code must retain the above copyright notice, this list of conditions and the
+//      following disclaimer.
+//    - Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+//      following disclaimer in the documentation and/or other materials provided with the distribution.
+//    - Neither the name of the FadingRed LLC nor the names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior written permission.
+//  
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+//  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+#ifndef _KFSBUFFERPOOL_H_
+#define _KFSBUFFERPOOL_H_
+
+#include "kfslib.h"
+
+/*!
+ \brief		Get a buffer
+ \details	Gets a buffer of at least size bytes (not zeroed). Buffers come in size classes
+			(powers of two from 64K to 4M), and freed buffers are kept to be reused for the
+			same class, so large buffers can be used for every call without allocating and
+			faulting in new memory each time. If capacity is given, it's set to the usable size
+			of the buffer, which may be more than was asked for. Buffers are thread safe to get
+			and free from any thread.
+ */
+void *kfsbuffer_alloc(size_t size, size_t *capacity);
+
+/*!
+ \brief		Free a buffer
+ \details	Returns a buffer from kfsbuffer_alloc to the pool. NULL is allowed.
+ */
+void kfsbuffer_free(void *buffer);
+
+#endif
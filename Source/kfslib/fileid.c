@@ -99,7 +99,7 @@ static void GetDictionariesForFilesystemWithID(kfsid_t identifier, CFMutableDict
 // function implementation
 // ----------------------------------------------------------------------------------------------------
 
-static pthread_mutex_t lock;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
 
 uint64_t kfs_fileid(kfsid_t fs, const char *path) {
 	static uint64_t id = 1;
@@ -130,6 +130,16 @@ const char *path_fromid(kfsid_t fs, uint64_t fileid) {
 	return result;
 }
 
+uint64_t fileid_frompath(kfsid_t fs, const char *path) {
+	pthread_mutex_lock(&lock);
+	CFMutableDictionaryRef idMap = NULL;
+	CFMutableDictionaryRef pathMap = NULL;
+	GetDictionariesForFilesystemWithID(fs, &idMap, &pathMap);
+	uint64_t result = (uint64_t)(uintptr_t)CFDictionaryGetValue(pathMap, path);
+	pthread_mutex_unlock(&lock);
+	return result;
+}
+
 void kfs_idswap(kfsid_t fs, uint64_t id_one, uint64_t id_two) {
 	const char *path_one = path_fromid(fs, id_one);
 	const char *path_two = path_fromid(fs, id_two);
@@ -47,6 +47,14 @@ void kfs_idswap(kfsid_t filesystem, uint64_t id_one, uint64_t id_two);
  */
 const char *path_fromid(kfsid_t filesystem, uint64_t fileid);
 
+/*!
+ \brief		Gets a file id from a path
+ \details	Gets the file id of a path, like kfs_fileid, but only if
+			the path has already been registered. Returns 0 when
+			it hasn't, rather than making a new id.
+ */
+uint64_t fileid_frompath(kfsid_t filesystem, const char *path);
+
 /*!
  \brief		Clear all ids for the filesystem
  \details	Remove all ids for the filesystem (useful to reclaim
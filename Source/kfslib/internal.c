@@ -31,7 +31,6 @@
 
 #include "internal.h"
 
-#define MAX_FIELSYSTEMS 1024
 
 #pragma mark -
 #pragma mark default implementation
@@ -59,7 +58,7 @@ static kfsfilesystem_t *kfsfilesystem_duplicate(const kfsfilesystem_t *filesyste
 static void kfsfilesystem_free(kfsfilesystem_t *filesystem);
 
 static kfsfilesystem_t *table[MAX_FIELSYSTEMS];
-static pthread_mutex_t tablelock;
+static pthread_mutex_t tablelock = PTHREAD_MUTEX_INITIALIZER;
 
 static kfsid_t kfstable_newidentifier_nolock(void) {
 	static kfsid_t number = 0;
@@ -99,6 +98,9 @@ static kfsid_t kfstable_put_nolock(const kfsfilesystem_t *filesystem) {
 	if (identifier >= 0) {
 		if (kfstable_get_nolock(identifier) == NULL) {
 			table[identifier] = kfsfilesystem_duplicate(filesystem);
+			// buffered writes are written later with write, so a filesystem that only has
+			// write_async writes everything right away.
+			if (!filesystem->write) { table[identifier]->options.writeback = 0; }
 			if (!table[identifier]->statfs) { table[identifier]->statfs = (void *)noimp; }
 			if (!table[identifier]->stat) { table[identifier]->stat = (void *)noimp; }
 			if (!table[identifier]->read) { table[identifier]->read = (void *)noimp; }
@@ -182,3 +184,30 @@ static void kfsfilesystem_free(kfsfilesystem_t *filesystem) {
 	free((void *)filesystem->options.mountpoint);
 	free(filesystem);
 }
+
+
+#pragma mark -
+#pragma mark transfer sizes
+// ----------------------------------------------------------------------------------------------------
+// transfer sizes
+// ----------------------------------------------------------------------------------------------------
+
+static size_t kfsfilesystem_transfer_size(unsigned int option, size_t standard);
+static size_t kfsfilesystem_transfer_size(unsigned int option, size_t standard) {
+	size_t size = option ? option : standard;
+	if (size < TRANSFER_MIN_LEN) { size = TRANSFER_MIN_LEN; }
+	if (size > TRANSFER_MAX_LEN) { size = TRANSFER_MAX_LEN; }
+	return size & ~(size_t)(TRANSFER_MIN_LEN - 1); // clients expect a multiple of the page size
+}
+
+size_t kfsfilesystem_rsize(const kfsfilesystem_t *filesystem) {
+	return kfsfilesystem_transfer_size(filesystem->options.rsize, READ_MAX_LEN);
+}
+
+size_t kfsfilesystem_wsize(const kfsfilesystem_t *filesystem) {
+	return kfsfilesystem_transfer_size(filesystem->options.wsize, WRITE_MAX_LEN);
+}
+
+uint64_t kfsfilesystem_attr_timeout(const kfsfilesystem_t *filesystem) {
+	return filesystem->options.attr_timeout ? filesystem->options.attr_timeout : ATTR_TIMEOUT;
+}
@@ -31,6 +31,7 @@
 
 struct kfscontents {
 	const char **entries;
+	kfsstat_t **stats;		// NULL until an entry is appended with attributes
 	uint64_t capacity;
 	uint64_t count;
 };
@@ -67,8 +68,33 @@ const kfsfilesystem_t *kfstable_get(kfsid_t identifier);
  */
 bool kfstable_iterate(kfsid_t *identifier);
 
-#define READ_MAX_LEN	0x10000		/* 64K */
-#define WRITE_MAX_LEN	0x10000		/* 64K */
+/*!
+ \brief		Get a filesystem's read size
+ \details	Gets the most bytes a single read of the filesystem will ask for, from its rsize
+			option (or the default), limited to what's supported.
+ */
+size_t kfsfilesystem_rsize(const kfsfilesystem_t *filesystem);
+
+/*!
+ \brief		Get a filesystem's write size
+ \details	Gets the most bytes a single write to the filesystem will give, from its wsize
+			option (or the default), limited to what's supported.
+ */
+size_t kfsfilesystem_wsize(const kfsfilesystem_t *filesystem);
+
+/*!
+ \brief		Get a filesystem's attribute timeout
+ \details	Gets the milliseconds what stat gives is used before it's called again, from its
+			attr_timeout option (or the default).
+ */
+uint64_t kfsfilesystem_attr_timeout(const kfsfilesystem_t *filesystem);
+
+#define MAX_FIELSYSTEMS	1024
+#define READ_MAX_LEN	0x10000		/* 64K, by default */
+#define WRITE_MAX_LEN	0x10000		/* 64K, by default */
+#define TRANSFER_MIN_LEN	0x01000		/* 4K */
+#define TRANSFER_MAX_LEN	0x100000	/* 1M, the largest read or write size allowed */
 #define DIR_MAX_LEN		0x00800		/* 2048 */
+#define ATTR_TIMEOUT	1000		/* milliseconds, by default */
 
 #endif
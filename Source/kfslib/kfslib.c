@@ -29,6 +29,15 @@
 #include "fileid.h"
 #include "mountargs.h"
 #include "nfs3programs.h"
+#include "threadpool.h"
+#include "transport.h"
+#include "handlecache.h"
+#include "attrcache.h"
+#include "writeback.h"
+#include "readahead.h"
+#include "blockcache.h"
+#include "dircache.h"
+#include "namecache.h"
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
@@ -37,7 +46,6 @@
 #include <sys/param.h>
 #include <sys/mount.h>
 #include <arpa/inet.h>
-#include <rpc/pmap_clnt.h>
 #include <pthread.h>
 
 int _rpcpmstart;
@@ -45,7 +53,11 @@ int _rpcsvcdirty;
 
 const char *kfs_devprefix = "kfs";
 
+#define DEFAULT_THREAD_COUNT 8
+
 static unsigned short g_nfs_port = 0;
+static unsigned int g_thread_count = DEFAULT_THREAD_COUNT;
+static unsigned int g_data_thread_count = 0;
 static void (*g_thread_begin)(void) = NULL;
 static void (*g_thread_end)(void) = NULL;
 
@@ -92,10 +104,10 @@ kfsid_t kfs_mount(const kfsfilesystem_t *filesystem) {
 		.proto = IPPROTO_TCP,
 		.fh = (u_char *)fshandle,
 		.fhsize = strlen(fshandle),
-		.flags = NFSMNT_NFSV3 | NFSMNT_SOFT | NFSMNT_WSIZE | NFSMNT_RSIZE | NFSMNT_READDIRSIZE |
+		.flags = NFSMNT_NFSV3 | NFSMNT_SOFT | NFSMNT_WSIZE | NFSMNT_RSIZE | NFSMNT_READDIRSIZE | NFSMNT_RDIRPLUS |
 				 NFSMNT_TIMEO | NFSMNT_RETRANS | NFSMNT_NOLOCKS | NFSMNT_DEADTIMEOUT | NFSMNT_NOQUOTA,
-		.wsize = WRITE_MAX_LEN,
-		.rsize = READ_MAX_LEN,
+		.wsize = (int)kfsfilesystem_wsize(filesystem),
+		.rsize = (int)kfsfilesystem_rsize(filesystem),
 		.readdirsize = DIR_MAX_LEN,
 		.timeo = 1,
 		.retrans = 4,
@@ -112,8 +124,10 @@ kfsid_t kfs_mount(const kfsfilesystem_t *filesystem) {
 	}
 
 	if (identifier >= 0) {
-		int flags = MNT_SYNCHRONOUS;
-		if (!filesystem->write || !filesystem->create || !filesystem->remove ||
+		// without writeback, the client is asked to make every write stable. with it, the
+		// client sends unstable writes to be buffered and commits them when it needs to.
+		int flags = kfstable_get(identifier)->options.writeback ? 0 : MNT_SYNCHRONOUS;
+		if ((!filesystem->write && !filesystem->write_async) || !filesystem->create || !filesystem->remove ||
 			!filesystem->rename || !filesystem->truncate ||
 			!filesystem->mkdir || !filesystem->rmdir) { flags |= MNT_RDONLY; }
 		if (mount("nfs", filesystem->options.mountpoint, flags, &args) != 0) {
@@ -139,13 +153,46 @@ void kfs_unmount(kfsid_t identifier) {
 		}
 	}
 
-	// remove the entry from our table
+	// write anything buffered, forget data read ahead or cached, close files the filesystem
+	// opened and forget cached attributes and names, then remove the entry from our table
+	kfswriteback_clear(identifier);
+	kfsreadahead_clear(identifier);
+	kfsblockcache_clear(identifier);
+	kfsdircache_clear(identifier);
+	kfshandle_clear(identifier);
+	kfsattrcache_clear(identifier);
+	kfsnamecache_clear(identifier);
 	kfstable_remove(identifier);
 	
 	// free any file ids
 	kfs_idclear(identifier);
 }
 
+void kfs_invalidate(kfsid_t identifier, const char *path) {
+	char parent[PATH_MAX];
+	strlcpy(parent, path, PATH_MAX);
+	char *slash = strrchr(parent, '/');
+	const char *name = slash ? path + (slash - parent) + 1 : path;
+	if (slash == parent) { slash[1] = '\0'; }
+	else if (slash) { *slash = '\0'; }
+
+	// a path without an id has never been given to a client, so only its parent
+	// can have anything cached about it (such as the name not existing)
+	uint64_t fileid = fileid_frompath(identifier, path);
+	if (fileid) {
+		kfsattrcache_invalidate(identifier, fileid);
+		kfsreadahead_invalidate(identifier, fileid);
+		kfsblockcache_invalidate(identifier, fileid);
+		kfsdircache_invalidate(identifier, fileid);
+		kfsnamecache_invalidate(identifier, fileid);
+	}
+	if (strcmp(parent, path) != 0 && (fileid = fileid_frompath(identifier, parent))) {
+		kfsattrcache_invalidate(identifier, fileid);
+		kfsdircache_invalidate(identifier, fileid);
+		kfsnamecache_remove(identifier, fileid, name);
+	}
+}
+
 
 #pragma mark -
 #pragma mark running the nfs server
@@ -153,16 +200,6 @@ void kfs_unmount(kfsid_t identifier) {
 // running the nfs server
 // ----------------------------------------------------------------------------------------------------
 
-static int _kfsrun(void) {
-	if (g_thread_begin) { g_thread_begin(); }
-
-	svc_run();
-	_msgout("svc_run returned unexpectedly");
-	
-	if (g_thread_end) { g_thread_end(); }
-	return 1; // should never reach here
-}
-
 static int kfsrun(void) {
 	// create and bind a new socket for kfs to use
 	int sock = socket(AF_INET, SOCK_STREAM, 0);
@@ -184,27 +221,39 @@ static int kfsrun(void) {
 		return 1;
 	}
 	g_nfs_port = baddr.sin_port;
-	
-	// create the service, then register the nfs and mount programs. we supply
-	// a protocol of 0 here so that the programs aren't registered with portmap
-	// (as per the documentation).
-	SVCXPRT *transp = svctcp_create(sock, 0, 0);
-	if (transp == NULL) {
-		_msgout("cannot create tcp service.");
+
+	if (listen(sock, SOMAXCONN) != 0) {
+		_errout("listen failed.");
 		return 1;
 	}
-	if (!svc_register(transp, NFS_PROGRAM, NFS_V3, nfs_program_3, 0)) {
+	
+	// register the nfs and mount programs. these aren't registered with portmap
+	// since the kernel is given the port directly when mounting.
+	if (!kfstransport_register(NFS_PROGRAM, NFS_V3, nfs_program_3, nfs_route_3, nfs_busy_3)) {
 		_msgout("unable to register (NFS_PROGRAM, NFS_V3, tcp).");
 		return 1;
 	}
-	if (!svc_register(transp, MOUNT_PROGRAM, MOUNT_V3, mount_program_3, 0)) {
+	if (!kfstransport_register(MOUNT_PROGRAM, MOUNT_V3, mount_program_3, NULL, NULL)) {
 		_msgout("unable to register (MOUNT_PROGRAM, MOUNT_V3, tcp).");
 		return 1;
 	}
-	
-	// do the actual run loop on a background thread
-	pthread_t thread;
-	pthread_create(&thread, NULL, (void *(*)(void *))_kfsrun, NULL);
+
+	// requests are read on the transport thread and handled by the workers
+	kfspool_t *pool = kfspool_create(g_thread_count, g_thread_begin, g_thread_end);
+	if (pool == NULL) {
+		_msgout("cannot create worker threads.");
+		return 1;
+	}
+
+	// keep a quarter of the workers free from reads and writes by default so
+	// metadata requests are handled quickly while data is being transferred.
+	unsigned int data_count = g_data_thread_count;
+	if (data_count == 0) { data_count = (g_thread_count > 1) ? g_thread_count - MAX(1, g_thread_count / 4) : 1; }
+	kfspool_set_budget(pool, KFSLANE_DATA, data_count);
+	if (!kfstransport_start(sock, pool)) {
+		_msgout("cannot start tcp transport.");
+		return 1;
+	}
 	
 	return 0;
 }
@@ -224,7 +273,10 @@ void kfscontents_destroy(kfscontents_t *contents) {
 	if (contents) {
 		for (uint64_t i = 0; i < kfscontents_count(contents); i++) {
 			free((void *)kfscontents_at(contents, i));
+			if (contents->stats) { free(contents->stats[i]); }
 		}
+		free(contents->entries);
+		free(contents->stats);
 		free(contents);
 	}
 }
@@ -239,9 +291,11 @@ void kfscontents_append(kfscontents_t *contents, const char *entry) {
 		else { cap *= 2; }
 
 		contents->entries = realloc(contents->entries, sizeof(const char *) * cap);
+		if (contents->stats) { contents->stats = realloc(contents->stats, sizeof(kfsstat_t *) * cap); }
 	}
 	
 	contents->entries[pos] = strdup(entry);
+	if (contents->stats) { contents->stats[pos] = NULL; }
 	contents->capacity = cap;
 	contents->count = len;
 }
@@ -258,6 +312,25 @@ const char *kfscontents_at(kfscontents_t *contents, uint64_t idx) {
 	return entry;
 }
 
+void kfscontents_append_stat(kfscontents_t *contents, const char *entry, const kfsstat_t *stat) {
+	if (contents->stats == NULL) {
+		contents->stats = calloc(contents->capacity ? contents->capacity : 1, sizeof(kfsstat_t *));
+	}
+	kfscontents_append(contents, entry);
+
+	kfsstat_t *copy = malloc(sizeof(kfsstat_t));
+	*copy = *stat;
+	contents->stats[contents->count - 1] = copy;
+}
+
+const kfsstat_t *kfscontents_stat_at(kfscontents_t *contents, uint64_t idx) {
+	const kfsstat_t *stat = NULL;
+	if (idx < contents->count && contents->stats) {
+		stat = contents->stats[idx];
+	}
+	return stat;
+}
+
 
 #pragma mark -
 #pragma mark thread helpers
@@ -267,6 +340,8 @@ const char *kfscontents_at(kfscontents_t *contents, uint64_t idx) {
 
 void kfs_set_thread_begin_callback(void (*fn)(void))  { g_thread_begin = fn; }
 void kfs_set_thread_end_callback(void (*fn)(void)) { g_thread_end = fn; }
+void kfs_set_thread_count(unsigned int count) { g_thread_count = count ? count : 1; }
+void kfs_set_data_thread_count(unsigned int count) { g_data_thread_count = count; }
 
 
 #pragma mark -
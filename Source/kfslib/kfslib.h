@@ -42,6 +42,7 @@ typedef struct kfsstatfs kfsstatfs_t;
 typedef struct kfsoptions kfsoptions_t;
 typedef struct kfstime kfstime_t;
 typedef struct kfscontents kfscontents_t;
+typedef struct kfsreq kfsreq_t;
 
 typedef enum {
 	KFS_REG,
@@ -109,16 +110,18 @@ typedef bool (*kfsstat_f)(const char *path, kfsstat_t *stat, int *error, void *c
 /*!
  \brief		Read from a file
  \details	Read length bytes from the file at path starting at offset. Read the data into the buffer which
-			is guarenteed to be large enough to hold length bytes. Return -1 on error.
+			is guarenteed to be large enough to hold length bytes. Return -1 on error. The handle is the
+			one open gave for the file (or NULL if open isn't set), as it is for every callback below
+			that takes one.
  */
-typedef ssize_t (*kfsread_f)(const char *path, char *buf, size_t offset, size_t length, int *error, void *context);
+typedef ssize_t (*kfsread_f)(const char *path, void *handle, char *buf, size_t offset, size_t length, int *error, void *context);
 
 /*!
  \brief		Write to a file
  \details	Write length bytes to the file at path starting at offset. Write the data from the buffer which
 			is guarenteed to be large enough to hold length bytes. Return -1 on error.
  */
-typedef ssize_t (*kfswrite_f)(const char *path, const char *buf, size_t offset, size_t length, int *error, void *context);
+typedef ssize_t (*kfswrite_f)(const char *path, void *handle, const char *buf, size_t offset, size_t length, int *error, void *context);
 
 /*!
  \brief		Create a symbolic link
@@ -152,11 +155,34 @@ typedef bool (*kfsremove_f)(const char *path, int *error, void *context);
  */
 typedef bool (*kfsrename_f)(const char *path, const char *new_path, int *error, void *context);
 
+/*!
+ \brief		Open a file
+ \details	Open the file at path for reading and writing (or just reading if that's all that's
+			allowed) and set handle to whatever you need to use it. The handle is passed to
+			read, write and truncate, and is kept open while the file is in use and for a few
+			seconds after, so a run of reads or writes opens the file once. It may be used
+			from several threads at once.
+ */
+typedef bool (*kfsopen_f)(const char *path, void **handle, int *error, void *context);
+
+/*!
+ \brief		Release a file
+ \details	Close the handle from open. The file at path may have been removed or renamed since.
+ */
+typedef void (*kfsrelease_f)(const char *path, void *handle, void *context);
+
+/*!
+ \brief		Check whether a file may be cached
+ \details	Return whether data read from the file at path may be kept for later reads. Return
+			false for files whose contents change without going through the filesystem.
+ */
+typedef bool (*kfscacheable_f)(const char *path, void *context);
+
 /*!
  \brief		Resize a file
  \details	Resize the file to the given size.
  */
-typedef bool (*kfstruncate_f)(const char *path, uint64_t size, int *error, void *context);
+typedef bool (*kfstruncate_f)(const char *path, void *handle, uint64_t size, int *error, void *context);
 
 /*!
  \brief		Change mode for a file
@@ -190,12 +216,103 @@ typedef bool (*kfsrmdir_f)(const char *path, int *error, void *context);
  */
 typedef bool (*kfsreaddir_f)(const char *path, kfscontents_t *contents, int *error, void *context);
 
+/*!
+ \brief		Get a directory's contents with attributes
+ \details	Like readdir, but add each entry along with its attributes by calling
+			kfscontents_append_stat, as stat would get them. Listing a directory with
+			attributes is much faster this way than with a stat for every entry. Without
+			this, readdir and stat are used.
+ */
+typedef bool (*kfsreaddirplus_f)(const char *path, kfscontents_t *contents, int *error, void *context);
+
+/*!
+ \brief		Start reading a directory
+ \details	Begin reading the contents of the directory at path a page at a time, and return a
+			cursor for readdir_next to pick up from. When after is set, start with the entry
+			that follows the entry of that name, which may no longer exist (so start where it
+			would have been). Return NULL on error.
+ */
+typedef void *(*kfsopendir_f)(const char *path, const char *after, int *error, void *context);
+
+/*!
+ \brief		Read the next entries of a directory
+ \details	Add up to max entries that follow those already read with the cursor to the contents,
+			by calling kfscontents_append (or kfscontents_append_stat). Set eof once there are no
+			more entries. Adding none is taken as the end of the directory, too.
+ */
+typedef bool (*kfsreaddir_next_f)(void *cursor, kfscontents_t *contents, uint64_t max, bool *eof, int *error, void *context);
+
+/*!
+ \brief		Finish reading a directory
+ \details	Called once a cursor from opendir won't be used any more.
+ */
+typedef void (*kfsclosedir_f)(void *cursor, void *context);
+
+/*!
+ \brief		Read from a file asynchronously
+ \details	Like read, but the read does not need to be done before returning. Call kfs_complete
+			with the request once the read has finished (from any thread), passing the number of
+			bytes read or -1 and an error. The path and buffer remain valid until then.
+ */
+typedef void (*kfsread_async_f)(const char *path, void *handle, char *buf, size_t offset, size_t length, kfsreq_t *req, void *context);
+
+/*!
+ \brief		Write to a file asynchronously
+ \details	Like write, but the write does not need to be done before returning. Call kfs_complete
+			with the request once the write has finished (from any thread), passing the number of
+			bytes written or -1 and an error. The path and buffer remain valid until then.
+ */
+typedef void (*kfswrite_async_f)(const char *path, void *handle, const char *buf, size_t offset, size_t length, kfsreq_t *req, void *context);
+
+/*!
+ \brief		Read from a file without copying
+ \details	Like read, but rather than copying into a buffer, point buf at the file's contents
+			starting at offset in memory you already have (a cache or a mapped file, for
+			instance). Return the number of bytes available there, up to length, or -1 on
+			error. The data is sent straight from that memory, which must remain valid until
+			release_buffer is called with buf (or, if that's not set, for as long as the
+			filesystem is mounted).
+ */
+typedef ssize_t (*kfsread_buffer_f)(const char *path, void *handle, const char **buf, size_t offset, size_t length, int *error, void *context);
+
+/*!
+ \brief		Release memory from read_buffer
+ \details	Called once the data at buf, returned by read_buffer, has been sent.
+ */
+typedef void (*kfsrelease_buffer_f)(const char *buf, void *context);
+
+/*!
+ \brief		Read from a file by descriptor
+ \details	Like read, but rather than reading the data yourself, give an open file descriptor
+			and the offset in it where the data starting at offset is found. Return the number
+			of bytes available there, up to length, or -1 on error. The data is sent straight
+			from the descriptor to the kernel (with sendfile), without being copied through
+			memory. The descriptor must remain open until release_file is called with it (or,
+			if that's not set, for as long as you like).
+ */
+typedef ssize_t (*kfsread_file_f)(const char *path, void *handle, size_t offset, size_t length, int *fd, off_t *fdoffset, int *error, void *context);
+
+/*!
+ \brief		Release a descriptor from read_file
+ \details	Called once the data from the descriptor returned by read_file has been sent.
+ */
+typedef void (*kfsrelease_file_f)(int fd, void *context);
+
 /*!
  \brief		
  \details	
  */
 struct kfsoptions {
 	const char *mountpoint;
+	unsigned int concurrency; // most requests handled at once for this filesystem (0 for the default of 4; readahead and writeback call read and write outside of this)
+	unsigned int busy_timeout; // milliseconds before a slow request is retried later (0 to always wait)
+	unsigned int writeback; // kilobytes of unstable writes buffered per file and written later with write (0, or no write, to write right away)
+	unsigned int write_chunk; // kilobytes of buffered data in a row that's written at once (0 to wait until the buffer is full)
+	unsigned int readahead; // most kilobytes read in the background ahead of sequential reads with read (0 to not read ahead)
+	unsigned int block_cache; // most kilobytes read with read that are kept for reading again (0 to not keep any)
+	unsigned int rsize; // most bytes read at once (0 for the default of 64K, up to 1M)
+	unsigned int wsize; // most bytes written at once (0 for the default of 64K, up to 1M)
+	unsigned int attr_timeout; // milliseconds attributes from stat are used before stat is called again (0 for the default of 1000)
 };
 
 /*!
@@ -205,6 +322,23 @@ struct kfsoptions {
 				- No support for users/groups on files
 				- No support for creating special file types
 				- No support for hard links
+			
+			The asynchronous callbacks are optional. When one is set, it is used instead of its
+			synchronous counterpart. Likewise, read_file or read_buffer (in that order) is used
+			instead of read when it's set (but not when read_async is).
+			
+			Open and release are optional as well. Without them, the handle passed to the
+			other callbacks is NULL.
+			
+			Cacheable is optional too. Without it, data from every file is cached when the
+			block_cache option is set.
+			
+			Opendir, readdir_next and closedir are optional, but must be set together. When
+			they are, they're used instead of readdir and readdirplus. Clients are then given a
+			directory as they ask for it, a page at a time, and the whole directory isn't held
+			in memory. A cursor is kept where a client's page ended and picked up by its next
+			one. Otherwise (if it's been a while, for instance) a new cursor is opened after the
+			last entry the client was given.
  */
 struct kfsfilesystem {
 	kfsstatfs_f statfs;
@@ -222,6 +356,19 @@ struct kfsfilesystem {
 	kfsmkdir_f mkdir;
 	kfsrmdir_f rmdir;
 	kfsreaddir_f readdir;
+	kfsreaddirplus_f readdirplus;
+	kfsread_async_f read_async;
+	kfswrite_async_f write_async;
+	kfsread_buffer_f read_buffer;
+	kfsrelease_buffer_f release_buffer;
+	kfsread_file_f read_file;
+	kfsrelease_file_f release_file;
+	kfsopen_f open;
+	kfsrelease_f release;
+	kfscacheable_f cacheable;
+	kfsopendir_f opendir;
+	kfsreaddir_next_f readdir_next;
+	kfsclosedir_f closedir;
 	kfsoptions_t options;
 	void *context;
 };
@@ -243,6 +390,16 @@ kfsid_t kfs_mount(const kfsfilesystem_t *filesystem);
  */
 void kfs_unmount(kfsid_t identifier);
 
+/*!
+ \brief		Invalidate cached information about a file
+ \details	Call this when the file or directory at path is changed other than through the mounted
+			filesystem. Its attributes, data read from it and its listing won't be used from the
+			cache again. The attributes and listing of its parent directory are forgotten as well,
+			since adding, removing or changing a file changes those too, along with whether its
+			name exists.
+ */
+void kfs_invalidate(kfsid_t identifier, const char *path);
+
 /*!
  \brief		KFS device name prefix
  \details	Name used when mounting devices.
@@ -312,6 +469,28 @@ uint64_t kfscontents_count(kfscontents_t *contents);
  */
 const char *kfscontents_at(kfscontents_t *contents, uint64_t index);
 
+/*!
+ \brief		Append an entry with attributes
+ \details	Like kfscontents_append, but also keeps a copy of the entry's attributes.
+ */
+void kfscontents_append_stat(kfscontents_t *contents, const char *entry, const kfsstat_t *stat);
+
+/*!
+ \brief		Get the attributes of an entry in a content listing
+ \details	Get the attributes of an entry in a content listing. This method returns NULL
+			if the index is out of range or the entry was appended without attributes.
+ */
+const kfsstat_t *kfscontents_stat_at(kfscontents_t *contents, uint64_t index);
+
+/*!
+ \brief		Complete an asynchronous request
+ \details	Call this exactly once for each request given to an asynchronous callback. It can
+			be called from any thread, including from within the callback itself. The result
+			and error have the same meaning as the return value and error of the synchronous
+			callback. The request must not be used after this call.
+ */
+void kfs_complete(kfsreq_t *req, ssize_t result, int error);
+
 /*!@}*/
 
 
@@ -325,6 +504,23 @@ const char *kfscontents_at(kfscontents_t *contents, uint64_t index);
 void kfs_set_thread_begin_callback(void (*)(void));
 void kfs_set_thread_end_callback(void (*)(void));
 
+/*!
+ \brief		Set the number of worker threads
+ \details	Filesystem requests are handled on a pool of worker threads, so your callbacks may
+			be called concurrently (for the same or different filesystems). The begin and end
+			callbacks are called once on each worker. The default is 8 workers.
+ */
+void kfs_set_thread_count(unsigned int count);
+
+/*!
+ \brief		Set the number of workers used for data
+ \details	Limits how many workers can be reading or writing file data at once. The rest remain
+			available for metadata requests (stat, lookup, directory listings, etc.) so that they
+			stay responsive during large transfers. The default (or 0) is three quarters of the
+			workers.
+ */
+void kfs_set_data_thread_count(unsigned int count);
+
 /*!@}*/
 
 
@@ -40,6 +40,7 @@
 #define	NFSMNT_WSIZE		0x00000002  /* set write size */
 #define	NFSMNT_RSIZE		0x00000004  /* set read size */
 #define	NFSMNT_READDIRSIZE	0x00020000  /* Set readdir size */
+#define	NFSMNT_RDIRPLUS		0x00010000  /* Use Readdirplus for V3 */
 #define	NFSMNT_TIMEO		0x00000008  /* set initial timeout */
 #define	NFSMNT_RETRANS		0x00000010  /* set number of request retries */
 #define	NFSMNT_INT			0x00000040  /* allow interrupts on hard mount */
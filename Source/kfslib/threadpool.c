@@ -0,0 +1,240 @@
+//
+//  threadpool.c
+//  KFS
+//
+//  Copyright (c) 2012, FadingRed LLC
+//  All rights reserved.
+//  
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+//  following conditions are met:
+//  
+//    - Redistributions of source code must retain the above copyright notice, this list of conditions and the
+//      following disclaimer.
+//    - Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+//      following disclaimer in the documentation and/or other materials provided with the distribution.
+//    - Neither the name of the FadingRed LLC nor the names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior written permission.
+//  
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+//  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "threadpool.h"
+
+struct kfsqueue {
+	kfspool_t *pool;
+	kfslane_t lane;
+	unsigned int limit;		// for every queue sharing it (only set on the group)
+	unsigned int running;	// for every queue sharing the limit (only set on the group)
+	bool scheduled;		// waiting for its turn in the pool
+	kfsjob_t *head;
+	kfsjob_t *tail;
+	kfsqueue_t *next;
+	kfsqueue_t *group;		// the queue whose limit this one shares (itself if none)
+	kfsqueue_t *sibling;	// the next queue sharing the group's limit
+};
+
+struct kfspool {
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	kfsqueue_t *first[KFSLANE_COUNT];	// queues that can start a job, in the order they get a turn
+	kfsqueue_t *last[KFSLANE_COUNT];
+	unsigned int running[KFSLANE_COUNT];
+	unsigned int budget[KFSLANE_COUNT];
+	kfsqueue_t *queue;					// the default queue
+	void (*begin)(void);
+	void (*end)(void);
+};
+
+
+#pragma mark -
+#pragma mark scheduling
+// ----------------------------------------------------------------------------------------------------
+// scheduling
+// ----------------------------------------------------------------------------------------------------
+
+// whether the queue's group has room for another job. the pool must be locked.
+static bool kfsqueue_allowed_nolock(kfsqueue_t *queue);
+static bool kfsqueue_allowed_nolock(kfsqueue_t *queue) {
+	kfsqueue_t *group = queue->group;
+	return group->limit == 0 || group->running < group->limit;
+}
+
+// give the queue a turn (at the back of the line in its lane) if it has a job
+// that's allowed to start. the pool must be locked.
+static void kfsqueue_schedule_nolock(kfsqueue_t *queue);
+static void kfsqueue_schedule_nolock(kfsqueue_t *queue) {
+	kfspool_t *pool = queue->pool;
+	kfslane_t lane = queue->lane;
+	if (!queue->scheduled && queue->head && kfsqueue_allowed_nolock(queue)) {
+		queue->scheduled = true;
+		queue->next = NULL;
+		if (pool->last[lane]) { pool->last[lane]->next = queue; }
+		else { pool->first[lane] = queue; }
+		pool->last[lane] = queue;
+		pthread_cond_signal(&pool->ready);
+	}
+}
+
+// give every queue in the group a turn that has a job allowed to start. the pool
+// must be locked.
+static void kfsqueue_schedule_group_nolock(kfsqueue_t *group);
+static void kfsqueue_schedule_group_nolock(kfsqueue_t *group) {
+	for (kfsqueue_t *queue = group; queue; queue = queue->sibling) { kfsqueue_schedule_nolock(queue); }
+}
+
+// take the next queue whose turn it is from the first lane that has one and is
+// within its budget. a queue whose group filled up since it was given its turn
+// loses it, and gets another once a job in the group finishes. the pool must be
+// locked.
+static kfsqueue_t *kfspool_next_nolock(kfspool_t *pool);
+static kfsqueue_t *kfspool_next_nolock(kfspool_t *pool) {
+	for (int lane = 0; lane < KFSLANE_COUNT; lane++) {
+		while (pool->first[lane] && pool->running[lane] < pool->budget[lane]) {
+			kfsqueue_t *queue = pool->first[lane];
+			pool->first[lane] = queue->next;
+			if (pool->first[lane] == NULL) { pool->last[lane] = NULL; }
+			queue->scheduled = false;
+			if (kfsqueue_allowed_nolock(queue)) { return queue; }
+		}
+	}
+	return NULL;
+}
+
+
+#pragma mark -
+#pragma mark workers
+// ----------------------------------------------------------------------------------------------------
+// workers
+// ----------------------------------------------------------------------------------------------------
+
+static void *kfspool_work(kfspool_t *pool);
+static void *kfspool_work(kfspool_t *pool) {
+	if (pool->begin) { pool->begin(); }
+
+	while (true) {
+		pthread_mutex_lock(&pool->lock);
+		kfsqueue_t *queue = NULL;
+		while ((queue = kfspool_next_nolock(pool)) == NULL) {
+			pthread_cond_wait(&pool->ready, &pool->lock);
+		}
+
+		// each queue starts one job per turn
+		kfsjob_t *job = queue->head;
+		queue->head = job->next;
+		if (queue->head == NULL) { queue->tail = NULL; }
+		queue->group->running++;
+		pool->running[queue->lane]++;
+		kfsqueue_schedule_nolock(queue);
+		pthread_mutex_unlock(&pool->lock);
+
+		job->next = NULL;
+		job->perform(job); // the job may be freed once this returns
+
+		pthread_mutex_lock(&pool->lock);
+		queue->group->running--;
+		pool->running[queue->lane]--;
+		kfsqueue_schedule_group_nolock(queue->group);
+		if (pool->first[queue->lane]) { pthread_cond_signal(&pool->ready); } // room in the budget
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	if (pool->end) { pool->end(); }
+	return NULL; // should never reach here
+}
+
+
+#pragma mark -
+#pragma mark function implementation
+// ----------------------------------------------------------------------------------------------------
+// function implementation
+// ----------------------------------------------------------------------------------------------------
+
+kfspool_t *kfspool_create(unsigned int count, void (*begin)(void), void (*end)(void)) {
+	kfspool_t *pool = calloc(1, sizeof(kfspool_t));
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->ready, NULL);
+	pool->begin = begin;
+	pool->end = end;
+	pool->queue = kfsqueue_create(pool, KFSLANE_METADATA, 0);
+	for (int lane = 0; lane < KFSLANE_COUNT; lane++) { pool->budget[lane] = count; }
+
+	unsigned int started = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, (void *(*)(void *))kfspool_work, pool) == 0) {
+			pthread_detach(thread);
+			started++;
+		}
+	}
+
+	if (started == 0) {
+		pthread_cond_destroy(&pool->ready);
+		pthread_mutex_destroy(&pool->lock);
+		free(pool->queue);
+		free(pool);
+		pool = NULL;
+	}
+
+	return pool;
+}
+
+void kfspool_set_budget(kfspool_t *pool, kfslane_t lane, unsigned int budget) {
+	pthread_mutex_lock(&pool->lock);
+	pool->budget[lane] = budget ? budget : 1;
+	pthread_cond_broadcast(&pool->ready);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void kfspool_submit(kfspool_t *pool, kfsjob_t *job) {
+	kfsqueue_submit(pool->queue, job);
+}
+
+kfsqueue_t *kfsqueue_create(kfspool_t *pool, kfslane_t lane, unsigned int limit) {
+	kfsqueue_t *queue = calloc(1, sizeof(kfsqueue_t));
+	queue->pool = pool;
+	queue->lane = lane;
+	queue->limit = limit;
+	queue->group = queue;
+	return queue;
+}
+
+kfsqueue_t *kfsqueue_create_shared(kfsqueue_t *other, kfslane_t lane) {
+	kfspool_t *pool = other->pool;
+	kfsqueue_t *queue = calloc(1, sizeof(kfsqueue_t));
+	queue->pool = pool;
+	queue->lane = lane;
+	pthread_mutex_lock(&pool->lock);
+	queue->group = other->group;
+	queue->sibling = other->group->sibling;
+	other->group->sibling = queue;
+	pthread_mutex_unlock(&pool->lock);
+	return queue;
+}
+
+void kfsqueue_set_limit(kfsqueue_t *queue, unsigned int limit) {
+	kfspool_t *pool = queue->pool;
+	pthread_mutex_lock(&pool->lock);
+	queue->group->limit = limit;
+	kfsqueue_schedule_group_nolock(queue->group);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void kfsqueue_submit(kfsqueue_t *queue, kfsjob_t *job) {
+	kfspool_t *pool = queue->pool;
+	job->next = NULL;
+	pthread_mutex_lock(&pool->lock);
+	if (queue->tail) { queue->tail->next = job; }
+	else { queue->head = job; }
+	queue->tail = job;
+	kfsqueue_schedule_nolock(queue);
+	pthread_mutex_unlock(&pool->lock);
+}
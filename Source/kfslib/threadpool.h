@@ -0,0 +1,110 @@
+//
+//  threadpool.h
+//  KFS
+//
+//  Copyright (c) 2012, FadingRed LLC
+//  All rights reserved.
+//  
+//  Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+//  following conditions are met:
+//  
+//    - Redistributions of source code must retain the above copyright notice, this list of conditions and the
+//      following disclaimer.
+//    - Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+//      following disclaimer in the documentation and/or other materials provided with the distribution.
+//    - Neither the name of the FadingRed LLC nor the names of its contributors may be used to endorse or promote
+//      products derived from this software without specific prior written permission.
+//  
+//  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+//  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+//  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+//  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+//  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+//  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+//  USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _KFSTHREADPOOL_H_
+#define _KFSTHREADPOOL_H_
+
+#include "kfslib.h"
+
+typedef struct kfspool kfspool_t;
+typedef struct kfsjob kfsjob_t;
+typedef struct kfsqueue kfsqueue_t;
+
+/*!
+ \brief		Lanes
+ \details	Every queue belongs to a lane. Each lane has a budget of workers it may use at
+			once, and when workers are free, lanes earlier in this list are served first.
+ */
+typedef enum {
+	KFSLANE_METADATA,
+	KFSLANE_DATA,
+	KFSLANE_COUNT,
+} kfslane_t;
+
+/*!
+ \brief		A unit of work
+ \details	Embed this in the structure describing the work to be done and set
+			perform. The pool does not allocate or free jobs.
+ */
+struct kfsjob {
+	void (*perform)(kfsjob_t *job);
+	kfsjob_t *next;
+};
+
+/*!
+ \brief		Create a pool
+ \details	Creates a pool with count worker threads. The begin and end functions (which
+			may be NULL) are called once on each worker as it starts and stops. Returns
+			NULL if no workers could be started. Every lane may use all of the workers
+			until its budget is set.
+ */
+kfspool_t *kfspool_create(unsigned int count, void (*begin)(void), void (*end)(void));
+
+/*!
+ \brief		Set a lane's budget
+ \details	Limits the number of workers performing jobs from the lane at once.
+ */
+void kfspool_set_budget(kfspool_t *pool, kfslane_t lane, unsigned int budget);
+
+/*!
+ \brief		Submit a job
+ \details	Queues the job on the pool's default queue, which is in the metadata lane
+			and has no limit.
+ */
+void kfspool_submit(kfspool_t *pool, kfsjob_t *job);
+
+/*!
+ \brief		Create a queue
+ \details	Creates a queue of jobs for the pool. Jobs in a queue are started in the order
+			they are submitted, and no more than limit of them (0 for no limit) are performed
+			at once. Workers take turns between queues that have jobs ready to start, so a
+			queue with a lot of work (or slow work) can't starve the others. Queues live as
+			long as the pool.
+ */
+kfsqueue_t *kfsqueue_create(kfspool_t *pool, kfslane_t lane, unsigned int limit);
+
+/*!
+ \brief		Create a queue sharing another's limit
+ \details	Creates a queue of jobs for the same pool as other, in the given lane. No more than
+			the limit of other are performed at once from it, other and any other queues that
+			share the limit, all together.
+ */
+kfsqueue_t *kfsqueue_create_shared(kfsqueue_t *other, kfslane_t lane);
+
+/*!
+ \brief		Change the limit of a queue
+ \details	Changes the limit for every queue that shares it. Jobs already running are not
+			affected.
+ */
+void kfsqueue_set_limit(kfsqueue_t *queue, unsigned int limit);
+
+/*!
+ \brief		Submit a job to a queue
+ \details	Queues the job to be performed on one of the workers.
+ */
+void kfsqueue_submit(kfsqueue_t *queue, kfsjob_t *job);
+
+#endif